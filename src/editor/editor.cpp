@@ -9,18 +9,28 @@ Selection::Selection() {}
 void Selection::Deselect()
 {
     object.reset();
+    objects.clear();
     if(onSelectionChanged) onSelectionChanged();
 }
 
 void Selection::SetSelection(std::shared_ptr<Object> object)
 {
-    if(object != this->object.lock())
+    if(object != this->object.lock() || objects.size() != 1)
     {
         this->object = object; 
+        objects.assign(1, object);
         if(onSelectionChanged) onSelectionChanged();
     }
 }
 
+void Selection::SetSelection(const std::vector<std::shared_ptr<Object>> & objects)
+{
+    if(objects.empty()) return Deselect();
+    object = objects.front();
+    this->objects.assign(begin(objects), end(objects));
+    if(onSelectionChanged) onSelectionChanged();
+}
+
 //////////////
 // Draggers //
 //////////////
@@ -38,6 +48,20 @@ public:
         auto viewY = 1 - (pixel.y - rect.y0) * 2.0f / rect.GetHeight();
         return Ray::Between(TransformCoordinate(invViewProj, {viewX, viewY, -1}), TransformCoordinate(invViewProj, {viewX, viewY, 1}));
     }
+
+    Frustum ComputeFrustum(const int2 & corner0, const int2 & corner1) const
+    {
+        float3 nearCorners[4], farCorners[4];
+        const int2 corners[] = {corner0, {corner1.x, corner0.y}, corner1, {corner0.x, corner1.y}};
+        for(int i=0; i<4; ++i)
+        {
+            auto viewX = (corners[i].x - rect.x0) * 2.0f / rect.GetWidth() - 1;
+            auto viewY = 1 - (corners[i].y - rect.y0) * 2.0f / rect.GetHeight();
+            nearCorners[i] = TransformCoordinate(invViewProj, {viewX, viewY, -1});
+            farCorners[i] = TransformCoordinate(invViewProj, {viewX, viewY, 1});
+        }
+        return Frustum::Between(nearCorners, farCorners);
+    }
 };
 
 class LinearTranslationDragger : public gui::IDragger
@@ -109,6 +133,39 @@ public:
     void OnCancel() override { object.localScale = initialScale; }
 };
 
+// Forwards to a dragger which changes the pose or scale of an object, keeping the object's matrices and its bounds in the scene up to date
+class SceneObjectDragger : public gui::IDragger
+{
+    Scene & scene;
+    Object & object;
+    gui::DraggerPtr dragger;
+
+    void Update() { object.InvalidateMatrices(); scene.UpdateObjectBounds(object); }
+public:
+    SceneObjectDragger(Scene & scene, Object & object, gui::DraggerPtr dragger) : scene(scene), object(object), dragger(dragger) {}
+
+    void OnDrag(int2 newMouse) override { dragger->OnDrag(newMouse); Update(); }
+    bool OnKey(int key, int action, int mods) override { return dragger->OnKey(key, action, mods); }
+    void OnRelease() override { dragger->OnRelease(); }
+    void OnCancel() override { dragger->OnCancel(); Update(); }
+};
+
+class BoxSelectDragger : public gui::IDragger
+{
+    View & view;
+    Raycaster caster;
+public:
+    BoxSelectDragger(View & view, const Raycaster & caster, const int2 & click) : view(view), caster(caster) { view.boxStart = view.boxEnd = click; }
+
+    void OnDrag(int2 newMouse) override { view.boxEnd = newMouse; view.isBoxSelecting = std::abs(view.boxEnd.x - view.boxStart.x) > 2 || std::abs(view.boxEnd.y - view.boxStart.y) > 2; }
+    void OnRelease() override 
+    { 
+        if(view.isBoxSelecting) view.selection.SetSelection(view.scene.Select(caster.ComputeFrustum(view.boxStart, view.boxEnd), &view.threads));
+        view.isBoxSelecting = false;
+    }
+    void OnCancel() override { view.isBoxSelecting = false; }
+};
+
 class MouselookDragger : public gui::IDragger
 {
     View & view;
@@ -154,57 +211,83 @@ NVGcolor View::OnDrawBackground(const gui::DrawEvent & e) const
     auto view = LookAtMatrixRh(viewpoint.position, viewpoint.position + viewpoint.Ydir(), viewpoint.Zdir());
     auto viewProj = mul(proj, view);
     
-    gl::Buffer buf;
-    if(auto b = selection.arrowProg->GetNamedBlock("PerView"))
+    // Write the uniform blocks of the whole frame, so that they reach the GPU in a single upload before anything is drawn
+    auto & uniforms = renderContext.uniforms;
+    gl::UniformRange perView = {0,0};
+    auto & perViewBlock = selection.arrowProg->perView;
+    if(perViewBlock.binding >= 0)
     {
-        std::vector<GLubyte> data(b->dataSize);
-        b->SetUniform(data.data(), "u_eye", viewpoint.position);
-        b->SetUniform(data.data(), "u_viewProj", viewProj);
-        buf.SetData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STREAM_DRAW);
-        buf.BindBase(GL_UNIFORM_BUFFER, b->binding);
+        perView = uniforms.Allocate(perViewBlock.dataSize);
+        perViewBlock.eye.Set(uniforms.GetData(perView), viewpoint.position);
+        perViewBlock.viewProj.Set(uniforms.GetData(perView), viewProj);
     }
 
-    RenderContext ctx;
-    scene.Draw(ctx);
+    renderContext.frustum = Frustum::FromMatrix(viewProj);
+    scene.WriteUniforms(renderContext, &threads);
 
-    if(auto obj = selection.object.lock())
+    std::vector<std::pair<std::shared_ptr<Object>, gl::UniformRange>> outlines;
+    for(auto & selected : selection.objects)
     {
-        glPushAttrib(GL_ALL_ATTRIB_BITS);
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        glDepthFunc(GL_LEQUAL);
-        glEnable(GL_POLYGON_OFFSET_LINE);
-        glPolygonOffset(-1, -1);
-        auto prog = obj->prog;
-        obj->prog = selection.selectionProgram;
-        obj->Draw();
-        obj->prog = prog;
-        glPopAttrib();
+        if(auto obj = selected.lock()) outlines.push_back({obj, obj->WriteUniforms(uniforms, *selection.selectionProgram)});
+    }
 
-        glClear(GL_DEPTH_BUFFER_BIT);
-        for(auto & axis : {float3(1,0,0), float3(0,1,0), float3(0,0,1)})
+    auto gizmoObject = selection.object.lock();
+    gl::UniformRange gizmoAxes[3];
+    auto & gizmoBlock = selection.arrowProg->perObject;
+    if(gizmoObject && gizmoBlock.binding >= 0)
+    {
+        const float3 axes[] = {{1,0,0}, {0,1,0}, {0,0,1}};
+        for(int i=0; i<3; ++i)
         {
-            auto model = (obj->pose * Pose({0,0,0}, RotationQuaternionFromToVec({0,0,1}, axis))).Matrix();
-            auto color = axis * 0.4f + 0.1f;
+            auto pose = gizmoObject->pose * Pose({0,0,0}, RotationQuaternionFromToVec({0,0,1}, axes[i]));
+            auto color = axes[i] * 0.4f + 0.1f;
+            gizmoAxes[i] = uniforms.Allocate(gizmoBlock.dataSize);
+            auto data = uniforms.GetData(gizmoAxes[i]);
+            gizmoBlock.model.Set(data, pose.Matrix());
+            gizmoBlock.modelIT.Set(data, ScaledNormalMatrix({1,1,1}, pose.orientation, pose.position));
+            gizmoBlock.diffuse.Set(data, color);
+            gizmoBlock.emissive.Set(data, color*0.5f);
+        }
+    }
 
-            gl::Buffer buf;
-            if(auto b = selection.arrowProg->GetNamedBlock("PerObject"))
-            {
-                std::vector<GLubyte> data(b->dataSize);
-                b->SetUniform(data.data(), "u_model", model);
-                b->SetUniform(data.data(), "u_modelIT", inv(transpose(model)));
-                b->SetUniform(data.data(), "u_diffuse", color);
-                b->SetUniform(data.data(), "u_emissive", color*0.5f);
-                buf.SetData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STREAM_DRAW);
-                buf.BindBase(GL_UNIFORM_BUFFER, b->binding);
-            }
+    uniforms.Upload();
+
+    if(perViewBlock.binding >= 0) uniforms.Bind(perView, perViewBlock.binding);
+    renderContext.eye = viewpoint.position;
+    scene.Draw(renderContext);
+
+    glPushAttrib(GL_ALL_ATTRIB_BITS);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    glDepthFunc(GL_LEQUAL);
+    glEnable(GL_POLYGON_OFFSET_LINE);
+    glPolygonOffset(-1, -1);
+    for(auto & outline : outlines) outline.first->Draw(uniforms, outline.second, *selection.selectionProgram);
+    glPopAttrib();
 
-            selection.arrowProg->Use();
+    if(gizmoObject)
+    {
+        glClear(GL_DEPTH_BUFFER_BIT);
+        for(auto & axis : gizmoAxes)
+        {
+            if(gizmoBlock.binding >= 0) uniforms.Bind(axis, gizmoBlock.binding);
+            selection.arrowProg->program.Use();
             GetGizmoMesh().Draw();
         }
     }
 
     glPopAttrib();
 
+    if(isBoxSelecting)
+    {
+        nvgBeginPath(e.vg);
+        nvgRect(e.vg, std::min(boxStart.x, boxEnd.x) + 0.5f, std::min(boxStart.y, boxEnd.y) + 0.5f, std::abs(boxEnd.x - boxStart.x), std::abs(boxEnd.y - boxStart.y));
+        nvgFillColor(e.vg, nvgRGBA(255,255,255,32));
+        nvgFill(e.vg);
+        nvgStrokeColor(e.vg, nvgRGBA(255,255,255,192));
+        nvgStrokeWidth(e.vg, 1);
+        nvgStroke(e.vg);
+    }
+
     if(e.hasFocus)
     {
 	    nvgBeginPath(e.vg);
@@ -227,6 +310,11 @@ static gui::DraggerPtr CreateGizmoDragger(View::Mode mode, Object & obj, Raycast
     }
 }
 
+static gui::DraggerPtr CreateGizmoDragger(View::Mode mode, Scene & scene, Object & obj, Raycaster caster, const float3 & axis, const int2 & cursor)
+{
+    return std::make_shared<SceneObjectDragger>(scene, obj, CreateGizmoDragger(mode, obj, caster, axis, cursor));
+}
+
 gui::DraggerPtr View::OnClick(const gui::MouseEvent & e)
 {
     // Mouselook when the user drags the right mouse button
@@ -248,7 +336,7 @@ gui::DraggerPtr View::OnClick(const gui::MouseEvent & e)
                 auto hit = GetGizmoMesh().Hit(localRay);
                 if(hit.hit && (!best || hit.t < bestT))
                 {
-                    best = CreateGizmoDragger(mode, *obj, caster, axis, e.cursor);
+                    best = CreateGizmoDragger(mode, scene, *obj, caster, axis, e.cursor);
                     bestT = hit.t;
                 }                    
             }
@@ -257,9 +345,12 @@ gui::DraggerPtr View::OnClick(const gui::MouseEvent & e)
 
         // Otherwise see if we have selected a new object
         if(auto obj = scene.Hit(ray)) selection.SetSelection(obj);
-        else selection.Deselect();
-
-        // If we did not click on an object directly, perhaps we should box select?             
+        else
+        {
+            // If we did not click on an object directly, drag out a box to select the objects inside it
+            selection.Deselect();
+            return std::make_shared<BoxSelectDragger>(*this, caster, e.cursor);
+        }
     }
 
     return nullptr;
@@ -275,7 +366,7 @@ const Mesh & View::GetGizmoMesh() const
     }
 }  
 
-View::View(Scene & scene, Selection & selection) : scene(scene), selection(selection) {}
+View::View(Scene & scene, Selection & selection, ThreadPool & threads) : scene(scene), selection(selection), threads(threads) {}
 
 bool View::OnKey(GLFWwindow * window, int key, int action, int mods)
 {
@@ -319,18 +410,20 @@ static Mesh MakeBox(const float3 & halfDims)
     return mesh;
 }
 
+#include "engine/file.h"
+
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
 Editor::Editor() : window("Editor", 1280, 720), font(window.GetNanoVG(), "../assets/Roboto-Bold.ttf", 18, true, 0x500), factory(font, 2), quit()
 {
-    assets.SetLoader<Mesh>([](const std::string & id) -> Mesh
+    assets.SetLoader<Mesh>([this](const std::string & id) -> Mesh
     {
-        return LoadMeshFromObj("../assets/"+id+".obj", true);
+        return LoadMeshFromObjCached("../assets/"+id+".obj", true, &threads);
     });
 
-    assets.SetLoader<gl::Program>([](const std::string & id) -> gl::Program
+    assets.SetLoader<Shader>([](const std::string & id) -> Shader
     {
         std::string shaderPrelude = R"(#version 420
 struct PointLight
@@ -347,18 +440,47 @@ layout(binding = 2) uniform PerView
     mat4 u_viewProj;
     vec3 u_eye;
 };
+)";
+
+        // Assets which contain "#pragma instanced" leave the per-object values to the prelude, and read them in the vertex shader only. They are
+        // built twice, reading the values from the PerObject block, and from per-instance attributes matching InstanceData.
+        std::string perObjectPrelude = R"(// Attribute locations 4 to 13 are reserved for the per-instance values below, and must not be declared by assets
+#ifdef INSTANCED
+#ifdef VERT_SHADER
+layout(location = 4) in mat4 u_model;
+layout(location = 8) in mat4 u_modelIT;
+layout(location = 12) in vec3 u_diffuse;
+layout(location = 13) in vec3 u_emissive;
+#endif
+#else
+layout(binding = 0) uniform PerObject
+{
+    mat4 u_model;
+    mat4 u_modelIT;
+    vec3 u_emissive;
+    vec3 u_diffuse;
+};
+#endif
 )";
 
         auto source = LoadTextFile("../assets/" + id + ".glsl");
-        auto vs = shaderPrelude + "#define VERT_SHADER\n" + source;
-        auto fs = shaderPrelude + "#define FRAG_SHADER\n" + source;
-        return gl::Program(vs, fs);
+        if(source.find("#pragma instanced") == std::string::npos)
+        {
+            auto vs = shaderPrelude + "#define VERT_SHADER\n" + source;
+            auto fs = shaderPrelude + "#define FRAG_SHADER\n" + source;
+            return Shader(gl::Program(vs, fs));
+        }
+        auto vs = shaderPrelude + "#define VERT_SHADER\n" + perObjectPrelude + source;
+        auto fs = shaderPrelude + "#define FRAG_SHADER\n" + perObjectPrelude + source;
+        auto ivs = shaderPrelude + "#define VERT_SHADER\n#define INSTANCED\n" + perObjectPrelude + source;
+        auto ifs = shaderPrelude + "#define FRAG_SHADER\n#define INSTANCED\n" + perObjectPrelude + source;
+        return Shader(gl::Program(vs, fs), gl::Program(ivs, ifs));
     });
 
-    view = std::make_shared<View>(scene, selection);
+    view = std::make_shared<View>(scene, selection, threads);
 
-    auto prog = assets.GetAsset<gl::Program>("simple");
-    selection.selectionProgram = assets.GetAsset<gl::Program>("white");
+    auto prog = assets.GetAsset<Shader>("simple");
+    selection.selectionProgram = assets.GetAsset<Shader>("white");
 
     selection.arrowMesh.AddCylinder({0,0,0}, 0.00f, {0,0,0}, 0.05f, {1,0,0}, {0,1,0}, 12);
     selection.arrowMesh.AddCylinder({0,0,0}, 0.05f, {0,0,1}, 0.05f, {1,0,0}, {0,1,0}, 12);
@@ -422,7 +544,9 @@ int Editor::Run()
 
 void Editor::LoadScene(const std::string & filepath)
 {
-    scene = DeserializeFromJson<Scene>(jsonFrom(LoadTextFile(filepath)), assets);
+    MappedFile file(filepath);
+    JsonReader reader(file.begin(), file.end()); // Objects are loaded as the mapping is paged in, without building a document tree
+    scene = DeserializeFromJson<Scene>(reader, assets);
     RefreshObjectList();
 }
 
@@ -441,7 +565,10 @@ void Editor::RefreshMenu()
             }),
             {"Save", [this](){ 
                 auto f = ChooseFile({{"Scene files","scene"}}, false);
-                if(!f.empty()) std::ofstream(f, std::ofstream::binary) << tabbed(SerializeToJson(scene), 4);
+                if(f.empty()) return;
+                std::ofstream out(f, std::ofstream::binary);
+                JsonWriter writer(out, 4);
+                SerializeToJson(writer, scene);
             }, GLFW_MOD_CONTROL, GLFW_KEY_S},
             {"Exit", [this]() { quit = true; }, GLFW_MOD_ALT, GLFW_KEY_F4}
         }),
@@ -452,7 +579,7 @@ void Editor::RefreshMenu()
         }),
         gui::MenuItem::Popup("Object", {
             {"New", [this]() { 
-                scene.CreateObject("New Object", {0,0,0}, {0.5f,0.5f,0.5f}, assets.GetAsset<Mesh>("cube"), assets.GetAsset<gl::Program>("diffuse"), {1,1,1});
+                scene.CreateObject("New Object", {0,0,0}, {0.5f,0.5f,0.5f}, assets.GetAsset<Mesh>("cube"), assets.GetAsset<Shader>("diffuse"), {1,1,1});
                 RefreshObjectList();
             }},
             {"Duplicate", [this]() { 
@@ -501,10 +628,12 @@ void Editor::RefreshPropertyPanel()
             scene.objects[selectedIndex]->name = text;
             objectList->SetItemText(selectedIndex, text);
         })});
-        props.push_back({"Position", factory.MakeVectorEdit(obj->pose.position)});
-        props.push_back({"Orientation", factory.MakeVectorEdit(obj->pose.orientation)});
-        props.push_back({"Scale", factory.MakeVectorEdit(obj->localScale)});
-        props.push_back({"Mesh", factory.MakeAssetHandleEdit(assets, obj->mesh)});
+        auto updateTransform = [this, obj]() { obj->InvalidateMatrices(); scene.UpdateObjectBounds(*obj); };
+        auto updateBounds = [this, obj]() { scene.UpdateObjectBounds(*obj); };
+        props.push_back({"Position", factory.MakeVectorEdit(obj->pose.position, updateTransform)});
+        props.push_back({"Orientation", factory.MakeVectorEdit(obj->pose.orientation, updateTransform)});
+        props.push_back({"Scale", factory.MakeVectorEdit(obj->localScale, updateTransform)});
+        props.push_back({"Mesh", factory.MakeAssetHandleEdit(assets, obj->mesh, updateBounds)});
         props.push_back({"Program", factory.MakeAssetHandleEdit(assets, obj->prog)});
         props.push_back({"Diffuse Color", factory.MakeVectorEdit(obj->color)});
         auto pmap = factory.MakePropertyMap(props);
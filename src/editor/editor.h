@@ -2,10 +2,12 @@
 #include "widgets.h"
 #include "xplat.h"
 #include "scene.h"
+#include "engine/parallel.h"
 
 struct Selection
 {
-    std::weak_ptr<Object> object;
+    std::weak_ptr<Object> object;                   // Object shown in the property panel and moved by the gizmo
+    std::vector<std::weak_ptr<Object>> objects;     // Every selected object, starting with object
     ProgramHandle selectionProgram;
 
     Mesh arrowMesh, circleMesh, scaleMesh;
@@ -16,6 +18,7 @@ struct Selection
 
     void Deselect();
     void SetSelection(std::shared_ptr<Object> object);
+    void SetSelection(const std::vector<std::shared_ptr<Object>> & objects);
 };
 
 struct View : public gui::Element
@@ -24,14 +27,18 @@ struct View : public gui::Element
 
     Scene & scene;
     Selection & selection;
+    ThreadPool & threads;
     Pose viewpoint;
     float yaw=0,pitch=0;
     bool bf=0,bl=0,bb=0,br=0;
     Mode mode=Translation;
+    bool isBoxSelecting=false;
+    int2 boxStart, boxEnd;
+    mutable RenderContext renderContext;            // Keeps the uniform ring from frame to frame
 
     const Mesh & GetGizmoMesh() const;
 
-    View(Scene & scene, Selection & selection);
+    View(Scene & scene, Selection & selection, ThreadPool & threads);
 
     bool OnKey(GLFWwindow * window, int key, int action, int mods) override;
     void OnUpdate(float timestep);
@@ -44,6 +51,7 @@ struct View : public gui::Element
 class Editor
 {
     Window                                  window;
+    ThreadPool                              threads;
     AssetLibrary                            assets;
     Font                                    font;
     GuiFactory                              factory;
@@ -0,0 +1,18 @@
+#include "engine/load.h"
+
+// Kept apart from scene.cpp, so that the tests, which run without a GL context, can link the scene and supply their own Upload and Draw
+
+void Mesh::Upload()
+{       
+    bvh.reset();
+    ComputeBounds();
+    glMesh.SetVertices(vertices);
+    glMesh.SetAttribute(0, &Vertex::position);
+    glMesh.SetAttribute(1, &Vertex::normal);
+    glMesh.SetElements(triangles);
+}
+
+void Mesh::Draw() const
+{
+    glMesh.Draw();
+}
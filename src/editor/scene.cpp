@@ -1,77 +1,418 @@
 #include "scene.h"
+#include "engine/parallel.h"
 
+#include <map>
 #include <sstream>
 
-void LightEnvironment::Bind(gl::Buffer & buffer, const gl::BlockDesc & perScene) const
+Shader::Shader(gl::Program && program, gl::Program && instanced) : program(std::move(program)), instanced(std::move(instanced))
 {
-    std::vector<GLubyte> dataBuffer(perScene.dataSize);    
-    for(size_t i=0; i<lights.size(); ++i)
+    for(auto & block : this->program.GetBlocks())
     {
-        std::ostringstream ss; ss << "u_lights[" << i << "]"; auto obj = ss.str();
-        perScene.SetUniform(dataBuffer.data(), obj+".position", lights[i].position);
-        perScene.SetUniform(dataBuffer.data(), obj+".color", lights[i].color);
+        if(block.name == "PerScene")
+        {
+            perScene.binding = block.binding;
+            perScene.dataSize = block.dataSize;
+            for(size_t i=0; ; ++i)
+            {
+                std::ostringstream ss; ss << "u_lights[" << i << "]"; auto obj = ss.str();
+                if(!block.GetNamedUniform(obj+".position") && !block.GetNamedUniform(obj+".color")) break;
+                perScene.lights.push_back({{block, obj+".position"}, {block, obj+".color"}});
+            }
+        }
+        if(block.name == "PerView")
+        {
+            perView.binding = block.binding;
+            perView.dataSize = block.dataSize;
+            perView.eye = {block, "u_eye"};
+            perView.viewProj = {block, "u_viewProj"};
+        }
+        if(block.name == "PerObject")
+        {
+            perObject.binding = block.binding;
+            perObject.dataSize = block.dataSize;
+            perObject.model = {block, "u_model"};
+            perObject.modelIT = {block, "u_modelIT"};
+            perObject.diffuse = {block, "u_diffuse"};
+            perObject.emissive = {block, "u_emissive"};
+        }
+    }
+}
+
+gl::UniformRange LightEnvironment::Write(gl::UniformRing & uniforms, const PerSceneBlock & perScene) const
+{
+    auto range = uniforms.Allocate(perScene.dataSize);
+    auto data = uniforms.GetData(range);
+    for(size_t i=0; i<lights.size() && i<perScene.lights.size(); ++i)
+    {
+        perScene.lights[i].position.Set(data, lights[i].position);
+        perScene.lights[i].color.Set(data, lights[i].color);
+    }
+    return range;
+}
+
+const float4x4 & Object::GetModelMatrix() const
+{
+    if(!matricesValid)
+    {
+        modelMatrix = ScaledTransformationMatrix(localScale, pose.orientation, pose.position);
+        normalMatrix = ScaledNormalMatrix(localScale, pose.orientation, pose.position);
+        matricesValid = true;
     }
+    return modelMatrix;
+}
 
-    buffer.SetData(GL_UNIFORM_BUFFER, dataBuffer.size(), dataBuffer.data(), GL_STREAM_DRAW);
-    buffer.BindBase(GL_UNIFORM_BUFFER, perScene.binding);
+const float4x4 & Object::GetNormalMatrix() const
+{
+    GetModelMatrix();
+    return normalMatrix;
 }
 
-void Mesh::Upload()
-{       
-    glMesh.SetVertices(vertices);
-    glMesh.SetAttribute(0, &Vertex::position);
-    glMesh.SetAttribute(1, &Vertex::normal);
-    glMesh.SetElements(triangles);
+gl::UniformRange Object::WriteUniforms(gl::UniformRing & uniforms, const Shader & shader) const
+{
+    auto & b = shader.perObject;
+    if(b.binding < 0 || !mesh) return {0,0};
+    auto range = uniforms.Allocate(b.dataSize);
+    auto data = uniforms.GetData(range);
+    b.model.Set(data, GetModelMatrix());
+    b.modelIT.Set(data, GetNormalMatrix());
+    b.diffuse.Set(data, color);
+    if(light) b.emissive.Set(data, light->color);
+    return range;
 }
 
-void Mesh::Draw() const
+void Object::Draw(const gl::UniformRing & uniforms, const gl::UniformRange & perObject, const Shader & shader) const
 {
-    glMesh.Draw();
+    if(!mesh) return;
+    if(shader.perObject.binding >= 0) uniforms.Bind(perObject, shader.perObject.binding);
+    shader.program.Use();
+    mesh->Draw();
 }
 
-void Object::Draw()
+RenderContext::RenderContext()
 {
-    if(!prog || !mesh) return;
+    instances.SetAttribute(4, &InstanceData::model);
+    instances.SetAttribute(8, &InstanceData::modelIT);
+    instances.SetAttribute(12, &InstanceData::diffuse);
+    instances.SetAttribute(13, &InstanceData::emissive);
+}
 
-    auto model = ScaledTransformationMatrix(localScale, pose.orientation, pose.position);
+static Bounds ComputeWorldBounds(const Object & obj)
+{
+    if(!obj.mesh || obj.mesh->triangles.empty()) return {};
+    auto local = obj.mesh->bounds.Padded(); // As the triangle bounds of the mesh's own BVH are, without building it
+    if(local.IsEmpty()) return {};
+    Bounds bounds;
+    for(int i=0; i<8; ++i) bounds.Include(obj.pose.TransformCoord(float3(i&1 ? local.max.x : local.min.x, i&2 ? local.max.y : local.min.y, i&4 ? local.max.z : local.min.z) * obj.localScale));
+    return bounds.Padded(); // Covers rounding in the transformation of rays into local space by Object::Hit
+}
 
-    gl::Buffer buf;
-    if(auto b = prog->GetNamedBlock("PerObject"))
+void Scene::RebuildBvh()
+{
+    std::vector<Bounds> bounds;
+    std::vector<uint32_t> indices;
+    for(uint32_t i=0; i<objects.size(); ++i)
     {
-        std::vector<GLubyte> data(b->dataSize);
-        b->SetUniform(data.data(), "u_model", model);
-        b->SetUniform(data.data(), "u_modelIT", inv(transpose(model)));
-        b->SetUniform(data.data(), "u_diffuse", color);
-        if(light) b->SetUniform(data.data(), "u_emissive", light->color);
-        buf.SetData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STREAM_DRAW);
-        buf.BindBase(GL_UNIFORM_BUFFER, b->binding);
+        auto b = ComputeWorldBounds(*objects[i]);
+        if(b.IsEmpty()) continue; // Objects without triangles can never be hit
+        bounds.push_back(b);
+        indices.push_back(i);
     }
-    
-    prog->Use();
-    mesh->Draw();
+
+    // Objects are expensive to test, so split down to one object per leaf wherever the centroids allow
+    bvhNodes = BuildBvh(bounds, bvhObjects, 1);
+    for(auto & index : bvhObjects) index = indices[index];
+    bvhParents.assign(bvhNodes.size(), UINT32_MAX);
+    bvhLeaves.clear();
+    for(uint32_t i=0; i<bvhNodes.size(); ++i)
+    {
+        auto & node = bvhNodes[i];
+        if(node.count) for(auto j=node.index; j<node.index+node.count; ++j) bvhLeaves[objects[bvhObjects[j]].get()] = i;
+        else bvhParents[i+1] = bvhParents[node.index] = i;
+    }
+    bvhDirty = false;
+}
+
+void Scene::UpdateObjectBounds(const Object & object)
+{
+    if(bvhDirty) return;
+    auto it = bvhLeaves.find(&object);
+    if(it == end(bvhLeaves) || !object.mesh) { bvhDirty = true; return; } // The object is entering or leaving the hierarchy
+
+    // Refit the leaf holding the object, then each of its ancestors, leaving the structure of the hierarchy untouched
+    auto & leaf = bvhNodes[it->second];
+    Bounds bounds;
+    for(auto i=leaf.index; i<leaf.index+leaf.count; ++i) bounds.Include(ComputeWorldBounds(*objects[bvhObjects[i]]));
+    if(bounds.IsEmpty()) { bvhDirty = true; return; }
+    leaf.min = bounds.min;
+    leaf.max = bounds.max;
+    for(auto parent = bvhParents[it->second]; parent != UINT32_MAX; parent = bvhParents[parent])
+    {
+        auto & node = bvhNodes[parent], & first = bvhNodes[parent+1], & second = bvhNodes[node.index];
+        Bounds b(first.min, first.max);
+        b.Include(second.min, second.max);
+        node.min = b.min;
+        node.max = b.max;
+    }
+}
+
+static uint32_t HitObject(const Scene & scene, const Ray & ray)
+{
+    uint32_t best = UINT32_MAX;
+    float bestT = INFINITY;
+    TraverseBvh(scene.bvhNodes, ray, bestT, [&](const BvhNode & node)
+    {
+        for(auto i=node.index; i<node.index+node.count; ++i)
+        {
+            auto index = scene.bvhObjects[i];
+            auto hit = scene.objects[index]->Hit(ray);
+            if(hit.hit && (hit.t < bestT || (hit.t == bestT && index < best)))
+            {
+                best = index;
+                bestT = hit.t;
+            }
+        }
+    });
+    return best;
 }
 
 std::shared_ptr<Object> Scene::Hit(const Ray & ray)
 {
-    std::shared_ptr<Object> best = nullptr;
-    float bestT = 0;
-    for(auto & obj : objects)
+    if(bvhDirty) RebuildBvh();
+    auto best = HitObject(*this, ray);
+    return best != UINT32_MAX ? objects[best] : nullptr;
+}
+
+void Scene::Hit(const Ray * rays, size_t count, std::shared_ptr<Object> * hits, ThreadPool * threads)
+{
+    if(bvhDirty) RebuildBvh();
+    enum { RaysPerTask = 64 };
+    ParallelFor(threads, (count + RaysPerTask - 1) / RaysPerTask, [&](size_t task)
+    {
+        for(size_t i=task*RaysPerTask, end=std::min<size_t>(i+RaysPerTask, count); i<end; ++i)
+        {
+            auto best = HitObject(*this, rays[i]);
+            hits[i] = best != UINT32_MAX ? objects[best] : nullptr;
+        }
+    });
+}
+
+static bool ContainsMesh(const Frustum & frustum, const Object & obj)
+{
+    // Move the planes into the object's local space, where p' = pose * (localScale * p) gives dot(n, p') + d = dot(localScale * n', p) + d'
+    Frustum local;
+    auto invOrientation = qinv(obj.pose.orientation);
+    for(auto & plane : frustum.planes) local.planes.push_back(Plane(qrot(invOrientation, plane.GetNormal()) * obj.localScale, dot(plane.GetNormal(), obj.pose.position) + plane.coeff.w));
+
+    // A box of the mesh's hierarchy which lies wholly outside holds triangle corners outside, so look for one before scanning every vertex.
+    // Boxes which lie wholly inside need not be searched further.
+    auto bvh = obj.mesh->GetBvh();
+    auto & nodes = bvh->GetNodes();
+    uint32_t stack[BvhMaxDepth+1], size = 0;
+    if(!nodes.empty()) stack[size++] = 0;
+    while(size)
+    {
+        auto index = stack[--size];
+        auto & node = nodes[index];
+        auto overlap = GetOverlap(local, Bounds(node.min, node.max));
+        if(overlap == Overlap::Outside) return false;
+        if(overlap == Overlap::Partial && node.count == 0)
+        {
+            stack[size++] = node.index;
+            stack[size++] = index + 1;
+        }
+    }
+
+    for(auto & vertex : obj.mesh->vertices) if(!local.Contains(vertex.position)) return false;
+    return true;
+}
+
+std::vector<std::shared_ptr<Object>> Scene::Select(const Frustum & frustum, ThreadPool * threads)
+{
+    if(bvhDirty) RebuildBvh();
+
+    // Objects in subtrees whose bounds lie inside the frustum are selected outright, and those in leaves which cross it are checked vertex by vertex
+    std::vector<uint8_t> selected(objects.size());
+    std::vector<uint32_t> candidates;
+    struct Entry { uint32_t node; bool inside; };
+    std::vector<Entry> stack;
+    if(!bvhNodes.empty()) stack.push_back({0, false});
+    while(!stack.empty())
     {
-        auto hit = obj->Hit(ray);
-        if(hit.hit && (!best || hit.t < bestT))
+        auto entry = stack.back();
+        stack.pop_back();
+        auto & node = bvhNodes[entry.node];
+        if(!entry.inside)
+        {
+            auto overlap = GetOverlap(frustum, Bounds(node.min, node.max));
+            if(overlap == Overlap::Outside) continue;
+            entry.inside = overlap == Overlap::Inside;
+        }
+        if(node.count == 0)
+        {
+            stack.push_back({node.index, entry.inside});
+            stack.push_back({entry.node + 1, entry.inside});
+        }
+        else for(auto i=node.index; i<node.index+node.count; ++i)
         {
-            best = obj;
-            bestT = hit.t;
+            if(entry.inside) selected[bvhObjects[i]] = 1;
+            else candidates.push_back(bvhObjects[i]);
         }
     }
-    return best;
+    ParallelFor(threads, candidates.size(), [&](size_t i) { selected[candidates[i]] = ContainsMesh(frustum, *objects[candidates[i]]); });
+
+    std::vector<std::shared_ptr<Object>> result;
+    for(size_t i=0; i<objects.size(); ++i) if(selected[i]) result.push_back(objects[i]);
+    return result;
 }
 
-void Scene::Draw(RenderContext & ctx)
+enum { ObjectsPerTask = 256 }; // Objects per task of the loops over every object which run in parallel
+
+size_t Scene::UpdateMatrices(ThreadPool * threads)
+{
+    // Recompute the matrices of the objects which have moved since they were last drawn, gathering the parts of their transforms into arrays
+    // for the batched kernel. Static objects keep their matrices from earlier frames.
+    std::vector<Object *> moved;
+    for(auto & obj : objects) if(!obj->matricesValid) moved.push_back(obj.get());
+    const size_t count = moved.size();
+    std::vector<float3> scales(count), positions(count);
+    std::vector<float4> orientations(count);
+    std::vector<float4x4> models(count), normalMatrices(count);
+    ParallelFor(threads, (count + ObjectsPerTask - 1) / ObjectsPerTask, [&](size_t task)
+    {
+        const size_t first = task*ObjectsPerTask, last = std::min<size_t>(first+ObjectsPerTask, count);
+        for(size_t i=first; i<last; ++i)
+        {
+            scales[i] = moved[i]->localScale;
+            orientations[i] = moved[i]->pose.orientation;
+            positions[i] = moved[i]->pose.position;
+        }
+        ComputeScaledTransformationMatrices(last-first, &scales[first], &orientations[first], &positions[first], &models[first], &normalMatrices[first]);
+        for(size_t i=first; i<last; ++i)
+        {
+            moved[i]->modelMatrix = models[i];
+            moved[i]->normalMatrix = normalMatrices[i];
+            moved[i]->matricesValid = true;
+        }
+    });
+    return count;
+}
+
+void Scene::WriteUniforms(RenderContext & ctx, ThreadPool * threads)
 {
     LightEnvironment lights;
     for(auto & obj : objects) if(obj->light) lights.lights.push_back({obj->pose.position, obj->light->color});
-    if(!objects.empty()) lights.Bind(ctx.perScene, *objects[0]->prog->GetNamedBlock("PerScene"));
+    ctx.perSceneBinding = -1;
+    if(!objects.empty() && objects[0]->prog && objects[0]->prog->perScene.binding >= 0)
+    {
+        ctx.perScene = lights.Write(ctx.uniforms, objects[0]->prog->perScene);
+        ctx.perSceneBinding = objects[0]->prog->perScene.binding;
+    }
 
-    for(auto & obj : objects) obj->Draw();
+    UpdateMatrices(threads);
+
+    // Cull the objects whose meshes lie outside the frustum. Each mesh's box is carried into world space by the object's model matrix, and the
+    // boxes are stored in an array for each component, so that they can be tested in SIMD lanes. Objects whose meshes have no vertices are
+    // hidden without being tested.
+    ctx.visible.assign(objects.size(), 1);
+    ctx.counters = RenderContext::Counters();
+    if(!ctx.frustum.planes.empty())
+    {
+        std::vector<uint32_t> tested;
+        for(uint32_t i=0; i<objects.size(); ++i)
+        {
+            auto & obj = *objects[i];
+            if(!obj.prog || !obj.mesh) continue;
+            if(obj.mesh->bounds.IsEmpty()) ctx.visible[i] = 0;
+            else tested.push_back(i);
+        }
+        ctx.objectBounds.Resize(tested.size());
+        std::vector<uint8_t> visible(tested.size());
+        std::vector<size_t> culled((tested.size() + ObjectsPerTask - 1) / ObjectsPerTask);
+        ParallelFor(threads, culled.size(), [&](size_t task)
+        {
+            const size_t first = task*ObjectsPerTask, last = std::min<size_t>(first+ObjectsPerTask, tested.size());
+            for(size_t i=first; i<last; ++i)
+            {
+                auto & obj = *objects[tested[i]];
+                auto & m = obj.GetModelMatrix();
+                auto & local = obj.mesh->bounds;
+                auto c = local.GetCenter(), e = (local.max - local.min) * 0.5f;
+                float3 center = m.x.xyz()*c.x + m.y.xyz()*c.y + m.z.xyz()*c.z + m.w.xyz(), extent;
+                for(int j=0; j<3; ++j) extent[j] = std::abs(m.x[j])*e.x + std::abs(m.y[j])*e.y + std::abs(m.z[j])*e.z;
+                ctx.objectBounds.Set(i, center, extent);
+            }
+            culled[task] = CullBoxes(ctx.frustum, ctx.objectBounds, first, last, visible.data());
+            for(size_t i=first; i<last; ++i) ctx.visible[tested[i]] = visible[i];
+        });
+        ctx.counters.tested = tested.size();
+        for(auto count : culled) ctx.counters.culled += count;
+    }
+
+    // Objects whose shaders have an instanced variant are gathered into a group for each pair of shader and mesh, and write their values into
+    // the group's run of instances in place of a uniform block of their own, so that each group takes a single draw
+    struct Slot { size_t group, index; };
+    std::vector<Slot> slots(objects.size(), Slot{SIZE_MAX, 0});
+    std::map<std::pair<const Shader *, const Mesh *>, size_t> groups;
+    auto lastGroup = groups.end();
+    ctx.perObject.assign(objects.size(), gl::UniformRange{0,0});
+    ctx.instanceGroups.clear();
+    for(size_t i=0; i<objects.size(); ++i)
+    {
+        auto & obj = *objects[i];
+        if(!obj.prog || !ctx.visible[i]) continue;
+        if(!obj.prog->instanced.IsValid() || !obj.mesh) { ctx.perObject[i] = obj.WriteUniforms(ctx.uniforms, *obj.prog); continue; }
+        auto key = std::make_pair(&*obj.prog, &*obj.mesh);
+        if(lastGroup == groups.end() || lastGroup->first != key) // Objects sharing a group are often listed together
+        {
+            lastGroup = groups.find(key);
+            if(lastGroup == groups.end())
+            {
+                lastGroup = groups.insert({key, ctx.instanceGroups.size()}).first;
+                ctx.instanceGroups.push_back({key.first, key.second, 0, 0});
+            }
+        }
+        slots[i] = {lastGroup->second, ctx.instanceGroups[lastGroup->second].count++};
+    }
+    size_t instanceCount = 0;
+    for(auto & group : ctx.instanceGroups) { group.first = instanceCount; instanceCount += group.count; }
+    ctx.instanceData.resize(instanceCount);
+    ParallelFor(threads, (objects.size() + ObjectsPerTask - 1) / ObjectsPerTask, [&](size_t task)
+    {
+        for(size_t i=task*ObjectsPerTask, end=std::min<size_t>(i+ObjectsPerTask, objects.size()); i<end; ++i)
+        {
+            if(slots[i].group == SIZE_MAX) continue;
+            auto & obj = *objects[i];
+            ctx.instanceData[ctx.instanceGroups[slots[i].group].first + slots[i].index] = {obj.GetModelMatrix(), obj.GetNormalMatrix(), obj.color, obj.light ? obj.light->color : float3(0,0,0)};
+        }
+    });
+    if(instanceCount) ctx.instances.SetInstances(ctx.instanceData);
+}
+
+void Scene::Draw(RenderContext & ctx) const
+{
+    GLRenderBackend backend(ctx.uniforms);
+    Draw(ctx, backend);
+}
+
+void Scene::Draw(RenderContext & ctx, IRenderBackend & backend) const
+{
+    if(ctx.perSceneBinding >= 0) backend.BindUniforms(ctx.perSceneBinding, ctx.perScene);
+
+    // Submit the draws sorted by program, mesh and depth, so that objects which share state are drawn together. Instance groups are drawn by a
+    // single draw each, which has no depth of its own.
+    ctx.queue.Clear();
+    for(size_t i=0; i<objects.size(); ++i)
+    {
+        auto & obj = *objects[i];
+        if(!obj.prog || !obj.mesh || !ctx.visible[i] || obj.prog->instanced.IsValid()) continue;
+        auto offset = obj.pose.position - ctx.eye;
+        ctx.queue.Add({&obj.prog->program, &obj.mesh->glMesh, obj.prog->perObject.binding, ctx.perObject[i], nullptr, 0, 0}, dot(offset, offset));
+    }
+    ctx.counters.drawn = ctx.queue.GetSize();
+    for(auto & group : ctx.instanceGroups)
+    {
+        ctx.queue.Add({&group.shader->instanced, &group.mesh->glMesh, -1, {0,0}, &ctx.instances, group.first, static_cast<GLsizei>(group.count)}, 0);
+        ctx.counters.drawn += group.count;
+    }
+    ctx.queue.Submit(backend);
 }
\ No newline at end of file
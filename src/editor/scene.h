@@ -4,15 +4,57 @@
 #include "engine/asset.h"
 #include "engine/load.h"
 #include "engine/pack.h"
+#include "engine/render.h"
+
+#include <unordered_map>
+
+// Uniforms of the blocks which the editor writes, resolved when a program is loaded. Blocks the program does not declare have a binding of -1.
+struct PerSceneBlock
+{
+    struct Light { gl::Uniform<float3> position, color; };
+    GLint binding = -1, dataSize = 0;
+    std::vector<Light> lights;
+};
+struct PerViewBlock
+{
+    GLint binding = -1, dataSize = 0;
+    gl::Uniform<float3> eye;
+    gl::Uniform<float4x4> viewProj;
+};
+struct PerObjectBlock
+{
+    GLint binding = -1, dataSize = 0;
+    gl::Uniform<float4x4> model, modelIT;
+    gl::Uniform<float3> diffuse, emissive;
+};
+
+// Per-instance values read by the instanced variant of a shader, at the attribute locations declared by the shader prelude
+struct InstanceData
+{
+    float4x4 model, modelIT;
+    float3 diffuse, emissive;
+};
+
+struct Shader
+{
+    gl::Program program;
+    gl::Program instanced;  // Variant which reads InstanceData in place of the PerObject block, if the asset opted in to instancing
+    PerSceneBlock perScene;
+    PerViewBlock perView;
+    PerObjectBlock perObject;
+
+    Shader(gl::Program && program, gl::Program && instanced = gl::Program()); // Throws if the program declares one of the editor's uniforms with a different type
+    Shader(Shader && r) : program(std::move(r.program)), instanced(std::move(r.instanced)), perScene(std::move(r.perScene)), perView(r.perView), perObject(r.perObject) {}
+};
 
 typedef AssetLibrary::Handle<Mesh> MeshHandle;
-typedef AssetLibrary::Handle<gl::Program> ProgramHandle;
+typedef AssetLibrary::Handle<Shader> ProgramHandle;
 
 struct PointLight { float3 position, color; };
 struct LightEnvironment
 {
     std::vector<PointLight> lights;
-    void Bind(gl::Buffer & buffer, const gl::BlockDesc & perScene) const;
+    gl::UniformRange Write(gl::UniformRing & uniforms, const PerSceneBlock & perScene) const;
 };
 
 struct LightComponent { float3 color; };
@@ -30,34 +72,89 @@ struct Object
 
     std::unique_ptr<LightComponent> light;
 
+    // World matrices, recomputed on first use after InvalidateMatrices, which must be called after changing pose or localScale. Objects
+    // start out invalid, which covers those created by deserialization or copying.
+    mutable float4x4 modelMatrix, normalMatrix;
+    mutable bool matricesValid = false;
+
     Object() {}
     Object(const Object & r) : name(r.name), pose(r.pose), localScale(r.localScale), color(r.color), mesh(r.mesh), prog(r.prog), light(r.light ? std::make_unique<LightComponent>(*r.light) : nullptr) {}
 
     RayMeshHit Hit(const Ray & ray) const
     { 
-        if(!mesh) return RayMeshHit({false}, 0);
+        if(!mesh) return RayMeshHit();
         auto localRay = pose.Inverse() * ray;
         localRay.start /= localScale;
         localRay.direction /= localScale;
         return mesh->Hit(localRay); 
     }
 
-    void Draw();
+    const float4x4 & GetModelMatrix() const;
+    const float4x4 & GetNormalMatrix() const;               // Inverse transpose of GetModelMatrix, which transforms normals
+    void InvalidateMatrices() { matricesValid = false; }
+
+    // Writes the PerObject block of program, returning an empty range if there is nothing to draw, then draws once the block is uploaded
+    gl::UniformRange WriteUniforms(gl::UniformRing & uniforms, const Shader & shader) const;
+    void Draw(const gl::UniformRing & uniforms, const gl::UniformRange & perObject, const Shader & shader) const;
 };
 template<class F> void VisitFields(Object & o, F f) { f("name", o.name); f("pose", o.pose); f("scale", o.localScale); f("diffuse", o.color); f("mesh", o.mesh); f("prog", o.prog); f("light", o.light); }
 
+// Objects sharing an instanced shader and a mesh, whose values are a run of RenderContext::instanceData
+struct InstanceGroup
+{
+    const Shader * shader;
+    const Mesh * mesh;
+    size_t first, count;
+};
+
+// Uniform blocks and instances of a frame. Rendering culls the objects outside the frustum, writes the blocks of the whole frame, uploads them
+// together, and then draws.
 struct RenderContext
 {
-    gl::Buffer perScene;
+    struct Counters { size_t tested, culled, drawn; };
+
+    Frustum frustum;                                        // Region seen by the viewer, or no planes to draw every object
+    BoxArrays objectBounds;                                 // World bounds of the objects tested against the frustum
+    std::vector<uint8_t> visible;                           // For each object in the scene
+    Counters counters;                                      // Objects tested against the frustum, culled by it, and drawn, in the last frame
+    gl::UniformRing uniforms;
+    gl::UniformRange perScene;
+    GLint perSceneBinding = -1;
+    std::vector<gl::UniformRange> perObject;                // For each object in the scene, empty for those drawn as instances
+    std::vector<InstanceData> instanceData;
+    std::vector<InstanceGroup> instanceGroups;
+    gl::InstanceBuffer instances;
+    float3 eye;                                             // Position of the viewer, from which draws are ordered front to back
+    RenderQueue queue;
+
+    RenderContext();
 };
 
 struct Scene
 {
     std::vector<std::shared_ptr<Object>> objects;
 
-    std::shared_ptr<Object> Hit(const Ray & ray);
+    // Hierarchy over the world bounds of the objects which have meshes, whose leaves defer to the hierarchy of each mesh. It is rebuilt by the
+    // first query after objects are created or deleted, and refit by UpdateObjectBounds.
+    std::vector<BvhNode> bvhNodes;
+    std::vector<uint32_t> bvhParents;                       // Parent of each node, or UINT32_MAX for the root
+    std::vector<uint32_t> bvhObjects;                       // Index into objects of the items of each leaf, in leaf order
+    std::unordered_map<const Object *, uint32_t> bvhLeaves; // Leaf holding each object
+    bool bvhDirty = true;
+
+    std::shared_ptr<Object> Hit(const Ray & ray);           // Returns the closest object hit, favoring the earliest in objects on ties
+    void Hit(const Ray * rays, size_t count, std::shared_ptr<Object> * hits, ThreadPool * threads = nullptr); // Hit for each ray, in parallel
+
+    // Returns the objects whose meshes lie entirely within the frustum, in the order of objects
+    std::vector<std::shared_ptr<Object>> Select(const Frustum & frustum, ThreadPool * threads = nullptr);
+
+    void UpdateObjectBounds(const Object & object);         // Must be called after changing the pose, localScale, or mesh of an object
+    void RebuildBvh();
 
-    void Draw(RenderContext & ctx);
+    size_t UpdateMatrices(ThreadPool * threads = nullptr);   // Recomputes the matrices of the objects which have moved, and returns their number
+    void WriteUniforms(RenderContext & ctx, ThreadPool * threads = nullptr); // Also calls UpdateMatrices, and culls the objects outside ctx.frustum
+    void Draw(RenderContext & ctx) const;                   // Once ctx.uniforms has been uploaded
+    void Draw(RenderContext & ctx, IRenderBackend & backend) const; // Submits the same commands to backend, which need not be GL
 
     std::shared_ptr<Object> CreateObject(std::string name, const float3 & position, const float3 & scale, MeshHandle mesh, ProgramHandle prog, const float3 & diffuseColor)
     {
@@ -70,6 +167,7 @@ struct Scene
         obj->prog = prog;
         obj->color = diffuseColor;
         objects.push_back(obj);
+        bvhDirty = true;
         return obj;
     }
 
@@ -77,6 +175,7 @@ struct Scene
     {
         auto obj = std::make_shared<Object>(original);
         objects.push_back(obj);
+        bvhDirty = true;
         return obj;    
     }
 
@@ -84,6 +183,7 @@ struct Scene
     {
         auto it = std::find(begin(objects), end(objects), object);
         if(it != end(objects)) objects.erase(it);
+        bvhDirty = true;
     }
 };
 template<class F> void VisitFields(Scene & o, F f) { f("objects", o.objects); }
@@ -50,34 +50,35 @@ public:
         ss << value; 
         return MakeEdit(ss.str(), [&value](const std::string & text) { value = text; });
     }
-    gui::ElementPtr MakeFloatEdit(float & value) const
+    gui::ElementPtr MakeFloatEdit(float & value, std::function<void()> onChange={}) const
     {
         std::ostringstream ss;
         ss << value; 
-        return MakeEdit(ss.str(), [&value](const std::string & text) { std::istringstream(text) >> value; });
+        return MakeEdit(ss.str(), [&value, onChange](const std::string & text) { std::istringstream(text) >> value; if(onChange) onChange(); });
     }
-    gui::ElementPtr MakeVectorEdit(float3 & value) const
+    gui::ElementPtr MakeVectorEdit(float3 & value, std::function<void()> onChange={}) const
     {
         auto panel = std::make_shared<gui::Element>();
-        panel->children.push_back({{{0.0f/3, 0},{0,0},{1.0f/3,-spacing*2.0f/3},{1,0}},MakeFloatEdit(value.x)});
-        panel->children.push_back({{{1.0f/3,+spacing*1.0f/3},{0,0},{2.0f/3,-spacing*1.0f/3},{1,0}},MakeFloatEdit(value.y)});
-        panel->children.push_back({{{2.0f/3,+spacing*2.0f/3},{0,0},{3.0f/3, 0},{1,0}},MakeFloatEdit(value.z)});
+        panel->children.push_back({{{0.0f/3, 0},{0,0},{1.0f/3,-spacing*2.0f/3},{1,0}},MakeFloatEdit(value.x, onChange)});
+        panel->children.push_back({{{1.0f/3,+spacing*1.0f/3},{0,0},{2.0f/3,-spacing*1.0f/3},{1,0}},MakeFloatEdit(value.y, onChange)});
+        panel->children.push_back({{{2.0f/3,+spacing*2.0f/3},{0,0},{3.0f/3, 0},{1,0}},MakeFloatEdit(value.z, onChange)});
         return panel;
     }
-    gui::ElementPtr MakeVectorEdit(float4 & value) const
+    gui::ElementPtr MakeVectorEdit(float4 & value, std::function<void()> onChange={}) const
     {
         auto panel = std::make_shared<gui::Element>();
-        panel->children.push_back({{{0.0f/4, 0},{0,0},{1.0f/4,-spacing*3.0f/4},{1,0}},MakeFloatEdit(value.x)});
-        panel->children.push_back({{{1.0f/4,+spacing*1.0f/4},{0,0},{2.0f/4,-spacing*2.0f/4},{1,0}},MakeFloatEdit(value.y)});
-        panel->children.push_back({{{2.0f/4,+spacing*2.0f/4},{0,0},{3.0f/4,-spacing*1.0f/4},{1,0}},MakeFloatEdit(value.z)});
-        panel->children.push_back({{{3.0f/4,+spacing*3.0f/4},{0,0},{4.0f/4, 0},{1,0}},MakeFloatEdit(value.w)});
+        panel->children.push_back({{{0.0f/4, 0},{0,0},{1.0f/4,-spacing*3.0f/4},{1,0}},MakeFloatEdit(value.x, onChange)});
+        panel->children.push_back({{{1.0f/4,+spacing*1.0f/4},{0,0},{2.0f/4,-spacing*2.0f/4},{1,0}},MakeFloatEdit(value.y, onChange)});
+        panel->children.push_back({{{2.0f/4,+spacing*2.0f/4},{0,0},{3.0f/4,-spacing*1.0f/4},{1,0}},MakeFloatEdit(value.z, onChange)});
+        panel->children.push_back({{{3.0f/4,+spacing*3.0f/4},{0,0},{4.0f/4, 0},{1,0}},MakeFloatEdit(value.w, onChange)});
         return panel;
     }
-    template<class T> gui::ElementPtr MakeAssetHandleEdit(AssetLibrary & assets, AssetLibrary::Handle<T> & value) const
+    template<class T> gui::ElementPtr MakeAssetHandleEdit(AssetLibrary & assets, AssetLibrary::Handle<T> & value, std::function<void()> onChange={}) const
     {
-        return MakeEdit(value ? value.GetId() : "{None}", [&assets, &value](const std::string & text) 
+        return MakeEdit(value ? value.GetId() : "{None}", [&assets, &value, onChange](const std::string & text) 
         {
             value = assets.GetAsset<T>(text);
+            if(onChange) onChange();
         });
     }
 };
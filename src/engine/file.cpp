@@ -0,0 +1,128 @@
+#include "file.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+
+#ifdef WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+static void * MapFile(const std::string & filename, size_t & size)
+{
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE) return nullptr;
+
+    void * view = nullptr;
+    LARGE_INTEGER length;
+    if(GetFileSizeEx(file, &length) && length.QuadPart > 0 && static_cast<unsigned long long>(length.QuadPart) <= SIZE_MAX)
+    {
+        if(HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr))
+        {
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping); // The view keeps the mapping alive
+        }
+        size = static_cast<size_t>(length.QuadPart);
+    }
+    CloseHandle(file);
+    return view;
+}
+
+static void UnmapFile(void * view, size_t) { UnmapViewOfFile(view); }
+
+bool GetFileInfo(const std::string & filename, uint64_t & size, int64_t & modifiedTime)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if(!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &data)) return false;
+    size = (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    modifiedTime = (int64_t(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime; // 100ns ticks
+    return true;
+}
+
+bool RenameFile(const std::string & from, const std::string & to)
+{
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void * MapFile(const std::string & filename, size_t & size)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0) return nullptr;
+
+    void * view = nullptr;
+    struct stat st;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(view == MAP_FAILED) view = nullptr;
+        else madvise(view, st.st_size, MADV_SEQUENTIAL);
+        size = st.st_size;
+    }
+    close(fd); // The mapping keeps the file alive
+    return view;
+}
+
+static void UnmapFile(void * view, size_t size) { munmap(view, size); }
+
+bool GetFileInfo(const std::string & filename, uint64_t & size, int64_t & modifiedTime)
+{
+    struct stat st;
+    if(stat(filename.c_str(), &st) != 0) return false;
+    size = st.st_size;
+#ifdef __linux__
+    modifiedTime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec; // Nanoseconds
+#else
+    modifiedTime = int64_t(st.st_mtime) * 1000000000;
+#endif
+    return true;
+}
+
+bool RenameFile(const std::string & from, const std::string & to)
+{
+    return rename(from.c_str(), to.c_str()) == 0;
+}
+
+#endif
+
+MappedFile::MappedFile(const std::string & filename) : first(), last(), view()
+{
+    size_t size = 0;
+    view = MapFile(filename, size);
+    if(view)
+    {
+        first = reinterpret_cast<const char *>(view);
+        last = first + size;
+        return;
+    }
+
+    // Fall back to reading the file in chunks, which also handles files whose size is not known up front
+    FILE * f = fopen(filename.c_str(), "rb");
+    if(!f) throw std::runtime_error("File not found: " + filename);
+    buffer.resize(std::max<size_t>(size + 1, 4096)); // One byte of slack to see end-of-file without growing
+    size_t used = 0;
+    while(size_t n = fread(buffer.data() + used, 1, buffer.size() - used, f))
+    {
+        used += n;
+        if(used == buffer.size()) buffer.resize(buffer.size() * 2);
+    }
+    bool failed = ferror(f) != 0;
+    fclose(f);
+    if(failed) throw std::runtime_error("Unable to read file: " + filename);
+    buffer.resize(used);
+    first = buffer.data();
+    last = first + used;
+}
+
+MappedFile::~MappedFile()
+{
+    if(view) UnmapFile(view, size());
+}
@@ -0,0 +1,34 @@
+#ifndef ENGINE_FILE_H
+#define ENGINE_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read-only view of the contents of a file. The file is memory mapped where possible, so that its pages are loaded lazily by the OS as they
+// are touched, and read into memory otherwise (for instance for empty files, pipes, or if mapping fails).
+class MappedFile
+{
+    const char *            first, * last;
+    void *                  view;           // Start of the mapped view, or nullptr if the contents were read into buffer
+    std::vector<char>       buffer;
+public:
+                            MappedFile(const std::string & filename); // throws std::runtime_error if the file cannot be opened
+                            MappedFile(const MappedFile &) = delete;
+                            ~MappedFile();
+
+    MappedFile &            operator = (const MappedFile &) = delete;
+
+    bool                    isMapped() const { return view != nullptr; }
+    const char *            begin() const { return first; }
+    const char *            end() const { return last; }
+    size_t                  size() const { return last - first; }
+};
+
+// Retrieves the size and last modification time of a file, in platform specific units, returning false if it does not exist
+bool GetFileInfo(const std::string & filename, uint64_t & size, int64_t & modifiedTime);
+
+// Renames a file, replacing any existing file at to, and returning false on failure. Readers of to see either the old or the new file.
+bool RenameFile(const std::string & from, const std::string & to);
+
+#endif
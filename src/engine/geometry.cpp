@@ -1,9 +1,45 @@
 #include "geometry.h"
 
+#include <algorithm>
+#include <limits>
+
+Frustum Frustum::Between(const float3 (&nearCorners)[4], const float3 (&farCorners)[4])
+{
+    float3 center;
+    for(int i=0; i<4; ++i) center += (nearCorners[i] + farCorners[i]) * 0.125f;
+
+    // Orient each face plane so that the center of the frustum lies on its inner side
+    Frustum frustum;
+    auto addFace = [&](const float3 & a, const float3 & b, const float3 & c)
+    {
+        Plane plane(cross(b - a, c - a), a);
+        if(dot(plane.GetNormal(), center) + plane.coeff.w < 0) plane = Plane(-plane.GetNormal(), a);
+        frustum.planes.push_back(plane);
+    };
+    addFace(nearCorners[0], nearCorners[1], nearCorners[2]);
+    addFace(farCorners[0], farCorners[1], farCorners[2]);
+    for(int i=0; i<4; ++i) addFace(nearCorners[i], nearCorners[(i+1)%4], farCorners[i]);
+    return frustum;
+}
+
+Frustum Frustum::FromMatrix(const float4x4 & viewProj)
+{
+    // Clip coordinates are the dot products of the rows of the matrix with (p,1), and points inside satisfy -w <= x, y, z <= w
+    auto row = [&](int i) { return float4(viewProj.x[i], viewProj.y[i], viewProj.z[i], viewProj.w[i]); };
+    Frustum frustum;
+    for(int i=0; i<3; ++i)
+    {
+        auto lower = row(3) + row(i), upper = row(3) - row(i);
+        frustum.planes.push_back(Plane(lower.xyz(), lower.w));
+        frustum.planes.push_back(Plane(upper.xyz(), upper.w));
+    }
+    return frustum;
+}
+
 RayPlaneHit IntersectRayPlane(const Ray & ray, const Plane & plane)
 {
     auto denom = dot(ray.direction, plane.GetNormal());
-    if(std::abs(denom) < 0.0001f) return {false};
+    if(std::abs(denom) < 0.0001f) return {false, 0};
     return {true, -(dot(ray.start, plane.GetNormal()) + plane.coeff.w) / denom};    
 }
 
@@ -26,4 +62,358 @@ RayTriHit IntersectRayTriangle(const Ray & ray, const float3 & v0, const float3
     if(t < 0) return {false};
 
     return {true,t,u,v};
-}
\ No newline at end of file
+}
+
+// IntersectRayTriangle over lanes, performing the same operations in the same order, so that each lane rounds identically
+static uint32_t IntersectLanes(const simd::floatv start[3], const simd::floatv dir[3], const simd::floatv v0[3], const simd::floatv e1[3], const simd::floatv e2[3], float (&t)[simd::floatv::Width], float (&u)[simd::floatv::Width], float (&v)[simd::floatv::Width])
+{
+    using simd::floatv;
+    const floatv h[3] = {dir[1]*e2[2] - dir[2]*e2[1], dir[2]*e2[0] - dir[0]*e2[2], dir[0]*e2[1] - dir[1]*e2[0]};
+    const floatv a = e1[0]*h[0] + e1[1]*h[1] + e1[2]*h[2];
+    const floatv f = floatv(1) / a;
+    const floatv s[3] = {start[0] - v0[0], start[1] - v0[1], start[2] - v0[2]};
+    const floatv lu = f * (s[0]*h[0] + s[1]*h[1] + s[2]*h[2]);
+    const floatv q[3] = {s[1]*e1[2] - s[2]*e1[1], s[2]*e1[0] - s[0]*e1[2], s[0]*e1[1] - s[1]*e1[0]};
+    const floatv lv = f * (dir[0]*q[0] + dir[1]*q[1] + dir[2]*q[2]);
+    const floatv lt = f * (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2]);
+    const floatv zero(0), one(1);
+    auto miss = ((a > floatv(-0.0001f)) & (a < floatv(0.0001f))) | (lu < zero) | (one < lu) | (lv < zero) | (one < lu + lv) | (lt < zero);
+    lt.Store(t); lu.Store(u); lv.Store(v);
+    return simd::MoveMask(miss) ^ ((1u << floatv::Width) - 1);
+}
+
+uint32_t IntersectRayTriangles(const Ray & ray, const TriangleBlock & block, RayTriHit (&hits)[TriangleBlock::Width])
+{
+    using simd::floatv;
+    const floatv start[3] = {ray.start.x, ray.start.y, ray.start.z}, dir[3] = {ray.direction.x, ray.direction.y, ray.direction.z};
+    floatv v0[3], e1[3], e2[3];
+    for(int i=0; i<3; ++i) { v0[i] = floatv::Load(block.vertex0[i]); e1[i] = floatv::Load(block.edge1[i]); e2[i] = floatv::Load(block.edge2[i]); }
+    float t[floatv::Width], u[floatv::Width], v[floatv::Width];
+    auto mask = IntersectLanes(start, dir, v0, e1, e2, t, u, v);
+    for(auto m = mask; m; m &= m-1) { auto lane = simd::CountTrailingZeros(m); hits[lane] = {true, t[lane], u[lane], v[lane]}; }
+    return mask;
+}
+
+static uint32_t IntersectRaysTriangle(const RayPacket & rays, const float3 & vertex0, const float3 & edge1, const float3 & edge2, RayTriHit (&hits)[RayPacket::Width], uint32_t lanes)
+{
+    using simd::floatv;
+    floatv start[3], dir[3], v0[3], e1[3], e2[3];
+    for(int i=0; i<3; ++i) { start[i] = floatv::Load(rays.start[i]); dir[i] = floatv::Load(rays.direction[i]); v0[i] = vertex0[i]; e1[i] = edge1[i]; e2[i] = edge2[i]; }
+    float t[floatv::Width], u[floatv::Width], v[floatv::Width];
+    auto mask = IntersectLanes(start, dir, v0, e1, e2, t, u, v) & lanes;
+    for(auto m = mask; m; m &= m-1) { auto lane = simd::CountTrailingZeros(m); hits[lane] = {true, t[lane], u[lane], v[lane]}; }
+    return mask;
+}
+
+uint32_t IntersectRaysTriangle(const RayPacket & rays, const float3 & vertex0, const float3 & vertex1, const float3 & vertex2, RayTriHit (&hits)[RayPacket::Width])
+{
+    return IntersectRaysTriangle(rays, vertex0, vertex1 - vertex0, vertex2 - vertex0, hits, (1u << RayPacket::Width) - 1);
+}
+
+Bounds Bounds::Padded() const
+{
+    float extent = 0, magnitude = 0;
+    for(int i=0; i<3; ++i) { extent = std::max(extent, max[i] - min[i]); magnitude = std::max(magnitude, std::max(std::abs(min[i]), std::abs(max[i]))); }
+    float pad = (extent + magnitude) * 1e-5f;
+    return {min - pad, max + pad};
+}
+
+Overlap GetOverlap(const Frustum & frustum, const Bounds & bounds)
+{
+    if(bounds.IsEmpty()) return Overlap::Outside;
+    auto overlap = Overlap::Inside;
+    for(auto & plane : frustum.planes)
+    {
+        // Test the corners of the box furthest along and against the plane's normal
+        auto & n = plane.GetNormal();
+        float3 inner, outer;
+        for(int i=0; i<3; ++i) { inner[i] = n[i] > 0 ? bounds.max[i] : bounds.min[i]; outer[i] = n[i] > 0 ? bounds.min[i] : bounds.max[i]; }
+        if(dot(n, inner) + plane.coeff.w < 0) return Overlap::Outside;
+        if(dot(n, outer) + plane.coeff.w < 0) overlap = Overlap::Partial;
+    }
+    return overlap;
+}
+
+size_t CullBoxes(const Frustum & frustum, const BoxArrays & boxes, size_t first, size_t last, uint8_t * visible)
+{
+    using simd::floatv;
+    size_t culled = 0;
+    for(size_t i=first; i<last; i+=floatv::Width)
+    {
+        floatv center[3], extent[3];
+        for(int j=0; j<3; ++j) { center[j] = floatv::Load(&boxes.center[j][i]); extent[j] = floatv::Load(&boxes.extent[j][i]); }
+
+        // A box lies outside a plane when its center lies further behind it than the box reaches along the plane's normal
+        const uint32_t all = (1u << floatv::Width) - 1;
+        uint32_t outside = 0;
+        for(auto & plane : frustum.planes)
+        {
+            auto & n = plane.GetNormal();
+            auto distance = center[0]*n.x + center[1]*n.y + center[2]*n.z + plane.coeff.w;
+            auto reach = extent[0]*std::abs(n.x) + extent[1]*std::abs(n.y) + extent[2]*std::abs(n.z);
+            outside |= simd::MoveMask(distance + reach < 0);
+            if(outside == all) break;
+        }
+        for(size_t j=i; j<last && j<i+floatv::Width; ++j)
+        {
+            visible[j] = !(outside >> (j-i) & 1);
+            culled += !visible[j];
+        }
+    }
+    return culled;
+}
+
+float3 GetInverseDirection(const Ray & ray)
+{
+    auto inverse = [](float d) { return 1 / (d != 0 ? d : 1e-30f); }; // Zero components are replaced by tiny values, to avoid 0 * inf
+    return {inverse(ray.direction.x), inverse(ray.direction.y), inverse(ray.direction.z)};
+}
+
+float IntersectRayBox(const Ray & ray, const float3 & invDir, const float3 & min, const float3 & max)
+{
+    // Slab test, with the exit distance scaled up to cover rounding, following Ize's robust BVH traversal
+    const float robust = 1 + 2 * 3 * (std::numeric_limits<float>::epsilon() / 2) / (1 - 3 * (std::numeric_limits<float>::epsilon() / 2));
+    auto t0 = (min - ray.start) * invDir, t1 = (max - ray.start) * invDir;
+    float enter = 0, exit = INFINITY;
+    for(int i=0; i<3; ++i) { enter = std::max(enter, std::min(t0[i], t1[i])); exit = std::min(exit, std::max(t0[i], t1[i])); }
+    return enter <= exit * robust ? enter : INFINITY;
+}
+
+std::vector<BvhNode> BuildBvh(const std::vector<Bounds> & items, std::vector<uint32_t> & order, uint32_t maxLeafSize)
+{
+    enum { NumBins = 16 };
+    std::vector<BvhNode> nodes;
+    order.clear();
+    if(items.empty()) return nodes;
+
+    // Items are partitioned by value rather than through an index array, so that each pass over a node reads memory sequentially
+    struct Prim { Bounds bounds; float3 centroid; uint32_t index; };
+    struct Bin { Bounds bounds, centroids; uint32_t count; Bin() : count() {} };
+    struct Task { uint32_t first, count, depth, parent; Bounds bounds, centroids; Task(uint32_t first, uint32_t count, uint32_t depth, uint32_t parent) : first(first), count(count), depth(depth), parent(parent) {} };
+    std::vector<Prim> prims(items.size());
+    Task root(0, static_cast<uint32_t>(items.size()), 0, UINT32_MAX);
+    for(size_t i=0; i<items.size(); ++i)
+    {
+        prims[i] = {items[i], items[i].GetCenter(), static_cast<uint32_t>(i)};
+        root.bounds.Include(prims[i].bounds);
+        root.centroids.Include(prims[i].centroid);
+    }
+
+    // Nodes are created when they are popped, so the first child of a node, pushed last, is created directly after it
+    std::vector<Task> tasks(1, root);
+    while(!tasks.empty())
+    {
+        auto task = tasks.back();
+        tasks.pop_back();
+        if(task.parent != UINT32_MAX && task.parent != nodes.size() - 1) nodes[task.parent].index = nodes.size();
+        nodes.push_back({task.bounds.min, task.first, task.bounds.max, task.count});
+        if(task.count <= 1 || task.depth >= BvhMaxDepth) continue;
+
+        // Find the cheapest split between bins of centroids along the axis where they are most spread out, with costs in units of item tests
+        auto first = prims.begin() + task.first, last = first + task.count;
+        auto spread = task.centroids.max - task.centroids.min;
+        int bestAxis = -1, bestSplit = 0;
+        float bestCost = task.count * task.bounds.HalfArea(), traversalCost = task.bounds.HalfArea();
+        Bin bins[3][NumBins];
+        for(int axis=0; axis<3; ++axis)
+        {
+            float lo = task.centroids.min[axis], hi = task.centroids.max[axis];
+            if(!(hi > lo) || spread[axis] < spread[(axis+1)%3] || spread[axis] < spread[(axis+2)%3]) continue;
+            const float scale = NumBins / (hi - lo);
+            for(auto it=first; it!=last; ++it)
+            {
+                auto & bin = bins[axis][std::min(static_cast<int>((it->centroid[axis] - lo) * scale), NumBins-1)];
+                bin.bounds.Include(it->bounds);
+                bin.centroids.Include(it->centroid);
+                ++bin.count;
+            }
+
+            float rightAreas[NumBins]; uint32_t rightCounts[NumBins];
+            Bounds right; uint32_t rightCount = 0;
+            for(int split=NumBins-1; split>0; --split)
+            {
+                right.Include(bins[axis][split].bounds);
+                rightCount += bins[axis][split].count;
+                rightAreas[split] = right.HalfArea();
+                rightCounts[split] = rightCount;
+            }
+            Bounds left; uint32_t leftCount = 0;
+            for(int split=1; split<NumBins; ++split)
+            {
+                left.Include(bins[axis][split-1].bounds);
+                leftCount += bins[axis][split-1].count;
+                if(leftCount == 0 || rightCounts[split] == 0) continue;
+                float cost = traversalCost + left.HalfArea() * leftCount + rightAreas[split] * rightCounts[split];
+                if(cost < bestCost) { bestCost = cost; bestAxis = axis; bestSplit = split; }
+            }
+        }
+
+        Task left(task.first, 0, task.depth + 1, static_cast<uint32_t>(nodes.size() - 1)), right = left;
+        if(bestAxis >= 0)
+        {
+            float lo = task.centroids.min[bestAxis], scale = NumBins / (task.centroids.max[bestAxis] - lo);
+            std::partition(first, last, [&](const Prim & p) { return std::min(static_cast<int>((p.centroid[bestAxis] - lo) * scale), NumBins-1) < bestSplit; });
+            for(int i=0; i<NumBins; ++i)
+            {
+                auto & side = i < bestSplit ? left : right;
+                side.bounds.Include(bins[bestAxis][i].bounds);
+                side.centroids.Include(bins[bestAxis][i].centroids);
+                side.count += bins[bestAxis][i].count;
+            }
+        }
+        else if(task.count <= maxLeafSize) continue; // Splitting would not pay off
+        else
+        {
+            // No split along the centroids pays off, or they coincide, so split the items evenly to bound the size of the leaves
+            left.count = task.count / 2;
+            right.count = task.count - left.count;
+            for(auto it=first; it!=last; ++it) (it - first < left.count ? left : right).bounds.Include(it->bounds);
+            left.centroids = right.centroids = task.centroids;
+        }
+        right.first = task.first + left.count;
+
+        nodes.back().count = 0;
+        tasks.push_back(right);
+        tasks.push_back(left);
+    }
+
+    order.resize(prims.size());
+    for(size_t i=0; i<prims.size(); ++i) order[i] = prims[i].index;
+    return nodes;
+}
+
+void TriangleBvh::Build(const std::vector<float3> & corners)
+{
+    enum { Width = TriangleBlock::Width };
+    const size_t numTris = corners.size() / 3;
+    std::vector<Bounds> bounds(numTris);
+    for(size_t i=0; i<numTris; ++i)
+    {
+        for(int j=0; j<3; ++j) bounds[i].Include(corners[i*3+j]);
+        bounds[i] = bounds[i].Padded(); // So that no triangle IntersectRayTriangle reports as hit can be culled
+    }
+    std::vector<uint32_t> order;
+    nodes = BuildBvh(bounds, order, 8);
+
+    // Give each leaf whole blocks, so that a ray is tested against all of its triangles at once
+    for(auto & node : nodes)
+    {
+        if(node.count == 0) continue;
+        const uint32_t first = node.index;
+        node.index = static_cast<uint32_t>(blocks.size());
+        for(uint32_t i=0; i<node.count; i+=Width)
+        {
+            TriangleBlock block;
+            for(uint32_t j=0; j<Width; ++j)
+            {
+                if(i+j >= node.count) { triangles.push_back(UINT32_MAX); continue; }
+                auto tri = order[first+i+j];
+                block.Set(j, corners[tri*3+0], corners[tri*3+1], corners[tri*3+2]);
+                triangles.push_back(tri);
+            }
+            blocks.push_back(block);
+        }
+    }
+}
+
+RayMeshHit TriangleBvh::Hit(const Ray & ray) const
+{
+    enum { Width = TriangleBlock::Width };
+    RayMeshHit best;
+    float maxT = INFINITY;
+    TraverseBvh(nodes, ray, maxT, [&](const BvhNode & node)
+    {
+        RayTriHit hits[Width];
+        for(auto b=node.index, end=node.index+(node.count+Width-1)/Width; b<end; ++b)
+        {
+            for(auto mask = IntersectRayTriangles(ray, blocks[b], hits); mask; mask &= mask-1)
+            {
+                auto lane = simd::CountTrailingZeros(mask);
+                auto tri = triangles[b*Width+lane];
+                if(!best.hit || hits[lane].t < best.t || (hits[lane].t == best.t && tri < best.triangle)) { best = {hits[lane], tri}; maxT = hits[lane].t; }
+            }
+        }
+    });
+    return best;
+}
+
+void TriangleBvh::Hit(const Ray * rays, size_t count, RayMeshHit * hits) const
+{
+    using simd::floatv;
+    enum { Width = RayPacket::Width };
+    const float robust = 1 + 2 * 3 * (std::numeric_limits<float>::epsilon() / 2) / (1 - 3 * (std::numeric_limits<float>::epsilon() / 2));
+    for(size_t first=0; first<count; first+=Width)
+    {
+        const size_t n = std::min<size_t>(count-first, Width);
+        for(size_t i=0; i<n; ++i) hits[first+i] = RayMeshHit();
+        if(nodes.empty()) continue;
+
+        // Each lane follows IntersectRayBox and TraverseBvh exactly, so the packet visits every node any of its rays would visit alone
+        const RayPacket packet(rays+first, n);
+        const uint32_t lanes = (1u << n) - 1; // Lanes beyond n repeat the last ray, and their hits are discarded
+        floatv start[3], invDir[3];
+        for(int i=0; i<3; ++i)
+        {
+            start[i] = floatv::Load(packet.start[i]);
+            float inverse[Width];
+            for(int j=0; j<Width; ++j) { float d = packet.direction[i][j]; inverse[j] = 1 / (d != 0 ? d : 1e-30f); }
+            invDir[i] = floatv::Load(inverse);
+        }
+        auto entry = [&](uint32_t index) -> floatv
+        {
+            auto & node = nodes[index];
+            floatv enter(0), exit(INFINITY);
+            for(int i=0; i<3; ++i)
+            {
+                auto t0 = (floatv(node.min[i]) - start[i]) * invDir[i], t1 = (floatv(node.max[i]) - start[i]) * invDir[i];
+                enter = simd::Max(enter, simd::Min(t0, t1));
+                exit = simd::Min(exit, simd::Max(t0, t1));
+            }
+            return simd::Select(enter <= exit * floatv(robust), enter, floatv(INFINITY));
+        };
+        float maxT[Width];
+        for(int j=0; j<Width; ++j) maxT[j] = INFINITY;
+        auto active = [&](const floatv & t) { return simd::MoveMask((t == floatv(INFINITY)) | (floatv::Load(maxT) < t)) ^ ((1u << Width) - 1); };
+        auto nearest = [&](const floatv & t, uint32_t mask) { float lanes[Width]; t.Store(lanes); float m = INFINITY; for(; mask; mask &= mask-1) m = std::min(m, lanes[simd::CountTrailingZeros(mask)]); return m; };
+
+        struct Entry { uint32_t node; floatv t; } stack[BvhMaxDepth + 1];
+        uint32_t size = 0;
+        stack[size++] = {0, entry(0)};
+        while(size)
+        {
+            auto top = stack[--size];
+            if(!active(top.t)) continue;
+            auto & node = nodes[top.node];
+            if(node.count)
+            {
+                // Test each ray of the packet against each triangle of the leaf
+                RayTriHit triHits[Width];
+                for(auto slot=node.index*Width, end=slot+node.count; slot<end; ++slot)
+                {
+                    auto & block = blocks[slot/Width];
+                    const int lane = slot%Width;
+                    const float3 v0(block.vertex0[0][lane], block.vertex0[1][lane], block.vertex0[2][lane]);
+                    const float3 e1(block.edge1[0][lane], block.edge1[1][lane], block.edge1[2][lane]), e2(block.edge2[0][lane], block.edge2[1][lane], block.edge2[2][lane]);
+                    auto tri = triangles[slot];
+                    for(auto mask = IntersectRaysTriangle(packet, v0, e1, e2, triHits, lanes); mask; mask &= mask-1)
+                    {
+                        auto j = simd::CountTrailingZeros(mask);
+                        auto & hit = triHits[j];
+                        auto & best = hits[first+j];
+                        if(!best.hit || hit.t < best.t || (hit.t == best.t && tri < best.triangle)) { best = {hit, tri}; maxT[j] = hit.t; }
+                    }
+                }
+            }
+            else
+            {
+                // Visit the child which the packet enters nearest first
+                uint32_t near = top.node + 1, far = node.index;
+                auto tNear = entry(near), tFar = entry(far);
+                auto maskNear = active(tNear), maskFar = active(tFar);
+                if(maskNear && maskFar && nearest(tFar, maskFar) < nearest(tNear, maskNear)) { std::swap(near, far); std::swap(tNear, tFar); std::swap(maskNear, maskFar); }
+                if(maskFar) stack[size++] = {far, tFar};
+                if(maskNear) stack[size++] = {near, tNear};
+            }
+        }
+    }
+}
@@ -2,15 +2,33 @@
 #define ENGINE_GEOMETRY_H
 
 #include "linalg.h"
+#include "simd.h"
 #include "transform.h"
 
+#include <utility>
+#include <vector>
+
 struct Plane
 {
     float4 coeff; // Coefficients of plane equation, in ax * by * cz + d form
     Plane(const float3 & axis, const float3 & point) : coeff(axis, -dot(axis,point)) {}
+    Plane(const float3 & axis, float offset) : coeff(axis, offset) {}
     const float3 & GetNormal() const { return coeff.xyz(); }
 };
 
+// Convex region on the inner side of a set of planes, such as the region seen through a rectangle of the screen
+struct Frustum
+{
+    std::vector<Plane> planes;
+
+    // Region between a near and a far face, whose corners are given in the same winding order
+    static Frustum Between(const float3 (&nearCorners)[4], const float3 (&farCorners)[4]);
+    // Region which viewProj maps into the clip volume of GL, such as the region seen by a camera. The planes are not normalized.
+    static Frustum FromMatrix(const float4x4 & viewProj);
+
+    bool Contains(const float3 & point) const { for(auto & p : planes) if(dot(p.GetNormal(), point) + p.coeff.w < 0) return false; return true; }
+};
+
 struct Ray
 {
     float3 start, direction; 
@@ -22,20 +40,162 @@ struct Ray
 struct RayPlaneHit { bool hit; float t; };
 RayPlaneHit IntersectRayPlane(const Ray & ray, const Plane & plane);
 
-struct RayTriHit { bool hit; float t,u,v; };
+struct RayTriHit { bool hit; float t,u,v; RayTriHit(bool hit = false, float t = 0, float u = 0, float v = 0) : hit(hit), t(t), u(u), v(v) {} };
 RayTriHit IntersectRayTriangle(const Ray & ray, const float3 & vertex0, const float3 & vertex1, const float3 & vertex2);
 
-struct RayMeshHit : RayTriHit { size_t triangle; RayMeshHit(const RayTriHit & hit, size_t triangle) : RayTriHit(hit), triangle(triangle) {} };
+// Triangles transposed into one lane each, stored as their first corner and the two edges leaving it. Lanes which have not been set hold
+// degenerate triangles, which are never hit.
+struct TriangleBlock
+{
+    enum { Width = simd::floatv::Width };
+    float vertex0[3][Width], edge1[3][Width], edge2[3][Width];
+
+    TriangleBlock() { memset(this, 0, sizeof(*this)); }
+    void Set(int lane, const float3 & v0, const float3 & v1, const float3 & v2)
+    {
+        auto e1 = v1 - v0, e2 = v2 - v0;
+        for(int i=0; i<3; ++i) { vertex0[i][lane] = v0[i]; edge1[i][lane] = e1[i]; edge2[i][lane] = e2[i]; }
+    }
+};
+
+// Rays transposed into one lane each. Takes up to Width rays, and repeats the last one in any remaining lanes.
+struct RayPacket
+{
+    enum { Width = simd::floatv::Width };
+    float start[3][Width], direction[3][Width];
+
+    RayPacket(const Ray * rays, size_t count) { for(size_t j=0; j<Width; ++j) for(int i=0; i<3; ++i) { auto & ray = rays[j < count ? j : count-1]; start[i][j] = ray.start[i]; direction[i][j] = ray.direction[i]; } }
+};
+
+// Test one ray against a block of triangles, or a packet of rays against one triangle, filling in hits for the lanes whose bits are set in
+// the returned mask. Each hit is the one IntersectRayTriangle would return, as long as the compiler does not fuse its multiplies and adds.
+uint32_t IntersectRayTriangles(const Ray & ray, const TriangleBlock & block, RayTriHit (&hits)[TriangleBlock::Width]);
+uint32_t IntersectRaysTriangle(const RayPacket & rays, const float3 & vertex0, const float3 & vertex1, const float3 & vertex2, RayTriHit (&hits)[RayPacket::Width]);
+
+struct RayMeshHit : RayTriHit { size_t triangle; RayMeshHit() : triangle() {} RayMeshHit(const RayTriHit & hit, size_t triangle) : RayTriHit(hit), triangle(triangle) {} };
 template<class VERTEX> RayMeshHit IntersectRayMesh(const Ray & ray, const VERTEX * verts, float3 (VERTEX::*position), const uint3 * tris, size_t numTris)
 {
-    RayMeshHit best = {{false},0};
-    for(size_t i=0; i<numTris; ++i)
+    RayMeshHit best;
+    TriangleBlock block;
+    RayTriHit hits[TriangleBlock::Width];
+    for(size_t i=0; i<numTris; i+=TriangleBlock::Width)
     {
-        auto & tri = tris[i];
-        auto hit = IntersectRayTriangle(ray, verts[tri.x].*position, verts[tri.y].*position, verts[tri.z].*position);
-        if(hit.hit && (!best.hit || hit.t < best.t)) best = {hit,i};
+        if(numTris - i < TriangleBlock::Width) block = TriangleBlock();
+        for(size_t j=i; j<numTris && j<i+TriangleBlock::Width; ++j) block.Set(static_cast<int>(j-i), verts[tris[j].x].*position, verts[tris[j].y].*position, verts[tris[j].z].*position);
+        for(auto mask = IntersectRayTriangles(ray, block, hits); mask; mask &= mask-1)
+        {
+            auto lane = simd::CountTrailingZeros(mask);
+            if(!best.hit || hits[lane].t < best.t) best = {hits[lane],i+lane};
+        }
     }
     return best;
 }
 
+// Axis aligned box, which is empty when default constructed
+struct Bounds
+{
+    float3 min, max;
+    Bounds() : min(INFINITY, INFINITY, INFINITY), max(-INFINITY, -INFINITY, -INFINITY) {}
+    Bounds(const float3 & min, const float3 & max) : min(min), max(max) {}
+    bool IsEmpty() const { return !(min.x <= max.x && min.y <= max.y && min.z <= max.z); }
+    float3 GetCenter() const { return (min + max) * 0.5f; }
+    float HalfArea() const { auto d = max - min; return IsEmpty() ? 0 : d.x*d.y + d.y*d.z + d.z*d.x; }
+    void Include(const float3 & point) { Include(point, point); }
+    void Include(const Bounds & bounds) { Include(bounds.min, bounds.max); }
+    void Include(const float3 & lo, const float3 & hi) { for(int i=0; i<3; ++i) { if(lo[i] < min[i]) min[i] = lo[i]; if(hi[i] > max[i]) max[i] = hi[i]; } }
+    Bounds Padded() const; // Grown by a margin relative to its size and distance from the origin, which absorbs rounding in intersection tests
+};
+
+// How much of a box lies within a frustum. Boxes near the corners of the frustum may be reported as Partial while lying entirely outside.
+enum class Overlap { Outside, Partial, Inside };
+Overlap GetOverlap(const Frustum & frustum, const Bounds & bounds);
+
+// Boxes transposed into an array for each component of their centers and half extents, padded to a whole number of SIMD widths
+struct BoxArrays
+{
+    enum { Width = simd::floatv::Width };
+    std::vector<float> center[3], extent[3];
+
+    void Resize(size_t count) { auto padded = (count + Width - 1) / Width * Width; for(int i=0; i<3; ++i) { center[i].resize(padded); extent[i].resize(padded); } }
+    void Set(size_t index, const float3 & c, const float3 & e) { for(int i=0; i<3; ++i) { center[i][index] = c[i]; extent[i][index] = e[i]; } }
+};
+
+// Sets visible[i] for each box in [first, last) to 0 if it lies entirely outside one of the planes of the frustum, and to 1 otherwise, testing
+// Width boxes at a time. first must be a multiple of Width. Like GetOverlap, boxes near the corners of the frustum may be kept while lying
+// outside. Returns the number of boxes culled.
+size_t CullBoxes(const Frustum & frustum, const BoxArrays & boxes, size_t first, size_t last, uint8_t * visible);
+
+// Returns the distance along the ray at which it enters the box, or INFINITY if it misses. Rounding never causes a miss. Use
+// GetInverseDirection(ray) for invDir.
+float3 GetInverseDirection(const Ray & ray);
+float IntersectRayBox(const Ray & ray, const float3 & invDir, const float3 & min, const float3 & max);
+
+// Node of a bounding volume hierarchy, stored in depth first order. Leaves hold count items starting at index. Interior nodes have a count of
+// zero, their first child directly after them, and their second child at index.
+struct BvhNode { float3 min; uint32_t index; float3 max; uint32_t count; };
+enum { BvhMaxDepth = 64 };
+
+// Builds a BVH over items with the given bounds, using the surface area heuristic with the cost of an item test equal to the cost of a box
+// test. On return, order lists the items so that those of each leaf are contiguous.
+std::vector<BvhNode> BuildBvh(const std::vector<Bounds> & items, std::vector<uint32_t> & order, uint32_t maxLeafSize);
+
+// Calls visitLeaf(node) for each leaf whose box the ray enters no further than maxT, nearest first. visitLeaf may lower maxT to prune the rest
+// of the search.
+template<class F> void TraverseBvh(const std::vector<BvhNode> & nodes, const Ray & ray, const float & maxT, F visitLeaf)
+{
+    if(nodes.empty()) return;
+    const auto invDir = GetInverseDirection(ray);
+    auto entry = [&](uint32_t node) { return IntersectRayBox(ray, invDir, nodes[node].min, nodes[node].max); };
+    auto beyond = [&](float t) { return t == INFINITY || t > maxT; }; // A box entered exactly at maxT may still hold an equally distant item
+
+    struct Entry { uint32_t node; float t; } stack[BvhMaxDepth + 1];
+    uint32_t size = 0, current = 0;
+    if(beyond(entry(0))) return;
+    while(true)
+    {
+        auto & node = nodes[current];
+        if(node.count) visitLeaf(node);
+        else
+        {
+            uint32_t first = current + 1, second = node.index;
+            float tFirst = entry(first), tSecond = entry(second);
+            if(tSecond < tFirst) { std::swap(first, second); std::swap(tFirst, tSecond); }
+            if(!beyond(tFirst))
+            {
+                if(!beyond(tSecond)) stack[size++] = {second, tSecond};
+                current = first;
+                continue;
+            }
+        }
+
+        // Pop the next box which may still hold a hit
+        do { if(size == 0) return; --size; } while(beyond(stack[size].t));
+        current = stack[size].node;
+    }
+}
+
+// Bounding volume hierarchy over the triangles of a mesh, with the triangles of each leaf stored in whole TriangleBlocks. Hit returns the same
+// result as IntersectRayMesh, including the choice between equally distant triangles, which favors the lowest triangle index.
+class TriangleBvh
+{
+    std::vector<BvhNode> nodes;             // Leaves hold count triangles, starting at block index
+    std::vector<TriangleBlock> blocks;
+    std::vector<uint32_t> triangles;        // Index in the source mesh of the triangle in each lane of each block, or UINT32_MAX for empty lanes
+
+    void Build(const std::vector<float3> & corners);
+public:
+    template<class VERTEX> TriangleBvh(const VERTEX * verts, float3 (VERTEX::*position), const uint3 * tris, size_t numTris)
+    {
+        std::vector<float3> corners;
+        corners.reserve(numTris * 3);
+        for(size_t i=0; i<numTris; ++i) for(int j=0; j<3; ++j) corners.push_back(verts[tris[i][j]].*position);
+        Build(corners);
+    }
+
+    Bounds GetBounds() const { return nodes.empty() ? Bounds() : Bounds(nodes[0].min, nodes[0].max); } // Includes a small margin
+    const std::vector<BvhNode> & GetNodes() const { return nodes; } // Depth first, with boxes which include a small margin
+    RayMeshHit Hit(const Ray & ray) const;
+    void Hit(const Ray * rays, size_t count, RayMeshHit * hits) const; // Traverses the tree once per RayPacket, which pays off for coherent rays
+};
+
 #endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "gl.h"
+#include <algorithm>
 #include <map>
 #include <stb_image.h>
 #pragma comment(lib, "glfw3dll.lib")
@@ -14,6 +15,61 @@ template<class T> T & BltSwap(T * lhs, T & rhs)
 
 using namespace gl;
 
+const Api & gl::GetApi()
+{
+    static const Api api = {
+        [](GLsizei n, GLuint * buffers) { glGenBuffers(n, buffers); },
+        [](GLsizei n, const GLuint * buffers) { glDeleteBuffers(n, buffers); },
+        [](GLenum target, GLuint buffer) { glBindBuffer(target, buffer); },
+        [](GLenum target, GLsizeiptr size, const GLvoid * data, GLenum usage) { glBufferData(target, size, data, usage); },
+        [](GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid * data) { glBufferSubData(target, offset, size, data); },
+        [](GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) { glBindBufferRange(target, index, buffer, offset, size); },
+        [](GLenum name, GLint * params) { glGetIntegerv(name, params); }
+    };
+    return api;
+}
+
+UniformRing::UniformRing(const Api & api, int segmentCount) : api(api), buffer(), alignment(), segmentSize(), segmentCount(segmentCount), nextSegment(), base() {}
+UniformRing::~UniformRing()
+{
+    if(buffer) api.DeleteBuffers(1, &buffer);
+}
+
+UniformRange UniformRing::Allocate(GLsizeiptr size)
+{
+    if(!alignment)
+    {
+        api.GetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        if(alignment < 1) alignment = 256; // The largest alignment the specification permits
+    }
+    auto offset = (staging.size() + alignment - 1) / alignment * alignment;
+    staging.resize(offset + size);
+    std::fill(staging.begin() + offset, staging.end(), 0);
+    return {static_cast<GLintptr>(offset), size};
+}
+
+void UniformRing::Upload()
+{
+    if(staging.empty()) return;
+    if(!buffer) api.GenBuffers(1, &buffer);
+    api.BindBuffer(GL_UNIFORM_BUFFER, buffer);
+
+    // Grow geometrically, replacing the whole buffer, which the driver can do without waiting for draws that still read the old one
+    auto size = static_cast<GLsizeiptr>(staging.size());
+    if(size > segmentSize)
+    {
+        segmentSize = std::max(size, segmentSize*2);
+        segmentSize = (segmentSize + alignment - 1) / alignment * alignment;
+        api.BufferData(GL_UNIFORM_BUFFER, segmentSize*segmentCount, nullptr, GL_STREAM_DRAW);
+        nextSegment = 0;
+    }
+
+    base = nextSegment * segmentSize;
+    api.BufferSubData(GL_UNIFORM_BUFFER, base, size, staging.data());
+    nextSegment = (nextSegment + 1) % segmentCount;
+    staging.clear();
+}
+
 Mesh::Mesh() : vertexArray(), arrayBuffer(), elementBuffer(), vertexCount(), indexCount(), mode(GL_TRIANGLES), indexType() {}
 Mesh::Mesh(Mesh && r) : Mesh() { BltSwap(this,r); }
 Mesh & Mesh::operator = (Mesh && r) { return BltSwap(this,r); }
@@ -24,13 +80,23 @@ Mesh::~Mesh()
     if(vertexArray) glDeleteVertexArrays(1,&vertexArray);
 }
 
-void Mesh::Draw() const
+void Mesh::Bind() const
 {
     glBindVertexArray(vertexArray);
+}
+
+void Mesh::DrawBound() const
+{
     if(elementBuffer) glDrawElements(mode, indexCount, indexType, nullptr);
     else glDrawArrays(mode, 0, vertexCount);
 }
 
+void Mesh::DrawBoundInstanced(GLsizei instanceCount) const
+{
+    if(elementBuffer) glDrawElementsInstanced(mode, indexCount, indexType, nullptr, instanceCount);
+    else glDrawArraysInstanced(mode, 0, vertexCount, instanceCount);
+}
+
 void Mesh::SetVertexData(const void * vertices, size_t vertexSize, size_t vertexCount)
 {
     if(!arrayBuffer) glGenBuffers(1,&arrayBuffer);
@@ -61,6 +127,26 @@ void Mesh::SetIndexData(const void * indices, GLenum type, size_t indexCount, GL
     this->mode = mode;
 }
 
+void InstanceBuffer::Bind(size_t firstInstance) const
+{
+    buffer.Bind(GL_ARRAY_BUFFER);
+    for(auto & attrib : attribs)
+    {
+        glVertexAttribPointer(attrib.index, attrib.size, attrib.type, GL_FALSE, stride, reinterpret_cast<const GLvoid *>(firstInstance*stride + attrib.offset));
+        glVertexAttribDivisor(attrib.index, 1);
+        glEnableVertexAttribArray(attrib.index);
+    }
+}
+
+void InstanceBuffer::Unbind() const
+{
+    for(auto & attrib : attribs)
+    {
+        glDisableVertexAttribArray(attrib.index);
+        glVertexAttribDivisor(attrib.index, 0);
+    }
+}
+
 void Texture::Load(const char * filename)
 {
     int x, y, n;
@@ -5,6 +5,7 @@
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -15,6 +16,12 @@ namespace gl
     inline GLenum GetType(uint32_t *) { return GL_UNSIGNED_INT; }
     inline GLenum GetType(float *) { return GL_FLOAT; }
 
+    inline GLenum GetUniformType(float *) { return GL_FLOAT; }
+    inline GLenum GetUniformType(float2 *) { return GL_FLOAT_VEC2; }
+    inline GLenum GetUniformType(float3 *) { return GL_FLOAT_VEC3; }
+    inline GLenum GetUniformType(float4 *) { return GL_FLOAT_VEC4; }
+    inline GLenum GetUniformType(float4x4 *) { return GL_FLOAT_MAT4; }
+
     class Buffer
     {
         GLuint object;
@@ -24,6 +31,7 @@ namespace gl
         Buffer(const Buffer & r) = delete;
         ~Buffer() { if(object) glDeleteBuffers(1, &object); }
 
+        void Bind(GLenum target) const { glBindBuffer(target, object); }
         void BindBase(GLenum target, GLuint index) const { glBindBufferBase(target, index, object); }
 
         Buffer & operator = (Buffer && r) { std::swap(object, r.object); return *this; }
@@ -37,6 +45,46 @@ namespace gl
         }
     };
 
+    // GL entry points used by UniformRing, gathered into a table so that tests can substitute functions which record the calls
+    struct Api
+    {
+        void (*GenBuffers)(GLsizei n, GLuint * buffers);
+        void (*DeleteBuffers)(GLsizei n, const GLuint * buffers);
+        void (*BindBuffer)(GLenum target, GLuint buffer);
+        void (*BufferData)(GLenum target, GLsizeiptr size, const GLvoid * data, GLenum usage);
+        void (*BufferSubData)(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid * data);
+        void (*BindBufferRange)(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+        void (*GetIntegerv)(GLenum name, GLint * params);
+    };
+    const Api & GetApi(); // Calls through to the current context
+
+    struct UniformRange { GLintptr offset; GLsizeiptr size; };
+
+    // Sub-allocates uniform blocks from one persistent buffer. Blocks are written in client memory, and Upload sends every block allocated
+    // since the previous Upload in a single call, into the next of several segments of the buffer, so that the GPU can still be reading the
+    // blocks of earlier frames. The buffer grows when a single upload does not fit into a segment.
+    class UniformRing
+    {
+        const Api &             api;
+        GLuint                  buffer;
+        GLint                   alignment;      // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, or 0 until the first allocation
+        GLsizeiptr              segmentSize;
+        int                     segmentCount, nextSegment;
+        GLintptr                base;           // Offset of the segment written by the last Upload
+        std::vector<uint8_t>    staging;        // Blocks allocated since the last Upload
+    public:
+                                UniformRing(const Api & api = GetApi(), int segmentCount = 3);
+                                UniformRing(const UniformRing & r) = delete;
+                                ~UniformRing();
+
+        UniformRing &           operator = (const UniformRing & r) = delete;
+
+        UniformRange            Allocate(GLsizeiptr size);                                      // Returns a range of zeroed bytes, aligned for binding
+        uint8_t *               GetData(const UniformRange & range)                             { return staging.data() + range.offset; } // Valid until the next Allocate or Upload
+        void                    Upload();
+        void                    Bind(const UniformRange & range, GLuint binding) const          { api.BindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, base + range.offset, range.size); } // Range must have been uploaded by the last Upload
+    };
+
     class Mesh
     {
         GLuint vertexArray, arrayBuffer, elementBuffer;
@@ -50,7 +98,10 @@ namespace gl
         Mesh & operator = (const Mesh & r) = delete;
         ~Mesh();
 
-        void Draw() const;
+        void Bind() const;
+        void DrawBound() const; // Draws this mesh, which must be the last mesh bound
+        void DrawBoundInstanced(GLsizei instanceCount) const;
+        void Draw() const { Bind(); DrawBound(); }
 
         void SetVertexData(const void * vertices, size_t vertexSize, size_t vertexCount);
         void SetAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid * pointer);
@@ -61,6 +112,28 @@ namespace gl
         template<class T, int N> void SetElements(const std::vector<vec<T,N>> & elements) { const GLenum modes[] = {0,GL_POINTS,GL_LINES,GL_TRIANGLES,GL_QUADS}; SetIndexData(elements.data(), GetType((T*)0), elements.size()*N, modes[N]); }
     };
 
+    // Vertex attributes which advance once per instance rather than once per vertex, read from an array of structs. Bind points them into the
+    // array for the bound vertex array, which is shared with every other draw of its mesh, so Unbind must restore it once the draw is issued.
+    class InstanceBuffer
+    {
+        struct Attrib { GLuint index; GLint size; GLenum type; size_t offset; };
+        Buffer buffer;
+        GLsizei stride;
+        std::vector<Attrib> attribs;
+    public:
+        InstanceBuffer() : stride() {}
+
+        void Bind(size_t firstInstance) const;
+        void Unbind() const;    // Disables the attributes of the bound vertex array which Bind enabled, and resets their divisors
+
+        void SetInstanceData(const void * instances, size_t instanceSize, size_t instanceCount) { buffer.SetData(GL_ARRAY_BUFFER, instanceSize*instanceCount, const_cast<void *>(instances), GL_STREAM_DRAW); }
+        void SetAttribPointer(GLuint index, GLint size, GLenum type, GLsizei stride, size_t offset) { this->stride = stride; attribs.push_back({index, size, type, offset}); }
+
+        template<class V> void SetInstances(const std::vector<V> & instances) { SetInstanceData(instances.data(), sizeof(V), instances.size()); }
+        template<class V, class T, int N> void SetAttribute(GLuint index, vec<T,N> V::*attribute) { SetAttribPointer(index, N, GetType((T*)0), sizeof(V), reinterpret_cast<size_t>(&(reinterpret_cast<V *>(nullptr)->*attribute))); }
+        template<class V, class T, int M, int N> void SetAttribute(GLuint index, mat<T,M,N> V::*attribute) { for(int j=0; j<N; ++j) SetAttribPointer(index+j, M, GetType((T*)0), sizeof(V), reinterpret_cast<size_t>(&(reinterpret_cast<V *>(nullptr)->*attribute)) + sizeof(vec<T,M>)*j); } // Takes one location per column
+    };
+
     class Texture
     {
         GLuint tex;
@@ -97,6 +170,28 @@ namespace gl
         template<class T> void SetUniform(uint8_t * data, const std::string & name, const T & value) const { if(auto u = GetNamedUniform(name)) u->SetValue(data, value); }
     };
 
+    // Offset of a uniform of type T within the data of a block, resolved once by name so that each write is a single store. Resolving throws if
+    // the block declares the name with a different type or layout, and yields a handle whose writes do nothing if the block lacks the name.
+    template<class T> class Uniform
+    {
+        GLint offset;
+    public:
+        Uniform() : offset(-1) {}
+        Uniform(const BlockDesc & block, const std::string & name) : Uniform()
+        {
+            auto u = block.GetNamedUniform(name);
+            if(!u) return;
+            if(u->type != GetUniformType((T*)0) || u->size != 1 || (u->type == GL_FLOAT_MAT4 && u->matrixStride != sizeof(float4)))
+            {
+                throw std::runtime_error("uniform " + name + " of block " + block.name + " does not have the expected type");
+            }
+            offset = u->offset;
+        }
+
+        bool IsValid() const { return offset >= 0; }
+        void Set(uint8_t * data, const T & value) const { if(offset >= 0) reinterpret_cast<T &>(data[offset]) = value; }
+    };
+
     class Program
     {
         GLuint object;
@@ -111,6 +206,7 @@ namespace gl
         Program & operator = (Program && r) { std::swap(object, r.object); blocks.swap(r.blocks); return *this; }
         Program & operator = (const Program & r) = delete;
 
+        bool IsValid() const { return object != 0; }
         const std::vector<BlockDesc> & GetBlocks() const { return blocks; }
         const BlockDesc * GetDefaultBlock(const std::string & name) const { for(auto & block : blocks) if(block.binding == -1) return &block; return nullptr; }
         const BlockDesc * GetNamedBlock(const std::string & name) const { for(auto & block : blocks) if(block.name == name) return &block; return nullptr; }
@@ -1,105 +1,395 @@
 #include "json.h"
+#include "simd.h"
 
 #include <algorithm>
-#include <regex>
+#include <cstring>
+#include <climits>
+#include <clocale>
 
-std::ostream & printEscaped(std::ostream & out, const std::string & str)
+// Escape sequences for ", \, and control characters, 0 indicates no escaping needed
+static const char * escapes[256] = {
+    "\\u0000", "\\u0001", "\\u0002", "\\u0003", "\\u0004", "\\u0005", "\\u0006", "\\u0007",
+    "\\b", "\\t", "\\n", "\\u000B", "\\f", "\\r", "\\u000E", "\\u000F",
+    "\\u0010", "\\u0011", "\\u0012", "\\u0013", "\\u0014", "\\u0015", "\\u0016", "\\u0017",
+    "\\u0018", "\\u0019", "\\u001A", "\\u001B", "\\u001C", "\\u001D", "\\u001E", "\\u001F",
+    0, 0, "\\\"", 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "\\\\", 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "\\u007F"
+};
+
+std::ostream & operator << (std::ostream & out, const JsonValue & val) { JsonWriter(out, 0, 0, 4096).value(val); return out; }
+std::ostream & operator << (std::ostream & out, const JsonArray & arr) { JsonWriter(out, 0, 0, 4096).value(arr); return out; }
+std::ostream & operator << (std::ostream & out, const JsonObject & obj) { JsonWriter(out, 0, 0, 4096).value(obj); return out; }
+std::ostream & operator << (std::ostream & out, tabbed_ref<JsonValue> val) { JsonWriter(out, val.tabWidth, val.indent, 4096).value(val.value); return out; }
+std::ostream & operator << (std::ostream & out, tabbed_ref<JsonArray> arr) { JsonWriter(out, arr.tabWidth, arr.indent, 4096).value(arr.value); return out; }
+std::ostream & operator << (std::ostream & out, tabbed_ref<JsonObject> obj) { JsonWriter(out, obj.tabWidth, obj.indent, 4096).value(obj.value); return out; }
+
+static bool is_digit(char ch) { return ch >= '0' && ch <= '9'; }
+
+bool isJsonNumber(const char * first, const char * last)
 {
-    // Escape sequences for ", \, and control characters, 0 indicates no escaping needed
-    static const char * escapes[256] = {
-        "\\u0000", "\\u0001", "\\u0002", "\\u0003", "\\u0004", "\\u0005", "\\u0006", "\\u0007",
-        "\\b", "\\t", "\\n", "\\u000B", "\\f", "\\r", "\\u000E", "\\u000F",
-        "\\u0010", "\\u0011", "\\u0012", "\\u0013", "\\u0014", "\\u0015", "\\u0016", "\\u0017",
-        "\\u0018", "\\u0019", "\\u001A", "\\u001B", "\\u001C", "\\u001D", "\\u001E", "\\u001F",
-        0, 0, "\\\"", 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "\\\\", 0, 0, 0,
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, "\\u007F"
-    };
-    out << '"';
-    for (uint8_t ch : str)
+    // Grammar: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    auto it = first;
+    if (it != last && *it == '-') ++it;
+    if (it == last || !is_digit(*it)) return false;
+    if (*it++ != '0') while (it != last && is_digit(*it)) ++it;
+    if (it != last && *it == '.')
     {
-        if (escapes[ch]) out << escapes[ch];
-        else out << ch;
+        if (++it == last || !is_digit(*it)) return false;
+        while (it != last && is_digit(*it)) ++it;
     }
-    return out << '"';
+    if (it != last && (*it == 'e' || *it == 'E'))
+    {
+        if (++it != last && (*it == '+' || *it == '-')) ++it;
+        if (it == last || !is_digit(*it)) return false;
+        while (it != last && is_digit(*it)) ++it;
+    }
+    return it == last;
 }
 
-std::ostream & operator << (std::ostream & out, const JsonArray & arr)
+bool isJsonNumber(const std::string & num)
 {
-    int i = 0;
-    out << '[';
-    for (auto & val : arr) out << (i++ ? "," : "") << val;
-    return out << ']';
+    return isJsonNumber(num.data(), num.data() + num.size());
 }
 
-std::ostream & operator << (std::ostream & out, const JsonObject & obj)
+static const double powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Decomposition of a JSON number into sign, decimal significand, and base 10 exponent
+struct JsonDecimal
 {
-    int i = 0;
-    out << '{';
-    for (auto & kvp : obj)
+    bool negative;
+    uint64_t significand; // Up to 19 significant digits
+    int exponent;
+    bool truncated; // True if there were more than 19 significant digits, or an extreme exponent
+
+    JsonDecimal(const char * it, const char * last) : negative(), significand(), exponent(), truncated()
     {
-        printEscaped(out << (i++ ? "," : ""), kvp.first) << ':' << kvp.second;
+        int digits = 0;
+        auto addDigit = [this, &digits](char ch) -> bool
+        {
+            if (digits == 0 && ch == '0') return true; // Skip leading zeros
+            if (digits == 19) { truncated |= ch != '0'; return false; }
+            significand = significand * 10 + (ch - '0');
+            ++digits;
+            return true;
+        };
+        if (it != last && *it == '-') { negative = true; ++it; }
+        for (; it != last && is_digit(*it); ++it) if (!addDigit(*it)) ++exponent;
+        if (it != last && *it == '.') for (++it; it != last && is_digit(*it); ++it) if (addDigit(*it)) --exponent;
+        if (it != last && (*it == 'e' || *it == 'E'))
+        {
+            bool negativeExp = false;
+            if (++it != last && (*it == '+' || *it == '-')) negativeExp = *it++ == '-';
+            int exp = 0;
+            for (; it != last && is_digit(*it); ++it) if (exp < 100000) exp = exp * 10 + (*it - '0');
+            exponent += negativeExp ? -exp : exp;
+        }
+        if (exponent < -100000 || exponent > 100000) truncated = true;
     }
-    return out << '}';
+
+    // Compute the correctly rounded double, if it can be done exactly using double arithmetic (Clinger's fast path)
+    bool toDouble(double & value) const
+    {
+        if (truncated || significand > (uint64_t(1) << 53) || exponent < -22 || exponent > 22) return false;
+        value = static_cast<double>(significand);
+        value = exponent < 0 ? value / powers_of_ten[-exponent] : value * powers_of_ten[exponent];
+        if (negative) value = -value;
+        return true;
+    }
+};
+
+// Fallback for numbers outside of the fast path, using the classic locale so results do not depend on user settings
+template<class T> static T parse_stream(const char * first, const char * last)
+{
+    std::istringstream ss(std::string(first, last));
+    ss.imbue(std::locale::classic());
+    T val = 0;
+    ss >> val;
+    return val;
 }
 
-std::ostream & operator << (std::ostream & out, const JsonValue & val)
+double parseJsonDouble(const char * first, const char * last)
 {
-    if (val.isNull()) return out << "null";
-    else if (val.isFalse()) return out << "false";
-    else if (val.isTrue()) return out << "true";
-    else if (val.isString()) return printEscaped(out, val.contents());
-    else if (val.isNumber()) return out << val.contents();
-    else if (val.isArray()) return out << val.array();
-    else return out << val.object();
+    double value;
+    if (JsonDecimal(first, last).toDouble(value)) return value;
+    return parse_stream<double>(first, last);
 }
 
-static std::ostream & indent(std::ostream & out, int space, int n = 0)
+// Rounding a correctly rounded double to float gives the correctly rounded float, unless the double landed exactly halfway
+// between two floats. Values outside the normal range of float are rejected as well.
+static bool round_to_float(double value, float & result)
 {
-    if (n) out << ',';
-    out << '\n';
-    for (int i = 0; i < space; ++i) out << ' ';
-    return out;
+    uint64_t bits; memcpy(&bits, &value, sizeof(bits));
+    int exp = static_cast<int>((bits >> 52) & 0x7FF);
+    bool isHalfway = (bits & 0x1FFFFFFF) == 0x10000000;
+    if (value != 0 && (exp <= 1023 - 126 || exp >= 1023 + 128 || isHalfway)) return false;
+    result = static_cast<float>(value);
+    return true;
 }
 
-std::ostream & operator << (std::ostream & out, tabbed_ref<JsonArray> arr)
+float parseJsonFloat(const char * first, const char * last)
 {
-    if (std::none_of(begin(arr.value), end(arr.value), [](const JsonValue & val) { return val.isArray() || val.isObject(); })) return out << arr.value;
-    else
+    double value; float result;
+    if (JsonDecimal(first, last).toDouble(value) && round_to_float(value, result)) return result;
+    return parse_stream<float>(first, last);
+}
+
+int64_t parseJsonInt64(const char * first, const char * last)
+{
+    const bool negative = first != last && *first == '-';
+    uint64_t magnitude = 0;
+    auto it = first + negative;
+    for (; it != last && is_digit(*it); ++it)
+    {
+        if (magnitude >= UINT64_MAX / 10) return negative ? INT64_MIN : INT64_MAX; // Magnitude will exceed 2^63
+        magnitude = magnitude * 10 + (*it - '0');
+    }
+    if (it != last) // Fraction or exponent present, truncate toward zero
     {
-        int space = arr.indent + arr.tabWidth, i = 0;
-        out << '[';
-        for (auto & val : arr.value) indent(out, space, i++) << tabbed(val, arr.tabWidth, space);
-        return indent(out, arr.indent) << ']';
+        double value = parseJsonDouble(first, last);
+        return value <= -9223372036854775808.0 ? INT64_MIN : value >= 9223372036854775808.0 ? INT64_MAX : static_cast<int64_t>(value);
     }
+    if (negative) return magnitude > uint64_t(INT64_MAX) + 1 ? INT64_MIN : static_cast<int64_t>(0 - magnitude);
+    return magnitude > uint64_t(INT64_MAX) ? INT64_MAX : static_cast<int64_t>(magnitude);
 }
 
-std::ostream & operator << (std::ostream & out, tabbed_ref<JsonObject> obj)
+uint64_t parseJsonUint64(const char * first, const char * last)
 {
-    if (obj.value.empty()) return out << "{}";
+    if (first != last && *first == '-') return 0;
+    uint64_t magnitude = 0;
+    auto it = first;
+    for (; it != last && is_digit(*it); ++it)
+    {
+        if (magnitude > UINT64_MAX / 10 || (magnitude == UINT64_MAX / 10 && static_cast<uint64_t>(*it - '0') > UINT64_MAX % 10)) return UINT64_MAX;
+        magnitude = magnitude * 10 + (*it - '0');
+    }
+    if (it != last)
+    {
+        double value = parseJsonDouble(first, last);
+        return value >= 18446744073709551616.0 ? UINT64_MAX : static_cast<uint64_t>(value);
+    }
+    return magnitude;
+}
+
+// Write a positive number as printf's %.{precision}g would, given its significant digits and the decimal exponent of the leading digit
+static char * print_general(char * out, uint64_t significand, int precision, int exponent)
+{
+    char digits[20];
+    for (int i = precision; i--; significand /= 10) digits[i] = '0' + significand % 10;
+    int count = precision;
+    while (count > 1 && digits[count - 1] == '0') --count; // Trailing zeros are not printed
+    if (exponent < -4 || exponent >= precision)
+    {
+        *out++ = digits[0];
+        if (count > 1) { *out++ = '.'; out = std::copy(digits + 1, digits + count, out); }
+        *out++ = 'e';
+        *out++ = exponent < 0 ? '-' : '+';
+        int magnitude = std::abs(exponent);
+        if (magnitude >= 100) *out++ = '0' + magnitude / 100;
+        *out++ = '0' + magnitude / 10 % 10;
+        *out++ = '0' + magnitude % 10;
+    }
+    else if (exponent >= 0)
+    {
+        const int whole = exponent + 1; // Digits before the decimal point
+        out = std::copy(digits, digits + whole, out);
+        if (count > whole) { *out++ = '.'; out = std::copy(digits + whole, digits + count, out); }
+    }
     else
     {
-        int space = obj.indent + obj.tabWidth, i = 0;
-        out << '{';
-        for (auto & kvp : obj.value)
+        *out++ = '0';
+        *out++ = '.';
+        out = std::fill_n(out, -exponent - 1, '0');
+        out = std::copy(digits, digits + count, out);
+    }
+    return out;
+}
+
+// Check whether a printed candidate converts back to value, using exact double arithmetic on its significand and scale where possible
+static bool round_trips(const char *, const char *, uint64_t significand, int scale, double value) { return (scale < 0 ? significand * powers_of_ten[-scale] : significand / powers_of_ten[scale]) == value; }
+static bool round_trips(const char * first, const char * last, uint64_t significand, int scale, float value)
+{
+    float result;
+    if (round_to_float(scale < 0 ? significand * powers_of_ten[-scale] : significand / powers_of_ten[scale], result)) return result == value;
+    return parseJsonFloat(first, last) == value;
+}
+
+// Find the fewest significant digits, starting from minPrecision, which convert back to the same value. Candidates are computed and checked
+// with exact double arithmetic where possible, otherwise they are printed by printf and checked by parsing them back.
+template<class T> static char * format_shortest(T value, char * out, int minPrecision, int maxPrecision, T (*parse)(const char *, const char *))
+{
+    if (!std::isfinite(value)) return nullptr;
+    if (std::signbit(value)) { *out++ = '-'; value = -value; }
+    if (value == 0) { *out++ = '0'; return out; }
+
+    static const uint64_t powers[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000, 10000000000, 100000000000, 1000000000000, 10000000000000, 100000000000000, 1000000000000000};
+    int precision = minPrecision, exponent = static_cast<int>(std::floor(std::log10(static_cast<double>(value))));
+    for (; precision <= std::min(maxPrecision, 15); ++precision)
+    {
+        int scale = precision - 1 - exponent;
+        if (scale < -22 || scale > 22) break;
+        auto significand = static_cast<uint64_t>(std::nearbyint(scale < 0 ? value / powers_of_ten[-scale] : value * powers_of_ten[scale]));
+        if (significand >= powers[precision]) { ++exponent; --precision; continue; } // log10 underestimated the exponent
+        if (significand < powers[precision - 1]) { --exponent; --precision; continue; } // log10 overestimated the exponent
+        auto end = print_general(out, significand, precision, exponent);
+        if (round_trips(out, end, significand, scale, value)) return end;
+    }
+    for (; ; ++precision)
+    {
+        auto end = out + sprintf(out, "%.*g", precision, static_cast<double>(value)); // At most 24 characters, as precision is at most 17
+        std::replace(out, end, *localeconv()->decimal_point, '.');
+        if (precision >= maxPrecision || parse(out, end) == value) return end;
+    }
+}
+
+char * formatJsonFloat(float value, char * out) { return format_shortest(value, out, 6, 9, parseJsonFloat); }
+char * formatJsonDouble(double value, char * out) { return format_shortest(value, out, 15, 17, parseJsonDouble); }
+
+JsonValue::JsonValue(const JsonValue & r) : JsonValue(r.kind)
+{
+    switch (kind)
+    {
+    case String: str = new JsonString(*r.str); break;
+    case Array: arr = new JsonArray(*r.arr); break;
+    case Object: setObject(new JsonObject(*r.obj)); break;
+    case Number:
+        num = r.num;
+        textSize = r.textSize;
+        if (textSize == LongText) longText = new JsonString(*r.longText);
+        else
         {
-            printEscaped(indent(out, space, i++), kvp.first) << ": " << tabbed(kvp.second, obj.tabWidth, space);
+            memcpy(head, r.head, sizeof(head));
+            memcpy(tail, r.tail, sizeof(tail));
         }
-        return indent(out, obj.indent) << '}';
+        break;
+    default: break;
     }
 }
 
-std::ostream & operator << (std::ostream & out, tabbed_ref<JsonValue> val)
+JsonValue & JsonValue::operator = (JsonValue && r) JSON_NOEXCEPT
 {
-    if (val.value.isArray()) return out << tabbed(val.value.array(), val.tabWidth, val.indent);
-    else if (val.value.isObject()) return out << tabbed(val.value.object(), val.tabWidth, val.indent);
-    else return out << val.value;
+    if (this != &r)
+    {
+        clear();
+        kind = r.kind;
+        textSize = r.textSize;
+        memcpy(head, r.head, sizeof(head));
+        memcpy(&num, &r.num, sizeof(num)); // Take ownership of any out-of-line storage
+        memcpy(tail, r.tail, sizeof(tail));
+        r.kind = Null;
+    }
+    return *this;
 }
 
-bool isJsonNumber(const std::string & num)
+void JsonValue::clear()
+{
+    switch (kind)
+    {
+    case String: destroy(str); break;
+    case Array: destroy(arr); break;
+    case Object:
+        if (index) JsonAllocator<uint32_t>(obj->get_allocator()).deallocate(index, index[0] + 2);
+        destroy(obj);
+        break;
+    case Number: if (textSize == LongText) destroy(longText); break;
+    default: break;
+    }
+    kind = Null;
+}
+
+bool JsonValue::operator == (const JsonValue & r) const
+{
+    if (kind != r.kind) return false;
+    switch (kind)
+    {
+    case String: return *str == *r.str;
+    case Number: return contents() == r.contents();
+    case Array: return *arr == *r.arr;
+    case Object: return *obj == *r.obj;
+    default: return true;
+    }
+}
+
+static uint32_t hash_key(const char * key, size_t length)
+{
+    uint32_t h = 2166136261; // 32-bit FNV-1a
+    for (size_t i = 0; i < length; ++i) h = (h ^ static_cast<uint8_t>(key[i])) * 16777619;
+    return h;
+}
+
+void JsonValue::setObject(JsonObject * o)
+{
+    obj = o;
+    index = nullptr;
+    if (obj->size() <= MaxUnindexedFields) return;
+
+    // Open addressing with linear probing, kept at most half full
+    uint32_t mask = 1;
+    while (mask < obj->size() * 2) mask = mask * 2 + 1;
+    auto table = JsonAllocator<uint32_t>(obj->get_allocator()).allocate(mask + 2);
+    table[0] = mask;
+    std::fill(table + 1, table + mask + 2, 0);
+    for (uint32_t i = 0; i < obj->size(); ++i)
+    {
+        auto & key = (*obj)[i].first;
+        for (uint32_t slot = hash_key(key.data(), key.size()) & mask; ; slot = (slot + 1) & mask)
+        {
+            if (!table[slot + 1]) { table[slot + 1] = i + 1; break; }
+            if ((*obj)[table[slot + 1] - 1].first == key) break; // Duplicate key, earlier field takes precedence
+        }
+    }
+    index = table;
+}
+
+const JsonValue * JsonValue::find(const char * key, size_t length) const
+{
+    if (kind != Object) return nullptr;
+    auto matches = [key, length](const JsonString & k) { return k.size() == length && memcmp(k.data(), key, length) == 0; };
+    if (!index)
+    {
+        for (auto & kvp : *obj) if (matches(kvp.first)) return &kvp.second;
+        return nullptr;
+    }
+    for (uint32_t slot = hash_key(key, length) & index[0]; index[slot + 1]; slot = (slot + 1) & index[0])
+    {
+        auto & kvp = (*obj)[index[slot + 1] - 1];
+        if (matches(kvp.first)) return &kvp.second;
+    }
+    return nullptr;
+}
+
+std::string JsonValue::contents() const
+{
+    if (kind == String) return std::string(str->data(), str->size());
+    if (kind != Number) return {};
+    if (textSize == LongText) return std::string(longText->data(), longText->size());
+    std::string s(head, std::min<size_t>(textSize, sizeof(head)));
+    if (textSize > sizeof(head)) s.append(tail, textSize - sizeof(head));
+    return s;
+}
+
+void JsonValue::setNumber(const char * first, const char * last, JsonArena * arena)
+{
+    assert(kind == Number);
+    num = parseJsonDouble(first, last);
+    const size_t size = last - first;
+    if (size > MaxInlineText)
+    {
+        textSize = LongText;
+        longText = create<JsonString>(arena, first, last);
+    }
+    else
+    {
+        textSize = static_cast<uint8_t>(size);
+        memcpy(head, first, std::min(size, sizeof(head)));
+        if (size > sizeof(head)) memcpy(tail, first + sizeof(head), size - sizeof(head));
+    }
+}
+
+float JsonValue::numberAs(float *) const
 {
-    static const std::regex regex(R"(-?(0|([1-9][0-9]*))((\.[0-9]+)?)(((e|E)((\+|-)?)[0-9]+)?))");
-	return std::regex_match(begin(num), end(num), regex);
+    float result;
+    return round_to_float(num, result) ? result : jsonNumberAs(contents(), (float *)0);
 }
 
 static uint16_t decode_hex(char ch) {
@@ -109,11 +399,14 @@ static uint16_t decode_hex(char ch) {
     throw JsonParseError(std::string("invalid hex digit: ") + ch);
 }
 
-static std::string decode_string(std::string::const_iterator first, std::string::const_iterator last)
+static bool is_control(uint8_t ch) { return ch < 0x20 || ch == 0x7F; }
+
+// Decode the contents of a string literal into s, which should be empty
+template<class S> static void decode_string(const char * first, const char * last, S & s)
 {
-    if (std::any_of(first, last, iscntrl)) throw JsonParseError("control character found in string literal");
-    if (std::find(first, last, '\\') == last) return std::string(first, last); // No escape characters, use the string directly
-    std::string s; s.reserve(last - first); // Reserve enough memory to hold the entire string
+    if (std::any_of(first, last, [](char ch) { return is_control(ch); })) throw JsonParseError("control character found in string literal");
+    if (std::find(first, last, '\\') == last) { s.assign(first, last); return; } // No escape characters, use the string directly
+    s.reserve(last - first); // Reserve enough memory to hold the entire string
     for (; first < last; ++first)
     {
         if (*first != '\\') s.push_back(*first);
@@ -150,125 +443,569 @@ static std::string decode_string(std::string::const_iterator first, std::string:
         default: throw JsonParseError("invalid escape sequence");
         }
     }
-    return s;
 }
 
-struct JsonToken { char type; std::string value; JsonToken(char type, std::string value = std::string()) : type(type), value(move(value)) {} };
+// Lexical rules shared by JsonParser and JsonReader
+static bool is_number_char(char ch) { return isalnum(static_cast<uint8_t>(ch)) || ch == '+' || ch == '-' || ch == '.'; }
+static bool is_literal_char(char ch) { return isalpha(static_cast<uint8_t>(ch)) != 0; }
+static void check_number(const char * first, const char * last) { if (!isJsonNumber(first, last)) throw JsonParseError("Invalid number: " + std::string(first, last)); }
+static JsonParseError invalid_character(char ch) { return JsonParseError("Invalid character: \'" + std::string(1, ch) + '"'); }
+static JsonReader::Event lex_literal(const char * first, const char * last)
+{
+    auto is = [first, last](const char * literal) { return static_cast<size_t>(last - first) == strlen(literal) && std::equal(first, last, literal); };
+    if (is("true")) return JsonReader::True;
+    else if (is("false")) return JsonReader::False;
+    else if (is("null")) return JsonReader::Null;
+    else throw JsonParseError("Invalid token: " + std::string(first, last));
+}
 
-struct JsonParseState
+// Recursive descent parser which reads values directly from the source text, without an intermediate token stream
+struct JsonParser
 {
-    std::vector<JsonToken>::iterator it, last;
+    const char * it, * last;
+    JsonArena * arena;                                      // Arena to allocate storage from, or nullptr to use the heap
+    std::vector<JsonValue> elements;                        // Elements of the arrays currently being parsed
+    std::vector<std::pair<JsonString, JsonValue>> fields;   // Fields of the objects currently being parsed
 
-    bool matchAndDiscard(char type) { if (it->type != type) return false; ++it; return true; }
-    void discardExpected(char type, const char * what) { if (!matchAndDiscard(type)) throw JsonParseError(std::string("Syntax error: Expected ") + what); }
+    JsonParser(const char * first, const char * last, JsonArena * arena) : it(first), last(last), arena(arena) {}
+
+    // Skip whitespace and return the first character of the next token, or -1 at end-of-stream
+    int peek() { it = simd::SkipWhitespace(it, last); return it == last ? -1 : static_cast<uint8_t>(*it); }
+    bool matchAndDiscard(char type) { if (peek() != type) return false; ++it; return true; }
+    void discardExpected(char type, const char * what) { if (!matchAndDiscard(type)) { lexToken(); throw JsonParseError(std::string("Syntax error: Expected ") + what); } }
+
+    JsonString lexString()
+    {
+        auto first = ++it;
+        bool plain = true; // Contains no escapes or control characters, and can be used as is
+        while (true)
+        {
+            it = simd::FindStringSpecial(it, last);
+            if (it == last) throw JsonParseError("String missing closing quote");
+            if (*it == '"') break;
+            plain = false;
+            if (*it == '\\' && ++it == last) throw JsonParseError("String missing closing quote");
+            ++it;
+        }
+        JsonString s(arena);
+        if (plain) s.assign(first, it++);
+        else decode_string(first, it++, s);
+        return s;
+    }
+
+    JsonValue lexNumber()
+    {
+        auto first = it;
+        it = std::find_if_not(it, last, is_number_char);
+        check_number(first, it);
+        JsonValue val(JsonValue::Number);
+        val.setNumber(first, it, arena);
+        return val;
+    }
+
+    JsonValue lexLiteral()
+    {
+        auto first = it;
+        it = std::find_if_not(it, last, is_literal_char);
+        switch (lex_literal(first, it))
+        {
+        case JsonReader::True: return true;
+        case JsonReader::False: return false;
+        default: return nullptr;
+        }
+    }
+
+    // Consume the next token, throwing if it is lexically invalid. Used to report bad tokens in preference to syntax errors.
+    void lexToken()
+    {
+        switch (peek())
+        {
+        case -1: break;
+        case '[': case ']': case ',':
+        case '{': case '}': case ':':
+            ++it;
+            break;
+        case '"': lexString(); break;
+        case '-': case '0': case '1': case '2':
+        case '3': case '4': case '5': case '6':
+        case '7': case '8': case '9':
+            lexNumber();
+            break;
+        default:
+            if (is_literal_char(*it)) lexLiteral();
+            else throw invalid_character(*it);
+        }
+    }
+
+    // Move the trailing elements of a scratch stack into an exactly sized container
+    template<class C, class E> C * take(E & stack, size_t base)
+    {
+        auto c = JsonValue::create<C>(arena, std::make_move_iterator(stack.begin() + base), std::make_move_iterator(stack.end()));
+        stack.erase(stack.begin() + base, stack.end());
+        return c;
+    }
 
     JsonValue parseValue()
     {
-        auto token = it++;
-        switch (token->type)
+        switch (peek())
         {
-        case 'n': return nullptr;
-        case 'f': return false;
-        case 't': return true;
-        case '"': return token->value;
-        case '#': return JsonValue::fromNumber(token->value);
+        case '"':
+            {
+                auto str = JsonValue::create<JsonString>(arena, lexString());
+                JsonValue val(JsonValue::String);
+                val.str = str;
+                return val;
+            }
+        case '-': case '0': case '1': case '2':
+        case '3': case '4': case '5': case '6':
+        case '7': case '8': case '9':
+            return lexNumber();
         case '[':
-            if (matchAndDiscard(']')) return JsonArray{};
-            else
+            ++it;
             {
-                JsonArray arr;
-                while (true)
+                const size_t base = elements.size();
+                if (!matchAndDiscard(']')) while (true)
                 {
-                    arr.push_back(parseValue());
-                    if (matchAndDiscard(']')) return arr;
+                    elements.push_back(parseValue());
+                    if (matchAndDiscard(']')) break;
                     discardExpected(',', ", or ]");
                 }
+                auto arr = take<JsonArray>(elements, base);
+                JsonValue val(JsonValue::Array);
+                val.arr = arr;
+                return val;
             }
         case '{':
-            if (matchAndDiscard('}')) return JsonObject{};
-            else
+            ++it;
             {
-                JsonObject obj;
-                while (true)
+                const size_t base = fields.size();
+                if (!matchAndDiscard('}')) while (true)
                 {
-                    auto name = move(it->value);
-                    discardExpected('"', "string");
+                    if (peek() != '"') { lexToken(); throw JsonParseError("Syntax error: Expected string"); }
+                    auto name = lexString();
                     discardExpected(':', ":");
-                    obj.emplace_back(move(name), parseValue());
-                    if (matchAndDiscard('}')) { return obj; }
+                    fields.emplace_back(move(name), parseValue());
+                    if (matchAndDiscard('}')) break;
                     discardExpected(',', ", or }");
                 }
+                auto obj = take<JsonObject>(fields, base);
+                JsonValue val(JsonValue::Object);
+                val.setObject(obj);
+                return val;
             }
-        default: throw JsonParseError("Expected value");
+        default:
+            if (it != last && is_literal_char(*it)) return lexLiteral();
+            lexToken();
+            throw JsonParseError("Expected value");
         }
     }
+
+    JsonValue parseDocument()
+    {
+        auto val = parseValue();
+        if (peek() != -1) { lexToken(); throw JsonParseError("Syntax error: Expected end-of-stream"); }
+        return val;
+    }
 };
 
-std::vector<JsonToken> jsonTokensFrom(const std::string & text)
+JsonValue jsonFrom(const std::string & text) { return jsonFrom(text.data(), text.data() + text.size()); }
+JsonValue jsonFrom(const std::string & text, JsonArena & arena) { return jsonFrom(text.data(), text.data() + text.size(), arena); }
+JsonValue jsonFrom(const char * first, const char * last) { return JsonParser(first, last, nullptr).parseDocument(); }
+JsonValue jsonFrom(const char * first, const char * last, JsonArena & arena) { return JsonParser(first, last, &arena).parseDocument(); }
+
+JsonReader::JsonReader(std::istream & in, size_t bufferSize) : in(&in), buffer(new char[bufferSize]), bufferSize(bufferSize), it(), last(), state(Start), event(EndOfStream) {}
+JsonReader::JsonReader(const char * first, const char * last) : in(), bufferSize(), it(first), last(last), state(Start), event(EndOfStream) {}
+
+bool JsonReader::refill()
+{
+    if (!in || !*in) return false;
+    in->read(buffer.get(), bufferSize);
+    it = buffer.get();
+    last = it + in->gcount();
+    return it != last;
+}
+
+int JsonReader::peek()
+{
+    while (true)
+    {
+        it = simd::SkipWhitespace(it, last);
+        if (it != last) return static_cast<uint8_t>(*it);
+        if (!refill()) return -1;
+    }
+}
+
+template<class P> void JsonReader::lexRun(P pred, const char *& first, const char *& end)
+{
+    first = it;
+    it = std::find_if_not(it, last, pred);
+    if (it != last || !in) { end = it; return; }
+
+    // Run reaches the end of the buffer, so gather it in scratch across refills
+    scratch.assign(first, it);
+    while (refill())
+    {
+        auto chunk = it;
+        it = std::find_if_not(it, last, pred);
+        scratch.append(chunk, it);
+        if (it != last) break;
+    }
+    first = scratch.data();
+    end = first + scratch.size();
+}
+
+void JsonReader::lexString()
 {
-    std::vector<JsonToken> tokens;
-    auto it = begin(text);
+    auto first = ++it;
+    bool split = false, plain = true;
     while (true)
     {
-        it = std::find_if_not(it, end(text), isspace); // Skip whitespace
-        if (it == end(text))
+        it = simd::FindStringSpecial(it, last);
+        if (it != last)
         {
-            tokens.emplace_back('$');
-            return tokens;
+            if (*it == '"') break;
+            plain = false;
+            if (*it != '\\' || last - it > 1) { it += *it == '\\' ? 2 : 1; continue; }
         }
-        switch (*it)
+
+        // String continues past the end of the buffer, including the character following a trailing backslash
+        const size_t escaped = it != last;
+        if (!split) scratch.clear();
+        scratch.append(first, last);
+        split = true;
+        if (!refill()) throw JsonParseError("String missing closing quote");
+        first = it;
+        it += escaped;
+    }
+    token.clear();
+    if (split) scratch.append(first, it);
+    auto contents = split ? scratch.data() : first, end = split ? scratch.data() + scratch.size() : it;
+    if (plain) token.assign(contents, end);
+    else decode_string(contents, end, token);
+    ++it;
+}
+
+void JsonReader::lexNumber()
+{
+    const char * first, * end;
+    lexRun(is_number_char, first, end);
+    check_number(first, end);
+    token.assign(first, end);
+}
+
+JsonReader::Event JsonReader::lexLiteral()
+{
+    const char * first, * end;
+    lexRun(is_literal_char, first, end);
+    return lex_literal(first, end);
+}
+
+void JsonReader::lexToken()
+{
+    switch (peek())
+    {
+    case -1: break;
+    case '[': case ']': case ',':
+    case '{': case '}': case ':':
+        ++it;
+        break;
+    case '"': lexString(); break;
+    case '-': case '0': case '1': case '2':
+    case '3': case '4': case '5': case '6':
+    case '7': case '8': case '9':
+        lexNumber();
+        break;
+    default:
+        if (is_literal_char(*it)) lexLiteral();
+        else throw invalid_character(*it);
+    }
+}
+
+void JsonReader::syntaxError(const char * expected)
+{
+    lexToken();
+    throw JsonParseError(std::string("Syntax error: Expected ") + expected);
+}
+
+JsonReader::Event JsonReader::readValue()
+{
+    state = AfterValue;
+    switch (peek())
+    {
+    case '"': lexString(); return event = String;
+    case '-': case '0': case '1': case '2':
+    case '3': case '4': case '5': case '6':
+    case '7': case '8': case '9':
+        lexNumber();
+        return event = Number;
+    case '[': ++it; stack.push_back('['); state = ArrayStart; return event = BeginArray;
+    case '{': ++it; stack.push_back('{'); state = ObjectStart; return event = BeginObject;
+    default:
+        if (it != last && is_literal_char(*it)) return event = lexLiteral();
+        lexToken();
+        throw JsonParseError("Expected value");
+    }
+}
+
+JsonReader::Event JsonReader::readKey()
+{
+    if (peek() != '"') syntaxError("string");
+    lexString();
+    state = AfterKey;
+    return event = Key;
+}
+
+JsonReader::Event JsonReader::next()
+{
+    switch (state)
+    {
+    case Start: return readValue();
+    case ArrayStart:
+        if (peek() != ']') return readValue();
+        break;
+    case ObjectStart:
+        if (peek() != '}') return readKey();
+        break;
+    case AfterKey:
+        if (peek() != ':') syntaxError(":");
+        ++it;
+        return readValue();
+    case AfterValue:
+        if (stack.empty())
         {
-        case '[': case ']': case ',':
-        case '{': case '}': case ':':
-            tokens.push_back({ *it++ });
-            break;
-        case '"':
-            {
-                auto it2 = ++it;
-                for (; it2 < end(text); ++it2)
-                {
-                    if (*it2 == '"') break;
-                    if (*it2 == '\\') ++it2;
-                }
-                if (it2 < end(text))
-                {
-                    tokens.emplace_back('"', decode_string(it, it2));
-                    it = it2 + 1;
-                }
-                else throw JsonParseError("String missing closing quote");
-            }
-            break;
-        case '-': case '0': case '1': case '2':
-        case '3': case '4': case '5': case '6':
-        case '7': case '8': case '9':
-            {
-                auto it2 = std::find_if_not(it, end(text), [](char ch) { return isalnum(ch) || ch == '+' || ch == '-' || ch == '.'; });
-                auto num = std::string(it, it2);
-                if (!isJsonNumber(num)) throw JsonParseError("Invalid number: " + num);
-                tokens.emplace_back('#', move(num));
-                it = it2;
-            }
-            break;
-        default:
-            if (isalpha(*it))
-            {
-                auto it2 = std::find_if_not(it, end(text), isalpha);
-                if (std::equal(it, it2, "true")) tokens.emplace_back('t');
-                else if (std::equal(it, it2, "false")) tokens.emplace_back('f');
-                else if (std::equal(it, it2, "null")) tokens.emplace_back('n');
-                else throw JsonParseError("Invalid token: " + std::string(it, it2));
-                it = it2;
-            }
-            else throw JsonParseError("Invalid character: \'" + std::string(1, *it) + '"');
+            if (peek() != -1) syntaxError("end-of-stream");
+            state = Finished;
+            return event = EndOfStream;
+        }
+        if (stack.back() == '[')
+        {
+            if (peek() == ']') break;
+            if (peek() != ',') syntaxError(", or ]");
+            ++it;
+            return readValue();
+        }
+        if (peek() == '}') break;
+        if (peek() != ',') syntaxError(", or }");
+        ++it;
+        return readKey();
+    case Finished: return event = EndOfStream;
+    }
+
+    // Close the innermost container
+    ++it;
+    event = stack.back() == '[' ? EndArray : EndObject;
+    stack.pop_back();
+    state = AfterValue;
+    return event;
+}
+
+void JsonReader::skip()
+{
+    if (event != BeginArray && event != BeginObject) return;
+    for (size_t depth = stack.size(); stack.size() >= depth; ) next();
+}
+
+JsonWriter::JsonWriter(std::ostream & out, int tabWidth, int indent, size_t bufferSize) : out(out), buffer(new char[bufferSize]), bufferSize(bufferSize), used(), tabWidth(tabWidth), indent(indent) {}
+
+void JsonWriter::flush()
+{
+    out.write(buffer.get(), used);
+    used = 0;
+}
+
+void JsonWriter::writeLarge(const char * text, size_t size)
+{
+    flush();
+    if (size > bufferSize) out.write(text, size);
+    else write(text, size);
+}
+
+void JsonWriter::emit(const char * text, size_t size)
+{
+    if (tabWidth && !stack.empty() && !stack.back().isObject && !stack.back().isMultiline) pending.append(text, size);
+    else write(text, size);
+}
+
+void JsonWriter::emitString(const char * text, size_t size)
+{
+    emit("\"", 1);
+    auto last = text + size;
+    while (text != last)
+    {
+        auto run = simd::FindStringSpecial(text, last);
+        emit(text, run - text);
+        if (run == last) break;
+        auto escape = escapes[static_cast<uint8_t>(*run)];
+        emit(escape, strlen(escape));
+        text = run + 1;
+    }
+    emit("\"", 1);
+}
+
+void JsonWriter::newline(int depth)
+{
+    static const char indentation[] = "\n                                                                "; // Newline and 64 spaces
+    const size_t chunk = sizeof(indentation) - 2;
+    size_t n = indent + depth * tabWidth;
+    if (n <= chunk) return write(indentation, n + 1);
+    write('\n');
+    for (; n > chunk; n -= chunk) write(indentation + 1, chunk);
+    write(indentation + 1, n);
+}
+
+void JsonWriter::beginValue(bool isContainer)
+{
+    if (stack.empty()) return;
+    auto & top = stack.back();
+    if (top.isObject) return; // Separator and key have already been written
+    if (tabWidth && !top.isMultiline)
+    {
+        if (!isContainer)
+        {
+            pendingStarts.push_back(pending.size());
+            ++top.count;
+            return;
         }
+
+        // Array contains a container, so place each of the elements held back so far on its own line
+        top.isMultiline = true;
+        write('[');
+        for (size_t i = 0; i < pendingStarts.size(); ++i)
+        {
+            if (i) write(',');
+            newline(static_cast<int>(stack.size()));
+            write(pending.data() + pendingStarts[i], (i + 1 < pendingStarts.size() ? pendingStarts[i + 1] : pending.size()) - pendingStarts[i]);
+        }
+        pending.clear();
+        pendingStarts.clear();
     }
+    if (top.count++) write(',');
+    if (tabWidth) newline(static_cast<int>(stack.size()));
 }
 
-JsonValue jsonFrom(const std::string & text)
+void JsonWriter::beginContainer(bool isObject)
 {
-    auto tokens = jsonTokensFrom(text);
-    JsonParseState p = { begin(tokens), end(tokens) };
-    auto val = p.parseValue();
-    p.discardExpected('$', "end-of-stream");
-    return val;
+    beginValue(true);
+    stack.push_back({isObject, isObject || !tabWidth, 0});
+    if (stack.back().isMultiline) write(isObject ? '{' : '['); // Held back arrays are opened once their layout is known
+}
+
+void JsonWriter::endContainer(bool isObject)
+{
+    assert(!stack.empty() && stack.back().isObject == isObject);
+    auto level = stack.back();
+    stack.pop_back();
+    if (!level.isMultiline)
+    {
+        // Array contained only scalars, so write it on one line
+        write('[');
+        for (size_t i = 0; i < pendingStarts.size(); ++i)
+        {
+            if (i) write(',');
+            write(pending.data() + pendingStarts[i], (i + 1 < pendingStarts.size() ? pendingStarts[i + 1] : pending.size()) - pendingStarts[i]);
+        }
+        write(']');
+        pending.clear();
+        pendingStarts.clear();
+        return;
+    }
+    if (tabWidth && level.count) newline(static_cast<int>(stack.size()));
+    write(isObject ? '}' : ']');
+}
+
+void JsonWriter::key(const char * name, size_t length)
+{
+    assert(!stack.empty() && stack.back().isObject);
+    if (stack.back().count++) write(',');
+    if (tabWidth) newline(static_cast<int>(stack.size()));
+    emitString(name, length);
+    if (tabWidth) write(": ", 2);
+    else write(':');
+}
+
+void JsonWriter::value(int64_t n)
+{
+    char buf[24], * it = buf + sizeof(buf);
+    uint64_t magnitude = n < 0 ? 0 - static_cast<uint64_t>(n) : static_cast<uint64_t>(n);
+    do *--it = '0' + magnitude % 10; while (magnitude /= 10);
+    if (n < 0) *--it = '-';
+    beginValue(false);
+    emit(it, buf + sizeof(buf) - it);
+}
+
+void JsonWriter::value(uint64_t n)
+{
+    char buf[24], * it = buf + sizeof(buf);
+    do *--it = '0' + n % 10; while (n /= 10);
+    beginValue(false);
+    emit(it, buf + sizeof(buf) - it);
+}
+
+void JsonWriter::value(float n)
+{
+    char buf[32];
+    auto end = formatJsonFloat(n, buf);
+    if (!end) return value(nullptr);
+    beginValue(false);
+    emit(buf, end - buf);
+}
+
+void JsonWriter::value(double n)
+{
+    char buf[32];
+    auto end = formatJsonDouble(n, buf);
+    if (!end) return value(nullptr);
+    beginValue(false);
+    emit(buf, end - buf);
+}
+
+void JsonWriter::value(const JsonArray & arr)
+{
+    beginArray();
+    for (auto & elem : arr) value(elem);
+    endArray();
+}
+
+void JsonWriter::value(const JsonObject & obj)
+{
+    beginObject();
+    for (auto & kvp : obj)
+    {
+        key(kvp.first.data(), kvp.first.size());
+        value(kvp.second);
+    }
+    endObject();
+}
+
+void JsonWriter::value(const JsonValue & val)
+{
+    switch (val.kind)
+    {
+    case JsonValue::Null: return value(nullptr);
+    case JsonValue::False: return value(false);
+    case JsonValue::True: return value(true);
+    case JsonValue::String:
+        beginValue(false);
+        return emitString(val.str->data(), val.str->size());
+    case JsonValue::Number:
+        beginValue(false);
+        if (val.textSize == JsonValue::LongText) return emit(val.longText->data(), val.longText->size());
+        if (val.textSize <= sizeof(val.head)) return emit(val.head, val.textSize);
+        emit(val.head, sizeof(val.head));
+        return emit(val.tail, val.textSize - sizeof(val.head));
+    case JsonValue::Array: return value(*val.arr);
+    case JsonValue::Object: return value(*val.obj);
+    }
+}
+
+char * JsonArena::grow(size_t size, size_t align)
+{
+    // Blocks double in size, so a document needs only a handful of them
+    size_t blockSize = std::max(nextBlockSize, size + align);
+    blocks.emplace_back(new char[blockSize]);
+    next = blocks.back().get();
+    last = next + blockSize;
+    nextBlockSize = blockSize * 2;
+    reserved += blockSize;
+    return reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(next) + align - 1) & ~uintptr_t(align - 1));
 }
@@ -3,50 +3,174 @@
 
 #include <cstdint>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
 #include <sstream>
 #include <vector>
+#include <memory>
+
+// Monotonic allocator which a whole JSON document can be parsed into, and released at once when the arena is destroyed
+class JsonArena
+{
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char * next, * last;
+    size_t nextBlockSize, reserved;
+
+    char * grow(size_t size, size_t align);
+public:
+    explicit JsonArena(size_t initialBlockSize = 64*1024) : next(), last(), nextBlockSize(initialBlockSize), reserved() {}
+    JsonArena(const JsonArena &) = delete;
+    JsonArena & operator = (const JsonArena &) = delete;
+
+    size_t bytesReserved() const { return reserved; }
+    void * allocate(size_t size, size_t align)
+    {
+        auto p = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(next) + align - 1) & ~uintptr_t(align - 1));
+        if (!next || p > last || size > static_cast<size_t>(last - p)) p = grow(size, align);
+        next = p + size;
+        return p;
+    }
+};
+
+// Allocator for DOM storage, which draws from an arena if one is specified, or the heap otherwise. Deallocation from an arena
+// is a no-op. Copies of containers always allocate from the heap, so copying a value out of a document detaches it from the arena.
+template<class T> struct JsonAllocator
+{
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    JsonArena * arena;
+
+    JsonAllocator() : arena() {}
+    JsonAllocator(JsonArena * arena) : arena(arena) {}
+    template<class U> JsonAllocator(const JsonAllocator<U> & r) : arena(r.arena) {}
+
+    T * allocate(size_t n) { return static_cast<T *>(arena ? arena->allocate(n * sizeof(T), std::alignment_of<T>::value) : ::operator new(n * sizeof(T))); }
+    void deallocate(T * p, size_t) { if (!arena) ::operator delete(p); }
+    JsonAllocator select_on_container_copy_construction() const { return {}; }
+
+    template<class U> bool operator == (const JsonAllocator<U> & r) const { return arena == r.arena; }
+    template<class U> bool operator != (const JsonAllocator<U> & r) const { return arena != r.arena; }
+};
+
+// VS2013 does not support noexcept, but accepts the equivalent throw() specification
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define JSON_NOEXCEPT throw()
+#else
+#define JSON_NOEXCEPT noexcept
+#endif
 
 class JsonValue;
-typedef std::vector<JsonValue> JsonArray;
-typedef std::vector<std::pair<std::string, JsonValue>> JsonObject;
+typedef std::basic_string<char, std::char_traits<char>, JsonAllocator<char>> JsonString;
+typedef std::vector<JsonValue, JsonAllocator<JsonValue>> JsonArray;
+typedef std::vector<std::pair<JsonString, JsonValue>, JsonAllocator<std::pair<JsonString, JsonValue>>> JsonObject;
 struct JsonParseError : std::runtime_error { JsonParseError(const std::string & what) : runtime_error("json parse error - " + what) {} };
 
 JsonValue jsonFrom(const std::string & text); // throws JsonParseError
+JsonValue jsonFrom(const std::string & text, JsonArena & arena); // throws JsonParseError, result and all its contents are stored in arena, and must not outlive it
+JsonValue jsonFrom(const char * first, const char * last); // throws JsonParseError
+JsonValue jsonFrom(const char * first, const char * last, JsonArena & arena); // throws JsonParseError, as above
 bool isJsonNumber(const std::string & num);
+bool isJsonNumber(const char * first, const char * last);
+
+// Locale-independent conversion of valid JSON numbers. Floating point results are correctly rounded, integer results saturate and truncate toward zero.
+double parseJsonDouble(const char * first, const char * last);
+float parseJsonFloat(const char * first, const char * last);
+int64_t parseJsonInt64(const char * first, const char * last);
+uint64_t parseJsonUint64(const char * first, const char * last);
+
+// Locale-independent conversion to the shortest text, of at least 6 (float) or 15 (double) significant digits, which converts back to the
+// same value. Text is formatted as by printf's %g. Writes at most 32 characters and returns the end of the text, or nullptr if value is not finite.
+char * formatJsonFloat(float value, char * out);
+char * formatJsonDouble(double value, char * out);
+
+inline float jsonNumberAs(const std::string & num, float *) { return parseJsonFloat(num.data(), num.data() + num.size()); }
+inline double jsonNumberAs(const std::string & num, double *) { return parseJsonDouble(num.data(), num.data() + num.size()); }
+inline long double jsonNumberAs(const std::string & num, long double *) { return parseJsonDouble(num.data(), num.data() + num.size()); }
+template<class T> T jsonNumberAs(const std::string & num, T *)
+{
+    static_assert(std::is_integral<T>::value, "jsonNumberAs requires an arithmetic type");
+    if (std::is_signed<T>::value)
+    {
+        auto n = parseJsonInt64(num.data(), num.data() + num.size());
+        return n < int64_t(std::numeric_limits<T>::min()) ? std::numeric_limits<T>::min() : n > int64_t(std::numeric_limits<T>::max()) ? std::numeric_limits<T>::max() : static_cast<T>(n);
+    }
+    auto n = parseJsonUint64(num.data(), num.data() + num.size());
+    return n > uint64_t(std::numeric_limits<T>::max()) ? std::numeric_limits<T>::max() : static_cast<T>(n);
+}
 
 class JsonValue
 {
     template<class T> static std::string to_str(const T & val) { std::ostringstream ss; ss << val; return ss.str(); }
 
-    enum                Kind { Null, False, True, String, Number, Array, Object };
-    Kind                kind; // What kind of value is this?
-    std::string         str;  // Contents of String or Number value
-    JsonObject          obj;  // Fields of Object value
-    JsonArray           arr;  // Elements of Array value
+    // Values are 24 byte tagged unions. Strings, arrays, and objects are stored out-of-line, either on the heap or in a JsonArena.
+    // Numbers store their parsed value inline, alongside their JSON text, which is split between head and tail when it fits in 14 characters.
+    // Objects with more than MaxUnindexedFields fields also store a hash index of their keys, so that lookup does not need to scan every field.
+    enum                Kind : uint8_t { Null, False, True, String, Number, Array, Object };
+    enum : uint8_t      { MaxInlineText = 14, LongText = 0xFF, MaxUnindexedFields = 16 };
+    Kind                kind;       // What kind of value is this?
+    uint8_t             textSize;   // Length of inline text of Number value, or LongText if stored out-of-line
+    char                head[6];    // First 6 characters of inline text of Number value
+    union
+    {
+        double          num;        // Parsed value of Number value
+        JsonString *    str;        // Contents of String value
+        JsonArray *     arr;        // Elements of Array value
+        JsonObject *    obj;        // Fields of Object value
+    };
+    union
+    {
+        char            tail[8];    // Remaining characters of inline text of Number value
+        JsonString *    longText;   // Text of Number value, if longer than MaxInlineText
+        uint32_t *      index;      // Hash index of Object value, as { mask, slots[mask+1]... }, where each slot holds field index + 1, or 0 if empty
+    };
 
-                        JsonValue(Kind kind, std::string str)       : kind(kind), str(move(str)) {}
+                        JsonValue(Kind kind)                        : kind(kind), textSize(), head(), num(), tail() {} // Zeroes all storage, since moves copy it whatever the kind
+                        JsonValue(Kind kind, const std::string & num) : JsonValue(kind) { setNumber(num.data(), num.data() + num.size()); }
+    template<class T, class... A> static T * create(JsonArena * arena, A &&... args) { return new(arena ? arena->allocate(sizeof(T), std::alignment_of<T>::value) : ::operator new(sizeof(T))) T(std::forward<A>(args)..., typename T::allocator_type(arena)); }
+    template<class T> static void destroy(T * p)                    { if (!p->get_allocator().arena) delete p; } // Arena storage is released with the arena
+    void                setNumber(const char * first, const char * last, JsonArena * arena = nullptr);
+    float               numberAs(float *) const;
+    double              numberAs(double *) const                    { return num; }
+    long double         numberAs(long double *) const               { return num; }
+    template<class T> T numberAs(T *) const                         { return std::abs(num) < 9007199254740992.0 ? clamp<T>(num) : jsonNumberAs(contents(), (T*)0); } // Integral types, exact below 2^53
+    template<class T> static T clamp(double n)                      { return n <= double(std::numeric_limits<T>::min()) ? std::numeric_limits<T>::min() : n >= double(std::numeric_limits<T>::max()) ? std::numeric_limits<T>::max() : static_cast<T>(n); }
+    void                setObject(JsonObject * o);
+    const JsonValue *   find(const char * key, size_t length) const;
+    void                clear();
+    friend struct JsonParser;
+    friend class JsonWriter;
 public:
-                        JsonValue()                                 : kind(Null) {}                 // Default construct null
-                        JsonValue(std::nullptr_t)                   : kind(Null) {}                 // Construct null from nullptr
-                        JsonValue(bool b)                           : kind(b ? True : False) {}     // Construct true or false from boolean
-                        JsonValue(const char * s)                   : JsonValue(String, s) {}           // Construct String from C-string
-                        JsonValue(std::string s)                    : JsonValue(String, move(s)) {}     // Construct String from std::string
+                        JsonValue()                                 : JsonValue(Null) {}            // Default construct null
+                        JsonValue(std::nullptr_t)                   : JsonValue(Null) {}            // Construct null from nullptr
+                        JsonValue(bool b)                           : JsonValue(b ? True : False) {}    // Construct true or false from boolean
+                        JsonValue(const char * s)                   : JsonValue(String) { str = create<JsonString>(nullptr, s); }                        // Construct String from C-string
+                        JsonValue(std::string s)                    : JsonValue(String) { str = create<JsonString>(nullptr, s.data(), s.size()); }       // Construct String from std::string
                         JsonValue(int32_t n)                        : JsonValue(Number, to_str(n)) {}   // Construct Number from integer
                         JsonValue(uint32_t n)                       : JsonValue(Number, to_str(n)) {}   // Construct Number from integer
                         JsonValue(int64_t n)                        : JsonValue(Number, to_str(n)) {}   // Construct Number from integer
                         JsonValue(uint64_t n)                       : JsonValue(Number, to_str(n)) {}   // Construct Number from integer
-                        JsonValue(float n)                          : JsonValue(Number, to_str(n)) {}   // Construct Number from float
-                        JsonValue(double n)                         : JsonValue(Number, to_str(n)) {}   // Construct Number from double
-                        JsonValue(JsonObject o)                     : kind(Object), obj(move(o)) {} // Construct Object from vector<pair<string,JsonValue>> (TODO: Assert no duplicate keys)
-                        JsonValue(JsonArray a)                      : kind(Array), arr(move(a)) {}  // Construct Array from vector<JsonValue>
+                        JsonValue(float n)                          : JsonValue(Null) { char buf[32]; if (auto end = formatJsonFloat(n, buf)) { kind = Number; setNumber(buf, end); } }   // Construct Number from float, or null if not finite
+                        JsonValue(double n)                         : JsonValue(Null) { char buf[32]; if (auto end = formatJsonDouble(n, buf)) { kind = Number; setNumber(buf, end); } } // Construct Number from double, or null if not finite
+                        JsonValue(JsonObject o)                     : JsonValue(Object) { setObject(create<JsonObject>(o.get_allocator().arena, move(o))); } // Construct Object from vector<pair<string,JsonValue>>, where the first of any duplicate keys is used
+                        JsonValue(JsonArray a)                      : JsonValue(Array) { arr = create<JsonArray>(a.get_allocator().arena, move(a)); }    // Construct Array from vector<JsonValue>
+                        JsonValue(const JsonValue & r);
+                        JsonValue(JsonValue && r) JSON_NOEXCEPT     : JsonValue() { *this = std::move(r); }
+                        ~JsonValue()                                { clear(); }
+
+    JsonValue &         operator = (const JsonValue & r)            { return *this = JsonValue(r); }
+    JsonValue &         operator = (JsonValue && r) JSON_NOEXCEPT;
 
-    bool                operator == (const JsonValue & r) const     { return kind == r.kind && str == r.str && obj == r.obj && arr == r.arr; }
+    bool                operator == (const JsonValue & r) const;
     bool                operator != (const JsonValue & r) const     { return !(*this == r); }
 
-    const JsonValue &   operator[](size_t index) const              { const static JsonValue null; return index < arr.size() ? arr[index] : null; }
+    const JsonValue &   operator[](size_t index) const              { const static JsonValue null; return isArray() && index < arr->size() ? (*arr)[index] : null; }
     const JsonValue &   operator[](int index) const                 { const static JsonValue null; return index < 0 ? null : (*this)[static_cast<size_t>(index)]; }
-    const JsonValue &   operator[](const char * key) const          { for (auto & kvp : obj) if (kvp.first == key) return kvp.second; const static JsonValue null; return null; }
-    const JsonValue &   operator[](const std::string & key) const   { return (*this)[key.c_str()]; }
+    const JsonValue &   operator[](const char * key) const          { const static JsonValue null; auto val = find(key, strlen(key)); return val ? *val : null; }
+    const JsonValue &   operator[](const std::string & key) const   { const static JsonValue null; auto val = find(key.data(), key.size()); return val ? *val : null; }
 
     bool                isString() const                            { return kind == String; }
     bool                isNumber() const                            { return kind == Number; }
@@ -57,17 +181,18 @@ public:
     bool                isNull() const                              { return kind == Null; }
 
     bool                boolOrDefault(bool def) const               { return isTrue() ? true : isFalse() ? false : def; }
-    std::string         stringOrDefault(const char * def) const     { return kind == String ? str : def; }
-    template<class T> T numberOrDefault(T def) const                { if (!isNumber()) return def; T val = def; std::istringstream(str) >> val; return val; }
+    std::string         stringOrDefault(const char * def) const     { return kind == String ? std::string(str->data(), str->size()) : def; }
+    template<class T> T numberOrDefault(T def) const                { return isNumber() ? numberAs((T*)0) : def; }
 
     std::string         string() const                              { return stringOrDefault(""); } // Value, if a String, empty otherwise
     template<class T> T number() const                              { return numberOrDefault(T()); } // Value, if a Number, empty otherwise
-    const JsonObject &  object() const                              { return obj; }    // Name/value pairs, if an Object, empty otherwise
-    const JsonArray &   array() const                               { return arr; }    // Values, if an Array, empty otherwise
+    const JsonObject &  object() const                              { const static JsonObject empty; return isObject() ? *obj : empty; } // Name/value pairs, if an Object, empty otherwise
+    const JsonArray &   array() const                               { const static JsonArray empty; return isArray() ? *arr : empty; }   // Values, if an Array, empty otherwise
 
-    const std::string & contents() const                            { return str; }    // Contents, if a String, JSON format number, if a Number, empty otherwise
+    std::string         contents() const;                           // Contents, if a String, JSON format number, if a Number, empty otherwise
 
-    static JsonValue    fromNumber(std::string num)                 { assert(::isJsonNumber(num)); return JsonValue(Number, move(num)); }
+    static JsonValue    fromNumber(const char * first, const char * last) { assert(::isJsonNumber(first, last)); JsonValue val(Number); val.setNumber(first, last); return val; }
+    static JsonValue    fromNumber(const std::string & num)         { return fromNumber(num.data(), num.data() + num.size()); }
 };
 
 std::ostream & operator << (std::ostream & out, const JsonValue & val);
@@ -80,4 +205,96 @@ std::ostream & operator << (std::ostream & out, tabbed_ref<JsonValue> val);
 std::ostream & operator << (std::ostream & out, tabbed_ref<JsonArray> arr);
 std::ostream & operator << (std::ostream & out, tabbed_ref<JsonObject> obj);
 
+// Writes a document to a stream as a sequence of values, keys, and array and object delimiters, without building any JsonValues. Output
+// is collected in a fixed size buffer and passed to the stream in blocks. Compact output is used by operator << on JsonValue, and tabbed
+// output by tabbed(). Tabbed output keeps arrays of scalars on one line, for which the elements of the innermost array are held back
+// until it is known whether it contains any arrays or objects.
+class JsonWriter
+{
+    struct Level { bool isObject, isMultiline; int count; };
+    std::ostream &          out;
+    std::unique_ptr<char[]> buffer;
+    size_t                  bufferSize, used;
+    int                     tabWidth;   // Spaces per level of indentation, or 0 for compact output
+    int                     indent;     // Spaces of indentation at the outermost level
+    std::vector<Level>      stack;      // Currently open arrays and objects
+    std::string             pending;    // Elements of the innermost array, while it is not yet known whether it will span multiple lines
+    std::vector<size_t>     pendingStarts;
+
+    void                    write(const char * text, size_t size) { if (size > bufferSize - used) return writeLarge(text, size); memcpy(buffer.get() + used, text, size); used += size; }
+    void                    writeLarge(const char * text, size_t size);
+    void                    write(char ch)                  { if (used == bufferSize) flush(); buffer[used++] = ch; }
+    void                    emit(const char * text, size_t size);
+    void                    emitString(const char * text, size_t size);
+    void                    newline(int depth);
+    void                    beginValue(bool isContainer);
+    void                    beginContainer(bool isObject);
+    void                    endContainer(bool isObject);
+public:
+                            JsonWriter(std::ostream & out, int tabWidth = 0, int indent = 0, size_t bufferSize = 64*1024);
+                            ~JsonWriter()                   { flush(); }
+
+    void                    beginArray()                    { beginContainer(false); }
+    void                    endArray()                      { endContainer(false); }
+    void                    beginObject()                   { beginContainer(true); }
+    void                    endObject()                     { endContainer(true); }
+    void                    key(const char * name)          { key(name, strlen(name)); }
+    void                    key(const std::string & name)   { key(name.data(), name.size()); }
+    void                    key(const char * name, size_t length);
+
+    void                    value(std::nullptr_t)           { beginValue(false); emit("null", 4); }
+    void                    value(bool b)                   { beginValue(false); b ? emit("true", 4) : emit("false", 5); }
+    void                    value(const char * s)           { beginValue(false); emitString(s, strlen(s)); }
+    void                    value(const std::string & s)    { beginValue(false); emitString(s.data(), s.size()); }
+    void                    value(int64_t n);
+    void                    value(uint64_t n);
+    void                    value(float n);                 // Writes null if not finite
+    void                    value(double n);                // Writes null if not finite
+    template<class T> std::enable_if_t<std::is_integral<T>::value && std::is_signed<T>::value> value(T n) { value(static_cast<int64_t>(n)); }
+    template<class T> std::enable_if_t<std::is_integral<T>::value && !std::is_signed<T>::value> value(T n) { value(static_cast<uint64_t>(n)); }
+    void                    value(const JsonValue & val);   // Writes an entire value, including its elements or fields
+    void                    value(const JsonArray & arr);
+    void                    value(const JsonObject & obj);
+    void                    flush();                        // Pass buffered output to the stream. Held back array elements remain buffered.
+};
+
+// Pull parser which reports a document as a sequence of events, without building any JsonValues. When reading from a stream, text
+// passes through a fixed size buffer, so memory use depends on nesting depth and the longest token, rather than the size of the document.
+class JsonReader
+{
+public:
+    enum Event { Null, False, True, String, Number, Key, BeginArray, EndArray, BeginObject, EndObject, EndOfStream };
+private:
+    enum State { Start, ArrayStart, ObjectStart, AfterKey, AfterValue, Finished };
+    std::istream *          in;         // Stream to refill buffer from, or nullptr if reading from memory
+    std::unique_ptr<char[]> buffer;
+    size_t                  bufferSize;
+    const char *            it, * last; // Unread portion of the current buffer or memory range
+    std::vector<char>       stack;      // '[' or '{' for each currently open array or object
+    State                   state;
+    Event                   event;
+    std::string             token;      // Contents of the current String or Key, or text of the current Number
+    std::string             scratch;    // Tokens which span more than one buffer are gathered here
+
+    bool                    refill();
+    int                     peek();
+    template<class P> void  lexRun(P pred, const char *& first, const char *& end);
+    void                    lexString();
+    void                    lexNumber();
+    Event                   lexLiteral();
+    void                    lexToken();
+    void                    syntaxError(const char * expected);
+    Event                   readValue();
+    Event                   readKey();
+public:
+                            JsonReader(std::istream & in, size_t bufferSize = 64*1024);
+                            JsonReader(const char * first, const char * last);
+
+    Event                   next();                         // Advance to the next event, throws JsonParseError
+    void                    skip();                         // If the current event is BeginArray or BeginObject, advance to the matching end event
+    Event                   current() const                 { return event; }
+    const std::string &     string() const                  { return token; } // Contents of current String or Key, or text of current Number
+    template<class T> T     number() const                  { return jsonNumberAs(token, (T*)0); }
+};
+
 #endif
\ No newline at end of file
@@ -204,4 +204,126 @@ template<class T> T det(const mat<T,4,4> & a) { return
     a.x.w*(a.y.x*a.w.y*a.z.z + a.z.x*a.y.y*a.w.z + a.w.x*a.z.y*a.y.z - a.y.x*a.z.y*a.w.z - a.w.x*a.y.y*a.z.z - a.z.x*a.w.y*a.y.z);
 }
 
+// Overloads of the hottest float4 and float4x4 operations using SSE, which overload resolution prefers to the templates above. Other targets
+// use the templates. All but inv round exactly as the templates do. qrot stays scalar, as a single rotation does not fill the lanes.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+namespace sse
+{
+    inline __m128           load    (const float4 & a)                                  { return _mm_loadu_ps(&a.x); }
+    inline float4           store   (__m128 v)                                          { float4 r; _mm_storeu_ps(&r.x, v); return r; }
+    template<int I> __m128  splat   (__m128 v)                                          { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(I,I,I,I)); }
+    inline __m128           mul     (__m128 x, __m128 y, __m128 z, __m128 w, __m128 b)  { return _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, splat<0>(b)), _mm_mul_ps(y, splat<1>(b))), _mm_mul_ps(z, splat<2>(b))), _mm_mul_ps(w, splat<3>(b))); }
+    inline __m128           flip    (float x, float y, float z, float w)                { return _mm_setr_ps(x, y, z, w); } // Multiplying by +-1 only changes signs, so it rounds nothing
+}
+
+inline float4               operator +  (const float4 & a, const float4 & b)            { return sse::store(_mm_add_ps(sse::load(a), sse::load(b))); }
+inline float4               operator -  (const float4 & a, const float4 & b)            { return sse::store(_mm_sub_ps(sse::load(a), sse::load(b))); }
+inline float4               operator *  (const float4 & a, const float4 & b)            { return sse::store(_mm_mul_ps(sse::load(a), sse::load(b))); }
+inline float4               operator /  (const float4 & a, const float4 & b)            { return sse::store(_mm_div_ps(sse::load(a), sse::load(b))); }
+inline float4               operator +  (const float4 & a, float b)                     { return sse::store(_mm_add_ps(sse::load(a), _mm_set1_ps(b))); }
+inline float4               operator -  (const float4 & a, float b)                     { return sse::store(_mm_sub_ps(sse::load(a), _mm_set1_ps(b))); }
+inline float4               operator *  (const float4 & a, float b)                     { return sse::store(_mm_mul_ps(sse::load(a), _mm_set1_ps(b))); }
+inline float4               operator /  (const float4 & a, float b)                     { return sse::store(_mm_div_ps(sse::load(a), _mm_set1_ps(b))); }
+
+inline float4               mul         (const float4x4 & a, const float4 & b)          { return sse::store(sse::mul(sse::load(a.x), sse::load(a.y), sse::load(a.z), sse::load(a.w), sse::load(b))); }
+inline float4x4             mul         (const float4x4 & a, const float4x4 & b)
+{
+    auto x = sse::load(a.x), y = sse::load(a.y), z = sse::load(a.z), w = sse::load(a.w);
+    return {sse::store(sse::mul(x, y, z, w, sse::load(b.x))), sse::store(sse::mul(x, y, z, w, sse::load(b.y))), sse::store(sse::mul(x, y, z, w, sse::load(b.z))), sse::store(sse::mul(x, y, z, w, sse::load(b.w)))};
+}
+inline float4x4             transpose   (const float4x4 & a)
+{
+    auto x = sse::load(a.x), y = sse::load(a.y), z = sse::load(a.z), w = sse::load(a.w);
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    return {sse::store(x), sse::store(y), sse::store(z), sse::store(w)};
+}
+
+// Each lane is a sum of the same four products as in the template, with subtracted products negated before adding, which is exact
+inline float4               qmul        (const float4 & a, const float4 & b)
+{
+    auto va = sse::load(a), vb = sse::load(b);
+    auto t1 = _mm_mul_ps(va, sse::splat<3>(vb));
+    auto t2 = _mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(va, va, _MM_SHUFFLE(0,3,3,3)), _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(0,2,1,0))), sse::flip(1,1,1,-1));
+    auto t3 = _mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(va, va, _MM_SHUFFLE(1,0,2,1)), _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(1,1,0,2))), sse::flip(1,1,1,-1));
+    auto t4 = _mm_mul_ps(_mm_shuffle_ps(va, va, _MM_SHUFFLE(2,1,0,2)), _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2,0,2,1)));
+    return sse::store(_mm_sub_ps(_mm_add_ps(_mm_add_ps(t1, t2), t3), t4));
+}
+
+// Cramer's rule over the cofactors of pairs of rows, following Intel's "Streaming SIMD Extensions - Inverse of 4x4 Matrix" (AP-928). The
+// routine reads its input as the transpose, and writes the inverse transposed, so column major matrices pass through unchanged.
+inline float4x4             inv         (const float4x4 & a)
+{
+    const float * src = &a.x.x;
+    __m128 tmp1 = _mm_setzero_ps(), row0, row1 = _mm_setzero_ps(), row2, row3 = _mm_setzero_ps(), minor0, minor1, minor2, minor3, det;
+    tmp1 = _mm_loadh_pi(_mm_loadl_pi(tmp1, reinterpret_cast<const __m64 *>(src)), reinterpret_cast<const __m64 *>(src+4));
+    row1 = _mm_loadh_pi(_mm_loadl_pi(row1, reinterpret_cast<const __m64 *>(src+8)), reinterpret_cast<const __m64 *>(src+12));
+    row0 = _mm_shuffle_ps(tmp1, row1, 0x88);
+    row1 = _mm_shuffle_ps(row1, tmp1, 0xDD);
+    tmp1 = _mm_loadh_pi(_mm_loadl_pi(tmp1, reinterpret_cast<const __m64 *>(src+2)), reinterpret_cast<const __m64 *>(src+6));
+    row3 = _mm_loadh_pi(_mm_loadl_pi(row3, reinterpret_cast<const __m64 *>(src+10)), reinterpret_cast<const __m64 *>(src+14));
+    row2 = _mm_shuffle_ps(tmp1, row3, 0x88);
+    row3 = _mm_shuffle_ps(row3, tmp1, 0xDD);
+
+    tmp1 = _mm_mul_ps(row2, row3);
+    tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0xB1);
+    minor0 = _mm_mul_ps(row1, tmp1);
+    minor1 = _mm_mul_ps(row0, tmp1);
+    tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0x4E);
+    minor0 = _mm_sub_ps(_mm_mul_ps(row1, tmp1), minor0);
+    minor1 = _mm_sub_ps(_mm_mul_ps(row0, tmp1), minor1);
+    minor1 = _mm_shuffle_ps(minor1, minor1, 0x4E);
+
+    tmp1 = _mm_mul_ps(row1, row2);
+    tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0xB1);
+    minor0 = _mm_add_ps(_mm_mul_ps(row3, tmp1), minor0);
+    minor3 = _mm_mul_ps(row0, tmp1);
+    tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0x4E);
+    minor0 = _mm_sub_ps(minor0, _mm_mul_ps(row3, tmp1));
+    minor3 = _mm_sub_ps(_mm_mul_ps(row0, tmp1), minor3);
+    minor3 = _mm_shuffle_ps(minor3, minor3, 0x4E);
+
+    tmp1 = _mm_mul_ps(_mm_shuffle_ps(row1, row1, 0x4E), row3);
+    tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0xB1);
+    row2 = _mm_shuffle_ps(row2, row2, 0x4E);
+    minor0 = _mm_add_ps(_mm_mul_ps(row2, tmp1), minor0);
+    minor2 = _mm_mul_ps(row0, tmp1);
+    tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0x4E);
+    minor0 = _mm_sub_ps(minor0, _mm_mul_ps(row2, tmp1));
+    minor2 = _mm_sub_ps(_mm_mul_ps(row0, tmp1), minor2);
+    minor2 = _mm_shuffle_ps(minor2, minor2, 0x4E);
+
+    tmp1 = _mm_mul_ps(row0, row1);
+    tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0xB1);
+    minor2 = _mm_add_ps(_mm_mul_ps(row3, tmp1), minor2);
+    minor3 = _mm_sub_ps(_mm_mul_ps(row2, tmp1), minor3);
+    tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0x4E);
+    minor2 = _mm_sub_ps(_mm_mul_ps(row3, tmp1), minor2);
+    minor3 = _mm_sub_ps(minor3, _mm_mul_ps(row2, tmp1));
+
+    tmp1 = _mm_mul_ps(row0, row3);
+    tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0xB1);
+    minor1 = _mm_sub_ps(minor1, _mm_mul_ps(row2, tmp1));
+    minor2 = _mm_add_ps(_mm_mul_ps(row1, tmp1), minor2);
+    tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0x4E);
+    minor1 = _mm_add_ps(_mm_mul_ps(row2, tmp1), minor1);
+    minor2 = _mm_sub_ps(minor2, _mm_mul_ps(row1, tmp1));
+
+    tmp1 = _mm_mul_ps(row0, row2);
+    tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0xB1);
+    minor1 = _mm_add_ps(_mm_mul_ps(row3, tmp1), minor1);
+    minor3 = _mm_sub_ps(minor3, _mm_mul_ps(row1, tmp1));
+    tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0x4E);
+    minor1 = _mm_sub_ps(minor1, _mm_mul_ps(row3, tmp1));
+    minor3 = _mm_add_ps(_mm_mul_ps(row1, tmp1), minor3);
+
+    // Divide by the determinant exactly, rather than through the approximate reciprocal of the original
+    det = _mm_mul_ps(row0, minor0);
+    det = _mm_add_ps(_mm_shuffle_ps(det, det, 0x4E), det);
+    det = _mm_add_ss(_mm_shuffle_ps(det, det, 0xB1), det);
+    det = sse::splat<0>(det);
+    return {sse::store(_mm_div_ps(minor0, det)), sse::store(_mm_div_ps(minor1, det)), sse::store(_mm_div_ps(minor2, det)), sse::store(_mm_div_ps(minor3, det))};
+}
+#endif
+
 #endif
\ No newline at end of file
@@ -1,84 +1,284 @@
 #include "load.h"
+#include "file.h"
+#include "json.h"
+#include "parallel.h"
 
-#include <map>
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 
-Mesh LoadMeshFromObj(const std::string & filepath, bool swapYZ)
+// Whitespace within a line of an OBJ file
+static bool IsBlank(char ch) { return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\v' || ch == '\f'; }
+static const char * SkipBlanks(const char * it, const char * last) { while(it != last && IsBlank(*it)) ++it; return it; }
+static const char * SkipToken(const char * it, const char * last) { while(it != last && *it != '\n' && !IsBlank(*it)) ++it; return it; }
+static const char * NextLine(const char * it, const char * last) { auto eol = static_cast<const char *>(memchr(it, '\n', last - it)); return eol ? eol + 1 : last; }
+static bool IsDigit(char ch) { return ch >= '0' && ch <= '9'; }
+
+// Parses a decimal number such as 1, -0.5, +.25, or 1.5e-3, leaving it unchanged if there is no number at it
+static bool ParseFloat(const char * & it, const char * last, float & value)
+{
+    auto first = it, p = it;
+    if(p != last && (*p == '+' || *p == '-')) ++p;
+    if(first != last && *first == '+') ++first; // parseJsonFloat accepts a leading minus only
+    auto digits = p;
+    while(p != last && IsDigit(*p)) ++p;
+    bool hasDigits = p != digits;
+    if(p != last && *p == '.') for(++p; p != last && IsDigit(*p); ++p) hasDigits = true;
+    if(!hasDigits) return false;
+    if(p != last && (*p == 'e' || *p == 'E'))
+    {
+        auto e = p + 1;
+        if(e != last && (*e == '+' || *e == '-')) ++e;
+        if(e != last && IsDigit(*e)) { p = e; while(p != last && IsDigit(*p)) ++p; }
+    }
+    value = parseJsonFloat(first, p);
+    it = p;
+    return true;
+}
+
+// Parses up to count whitespace separated numbers, stopping at the first token which is not a number
+static const char * ParseFloats(const char * it, const char * last, float * values, int count)
+{
+    for(int i=0; i<count; ++i)
+    {
+        it = SkipBlanks(it, last);
+        if(!ParseFloat(it, last, values[i])) break;
+    }
+    return it;
+}
+
+static bool ParseIndex(const char * & it, const char * last, int64_t & index)
 {
+    auto p = it;
+    bool negative = p != last && *p == '-';
+    if(p != last && (*p == '+' || *p == '-')) ++p;
+    if(p == last || !IsDigit(*p)) return false;
+    int64_t magnitude = 0;
+    for(; p != last && IsDigit(*p); ++p) if(magnitude < INT32_MAX) magnitude = magnitude * 10 + (*p - '0');
+    index = negative ? -magnitude : magnitude;
+    it = p;
+    return true;
+}
 
-    std::ifstream in(filepath);
-    if(!in) throw std::runtime_error("File not found: " + filepath);
+// Converts a one-based index, or a negative index relative to the end of the list, into a one-based index, where zero means the attribute is absent
+static uint32_t ResolveIndex(int64_t index, size_t count, const std::string & filepath)
+{
+    const bool relative = index < 0;
+    if(relative) index += count + 1;
+    if(index < (relative ? 1 : 0) || index > static_cast<int64_t>(count)) throw std::runtime_error("Index out of range in " + filepath);
+    return static_cast<uint32_t>(index);
+}
 
-    std::vector<Vertex> vertices;
-    std::map<std::string, size_t> indices;
-    std::vector<uint3> triangles;
+// Maps the position, texcoord, and normal indices of a face vertex to the index of the corresponding mesh vertex, using open addressing
+class ObjVertexTable
+{
+    struct Slot { uint3 key; uint32_t vertex; };
+    std::vector<Slot> slots;
+    size_t count;
 
-    std::vector<float4> positions;
-    std::vector<float3> texCoords, normals;
-    std::string line;
-    while(in)
+    static size_t Hash(const uint3 & key) { uint32_t h = key.x * 0x9E3779B1u ^ key.y * 0x85EBCA77u ^ key.z * 0xC2B2AE3Du; return h ^ (h >> 15); }
+    Slot & Find(const uint3 & key)
     {
-        std::getline(in, line);
-        if(!in) break;
-        
-        std::istringstream inLine(line);
-        std::string token;
-        inLine >> token;
-        if(token == "v")
+        for(size_t mask = slots.size() - 1, i = Hash(key) & mask; ; i = (i + 1) & mask)
         {
-            float4 position = {0,0,0,1};
-            inLine >> position.x >> position.y >> position.z >> position.w;
-            positions.push_back(position);
+            auto & slot = slots[i];
+            if(slot.vertex == UINT32_MAX || slot.key == key) return slot;
         }
-        if(token == "vt")
+    }
+public:
+    ObjVertexTable() : slots(1024, Slot{{}, UINT32_MAX}), count() {}
+
+    // Returns the vertex previously inserted for key, or inserts and returns newVertex
+    uint32_t Insert(const uint3 & key, uint32_t newVertex)
+    {
+        auto & slot = Find(key);
+        if(slot.vertex != UINT32_MAX) return slot.vertex;
+        slot = {key, newVertex};
+        if(++count * 2 > slots.size()) // Keep the load factor at or below one half
         {
-            float3 texCoord = {0,0,0};
-            inLine >> texCoord.x >> texCoord.y >> texCoord.z;
-            texCoords.push_back(texCoord);
+            std::vector<Slot> old(slots.size() * 2, Slot{{}, UINT32_MAX});
+            swap(old, slots);
+            for(auto & s : old) if(s.vertex != UINT32_MAX) Find(s.key) = s;
         }
-        if(token == "vn")
+        return newVertex;
+    }
+};
+
+enum class ObjRecord { Other, Position, TexCoord, Normal, Face };
+
+// Reads the keyword at the start of a line, returning a pointer just past it
+static const char * ParseKeyword(const char * it, const char * last, ObjRecord & record)
+{
+    auto keyword = SkipBlanks(it, last);
+    it = SkipToken(keyword, last);
+    auto length = it - keyword;
+    if(length == 1 && keyword[0] == 'v') record = ObjRecord::Position;
+    else if(length == 2 && keyword[0] == 'v' && keyword[1] == 't') record = ObjRecord::TexCoord;
+    else if(length == 2 && keyword[0] == 'v' && keyword[1] == 'n') record = ObjRecord::Normal;
+    else if(length == 1 && keyword[0] == 'f') record = ObjRecord::Face;
+    else record = ObjRecord::Other;
+    return it;
+}
+
+// The records from a range of whole lines of an OBJ file. Chunks can be parsed independently once the number of attributes defined before
+// them is known. Vertices are numbered in order of first use within the chunk, and renumbered when the chunks are merged.
+struct ObjChunk
+{
+    const char * first, * last;
+    size_t positionBase, texCoordBase, normalBase; // Number of attributes defined in earlier chunks
+    std::vector<float3> positions, normals;
+    std::vector<float2> texCoords;
+    std::vector<uint3> keys; // One-based (position, texCoord, normal) indices of each vertex, zero if absent
+    std::vector<uint3> triangles; // Indices into keys, and later into the vertices of the mesh
+    std::vector<uint32_t> vertices; // Mesh vertex for each entry in keys, filled in by the merge
+
+    ObjChunk(const char * first, const char * last) : first(first), last(last), positionBase(), texCoordBase(), normalBase() {}
+
+    void CountAttributes(size_t & positionCount, size_t & texCoordCount, size_t & normalCount) const
+    {
+        ObjRecord record;
+        for(auto it = first; it != last; it = NextLine(it, last))
         {
-            float3 normal = {0,0,0};
-            inLine >> normal.x >> normal.y >> normal.z;
-            normals.push_back(norm(normal));
+            ParseKeyword(it, last, record);
+            positionCount += record == ObjRecord::Position;
+            texCoordCount += record == ObjRecord::TexCoord;
+            normalCount += record == ObjRecord::Normal;
         }
+    }
 
-        if(token == "f")
+    void Parse(const std::string & filepath)
+    {
+        ObjVertexTable indices;
+        std::vector<uint32_t> faceIndices;
+        ObjRecord record;
+        for(auto it = first; it != last; it = NextLine(it, last))
         {
-            std::vector<uint32_t> faceIndices;
-            while(inLine)
+            it = ParseKeyword(it, last, record);
+            if(record == ObjRecord::Position)
             {
-                inLine >> token;
-                if(!inLine) break;
-                auto it = indices.find(token);
-                if(it != end(indices))
+                float4 position = {0,0,0,1};
+                it = ParseFloats(it, last, &position.x, 4);
+                positions.push_back(position.xyz());
+            }
+            else if(record == ObjRecord::TexCoord)
+            {
+                float3 texCoord = {0,0,0};
+                it = ParseFloats(it, last, &texCoord.x, 3);
+                texCoords.push_back(texCoord.xy());
+            }
+            else if(record == ObjRecord::Normal)
+            {
+                float3 normal = {0,0,0};
+                it = ParseFloats(it, last, &normal.x, 3);
+                normals.push_back(norm(normal));
+            }
+            else if(record == ObjRecord::Face)
+            {
+                // Each vertex is written as v, v/vt, v/vt/vn, or v//vn
+                faceIndices.clear();
+                while((it = SkipBlanks(it, last)) != last && *it != '\n' && *it != '#')
+                {
+                    int64_t i0=0, i1=0, i2=0;
+                    if(ParseIndex(it, last, i0) && it != last && *it == '/')
+                    {
+                        ParseIndex(++it, last, i1);
+                        if(it != last && *it == '/') ParseIndex(++it, last, i2);
+                    }
+                    it = SkipToken(it, last);
+
+                    uint3 key = {ResolveIndex(i0, positionBase + positions.size(), filepath), ResolveIndex(i1, texCoordBase + texCoords.size(), filepath), ResolveIndex(i2, normalBase + normals.size(), filepath)};
+                    auto index = indices.Insert(key, keys.size());
+                    if(index == keys.size()) keys.push_back(key);
+                    faceIndices.push_back(index);
+                }
+
+                for(size_t i=2; i<faceIndices.size(); ++i)
                 {
-                    faceIndices.push_back(it->second);
-                    continue;
+                    triangles.push_back({faceIndices[0], faceIndices[i-1], faceIndices[i]});
                 }
-                indices[token] = vertices.size();
-                faceIndices.push_back(vertices.size());
-
-                Vertex vertex;
-                bool skipTexCoords = token.find("//") != std::string::npos;
-                for(auto & ch : token) if(ch == '/') ch = ' ';
-                int i0=0, i1=0, i2=0;
-                std::istringstream(token) >> i0 >> i1 >> i2;
-                if(skipTexCoords) std::swap(i1, i2);
-                if(i0) vertex.position = positions[i0-1].xyz();
-                if(i1) vertex.texCoord = texCoords[i1-1].xy();
-                if(i2) vertex.normal = normals[i2-1];
-                vertices.push_back(vertex);                
             }
+        }
+    }
+};
+
+// Concatenates the given member of each chunk, in parallel
+template<class T> static std::vector<T> Concatenate(ThreadPool * threads, std::vector<ObjChunk> & chunks, std::vector<T> ObjChunk::*member)
+{
+    if(chunks.size() == 1) return std::move(chunks[0].*member);
+    std::vector<size_t> offsets(1, 0);
+    for(auto & chunk : chunks) offsets.push_back(offsets.back() + (chunk.*member).size());
+    std::vector<T> result(offsets.back());
+    ParallelFor(threads, chunks.size(), [&](size_t i) { std::copy(begin(chunks[i].*member), end(chunks[i].*member), result.begin() + offsets[i]); });
+    return result;
+}
+
+static Mesh ParseObj(const std::string & filepath, bool swapYZ, ThreadPool * threads)
+{
+    MappedFile file(filepath);
+
+    // Split the file at line boundaries into a few chunks per thread, and number the attributes of each chunk with a prefix sum of their counts
+    std::vector<ObjChunk> chunks;
+    const size_t minChunkSize = 1 << 20, threadCount = threads ? threads->GetThreadCount() : 1;
+    const size_t chunkSize = threadCount > 1 ? std::max(minChunkSize, file.size() / (threadCount * 4) + 1) : file.size();
+    for(auto it = file.begin(), last = file.end(); it != last; )
+    {
+        auto end = static_cast<size_t>(last - it) > chunkSize ? NextLine(it + chunkSize, last) : last;
+        chunks.push_back(ObjChunk(it, end));
+        it = end;
+    }
+    if(chunks.empty()) chunks.push_back(ObjChunk(file.begin(), file.end()));
+    if(chunks.size() > 1)
+    {
+        std::vector<size_t> counts(chunks.size() * 3);
+        ParallelFor(threads, chunks.size(), [&](size_t i) { chunks[i].CountAttributes(counts[i*3+0], counts[i*3+1], counts[i*3+2]); });
+        for(size_t i=1; i<chunks.size(); ++i)
+        {
+            chunks[i].positionBase = chunks[i-1].positionBase + counts[i*3-3];
+            chunks[i].texCoordBase = chunks[i-1].texCoordBase + counts[i*3-2];
+            chunks[i].normalBase = chunks[i-1].normalBase + counts[i*3-1];
+        }
+    }
+    ParallelFor(threads, chunks.size(), [&](size_t i) { chunks[i].Parse(filepath); });
 
-            for(size_t i=2; i<faceIndices.size(); ++i)
+    // Number the vertices in order of first use across the whole file, as a serial parse would, then renumber the triangles of each chunk
+    std::vector<uint3> keys;
+    if(chunks.size() == 1) keys = std::move(chunks[0].keys);
+    else
+    {
+        ObjVertexTable indices;
+        for(auto & chunk : chunks)
+        {
+            for(auto & key : chunk.keys)
             {
-                triangles.push_back({faceIndices[0], faceIndices[i-1], faceIndices[i]});
+                chunk.vertices.push_back(indices.Insert(key, keys.size()));
+                if(chunk.vertices.back() == keys.size()) keys.push_back(key);
             }
         }
+        ParallelFor(threads, chunks.size(), [&](size_t i)
+        {
+            auto & chunk = chunks[i];
+            for(auto & tri : chunk.triangles) tri = {chunk.vertices[tri.x], chunk.vertices[tri.y], chunk.vertices[tri.z]};
+        });
     }
-    in.close();
+
+    auto positions = Concatenate(threads, chunks, &ObjChunk::positions);
+    auto texCoords = Concatenate(threads, chunks, &ObjChunk::texCoords);
+    auto normals = Concatenate(threads, chunks, &ObjChunk::normals);
+    auto triangles = Concatenate(threads, chunks, &ObjChunk::triangles);
+
+    const size_t vertexBlock = 1 << 16;
+    std::vector<Vertex> vertices(keys.size());
+    ParallelFor(threads, (vertices.size() + vertexBlock - 1) / vertexBlock, [&](size_t block)
+    {
+        for(size_t i = block * vertexBlock, n = std::min(i + vertexBlock, vertices.size()); i < n; ++i)
+        {
+            auto & key = keys[i];
+            if(key.x) vertices[i].position = positions[key.x-1];
+            if(key.y) vertices[i].texCoord = texCoords[key.y-1];
+            if(key.z) vertices[i].normal = normals[key.z-1];
+        }
+    });
 
     if(swapYZ)
     {
@@ -97,20 +297,86 @@ Mesh LoadMeshFromObj(const std::string & filepath, bool swapYZ)
     mesh.vertices = std::move(vertices);
     mesh.triangles = std::move(triangles);
     if(normals.empty()) mesh.ComputeNormals();
+    return mesh;
+}
+
+Mesh LoadMeshFromObj(const std::string & filepath, bool swapYZ, ThreadPool * threads)
+{
+    auto mesh = ParseObj(filepath, swapYZ, threads);
+    mesh.Upload();
+    return mesh;
+}
+
+// Header of a binary mesh file, which is followed by the vertices and triangles of the mesh in their in-memory layout
+struct MeshFileHeader
+{
+    enum : uint32_t { Magic = 0x4853454D, CurrentVersion = 1 }; // Magic is "MESH" in little endian order
+
+    uint32_t magic, version;
+    uint32_t vertexSize, triangleSize;      // Guards against layout changes which do not bump the version
+    uint64_t vertexCount, triangleCount;
+    uint64_t sourceSize;                    // Size and modification time of the OBJ file the mesh was loaded from
+    int64_t sourceModifiedTime;
+    uint32_t swapYZ, reserved;
+};
+
+static bool LoadMeshFile(const std::string & filepath, const MeshFileHeader & expected, Mesh & mesh)
+{
+    // A missing or truncated cache is rejected before mapping it. Its own modification time does not matter, as the header records the source's.
+    uint64_t size; int64_t modifiedTime;
+    if(!GetFileInfo(filepath, size, modifiedTime) || size < sizeof(MeshFileHeader)) return false;
+
+    MappedFile file(filepath);
+    MeshFileHeader header;
+    if(file.size() != size) return false; // Replaced since it was checked
+    memcpy(&header, file.begin(), sizeof(header));
+    if(header.magic != expected.magic || header.version != expected.version || header.vertexSize != expected.vertexSize || header.triangleSize != expected.triangleSize
+        || header.sourceSize != expected.sourceSize || header.sourceModifiedTime != expected.sourceModifiedTime || header.swapYZ != expected.swapYZ) return false;
+    if(header.vertexCount > file.size() / sizeof(Vertex) || header.triangleCount > file.size() / sizeof(uint3)) return false;
+    if(file.size() != sizeof(header) + header.vertexCount * sizeof(Vertex) + header.triangleCount * sizeof(uint3)) return false;
+
+    auto vertices = file.begin() + sizeof(header);
+    auto triangles = vertices + header.vertexCount * sizeof(Vertex);
+    mesh.vertices.resize(header.vertexCount);
+    mesh.triangles.resize(header.triangleCount);
+    memcpy(mesh.vertices.data(), vertices, header.vertexCount * sizeof(Vertex));
+    memcpy(mesh.triangles.data(), triangles, header.triangleCount * sizeof(uint3));
+    return true;
+}
+
+// Writes to a temporary file which is then renamed over filepath, so that a partially written file is never loaded
+static void SaveMeshFile(const std::string & filepath, const MeshFileHeader & header, const Mesh & mesh)
+{
+    auto temppath = filepath + ".tmp";
+    FILE * f = fopen(temppath.c_str(), "wb");
+    if(!f) return; // The cache is optional, for instance the asset directory may be read-only
+    bool written = fwrite(&header, sizeof(header), 1, f) == 1;
+    if(written && !mesh.vertices.empty()) written = fwrite(mesh.vertices.data(), sizeof(Vertex), mesh.vertices.size(), f) == mesh.vertices.size();
+    if(written && !mesh.triangles.empty()) written = fwrite(mesh.triangles.data(), sizeof(uint3), mesh.triangles.size(), f) == mesh.triangles.size();
+    written &= fclose(f) == 0;
+    if(!written || !RenameFile(temppath, filepath)) remove(temppath.c_str());
+}
+
+Mesh LoadMeshFromObjCached(const std::string & filepath, bool swapYZ, ThreadPool * threads)
+{
+    MeshFileHeader header = {MeshFileHeader::Magic, MeshFileHeader::CurrentVersion, sizeof(Vertex), sizeof(uint3), 0, 0, 0, 0, swapYZ, 0};
+    if(!GetFileInfo(filepath, header.sourceSize, header.sourceModifiedTime)) throw std::runtime_error("File not found: " + filepath);
+
+    Mesh mesh;
+    auto cachepath = filepath + ".mesh";
+    if(!LoadMeshFile(cachepath, header, mesh))
+    {
+        mesh = ParseObj(filepath, swapYZ, threads);
+        header.vertexCount = mesh.vertices.size();
+        header.triangleCount = mesh.triangles.size();
+        SaveMeshFile(cachepath, header, mesh);
+    }
     mesh.Upload();
     return mesh;
 }
 
 std::string LoadTextFile(const std::string & filename)
 {
-    FILE * f = fopen(filename.c_str(), "rb");
-    if(!f) throw std::runtime_error("File not found: " + filename);
-    fseek(f, 0, SEEK_END);
-    auto len = ftell(f);
-    std::string contents((size_t)len, ' ');
-    contents.resize(len);
-    fseek(f, 0, SEEK_SET);
-    fread(&contents[0], 1, contents.size(), f);
-    fclose(f);
-    return contents;
+    MappedFile file(filename);
+    return std::string(file.begin(), file.end());
 }
\ No newline at end of file
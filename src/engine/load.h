@@ -4,6 +4,8 @@
 #include "gl.h"
 #include "geometry.h"
 
+#include <memory>
+
 struct Vertex { float3 position, normal; float2 texCoord; };
 
 struct Mesh
@@ -11,16 +13,30 @@ struct Mesh
     std::vector<Vertex> vertices;
     std::vector<uint3> triangles;
     gl::Mesh glMesh;
+    mutable std::shared_ptr<const TriangleBvh> bvh; // Built by the first call to GetBvh or Hit, and discarded by Upload, AddCylinder, and AddBox
+    Bounds bounds;                                  // Of the vertex positions, as of the last call to Upload or ComputeBounds
 
     Mesh() {}
     Mesh(Mesh && m) : Mesh() { *this = std::move(m); }
-    Mesh & operator = (Mesh && m) { vertices=move(m.vertices); triangles=move(m.triangles); glMesh=std::move(m.glMesh); return *this; }
+    Mesh & operator = (Mesh && m) { vertices=move(m.vertices); triangles=move(m.triangles); glMesh=std::move(m.glMesh); bvh=move(m.bvh); bounds=m.bounds; return *this; }
 
-    RayMeshHit Hit(const Ray & ray) const { return IntersectRayMesh(ray, vertices.data(), &Vertex::position, triangles.data(), triangles.size()); }
+    std::shared_ptr<const TriangleBvh> GetBvh() const
+    {
+        auto tree = std::atomic_load(&bvh); // Concurrent first calls may each build a tree, but all of them are equivalent
+        if(!tree) std::atomic_store(&bvh, tree = std::make_shared<const TriangleBvh>(vertices.data(), &Vertex::position, triangles.data(), triangles.size()));
+        return tree;
+    }
+    RayMeshHit Hit(const Ray & ray) const { return GetBvh()->Hit(ray); }
 
-    void Upload();
+    void Upload(); // Also calls ComputeBounds
     void Draw() const;
 
+    void ComputeBounds()
+    {
+        bounds = Bounds();
+        for(auto & vert : vertices) bounds.Include(vert.position);
+    }
+
     void ComputeNormals()
     {
         for(auto & vert : vertices) vert.normal = float3(0,0,0);
@@ -35,6 +51,7 @@ struct Mesh
 
     void AddCylinder(const float3 & center0, float radius0, const float3 & center1, float radius1, const float3 & axisA, const float3 & axisB, int segments)
     {
+        bvh.reset();
         uint32_t base = vertices.size();
         for(uint32_t i=0, n=segments; i<n; ++i)
         {
@@ -50,6 +67,7 @@ struct Mesh
 
     void AddBox(const float3 & b0, const float3 & b1)
     {
+        bvh.reset();
         static const float3 verts[] = {{1,0,0}, {1,1,0}, {1,1,1}, {1,0,1}, {0,1,0}, {0,0,0}, {0,0,1}, {0,1,1}, {0,1,0}, {0,1,1}, {1,1,1}, {1,1,0}, {0,0,1}, {0,0,0}, {1,0,0}, {1,0,1}, {0,0,1}, {1,0,1}, {1,1,1}, {0,1,1}, {1,0,0}, {0,0,0}, {0,1,0}, {1,1,0}};
         static const uint3 tris[] = {{0,1,2}, {0,2,3}, {4,5,6}, {4,6,7}, {8,9,10}, {8,10,11}, {12,13,14}, {12,14,15}, {16,17,18}, {16,18,19}, {20,21,22}, {20,22,23}};
         uint32_t base = vertices.size();
@@ -58,7 +76,10 @@ struct Mesh
     }
 };
 
-Mesh LoadMeshFromObj(const std::string & filepath, bool swapYZ);
+class ThreadPool;
+
+Mesh LoadMeshFromObj(const std::string & filepath, bool swapYZ, ThreadPool * threads = nullptr); // Large files are parsed in parallel if threads is given, with identical results
+Mesh LoadMeshFromObjCached(const std::string & filepath, bool swapYZ, ThreadPool * threads = nullptr); // As above, but reuses a binary copy of the mesh stored in filepath + ".mesh" until the OBJ changes
 std::string LoadTextFile(const std::string & filename);
 
 #endif
\ No newline at end of file
@@ -26,6 +26,35 @@ public:
     template<class T> std::enable_if_t<std::is_class<T>::value, JsonValue> Save(const T & object) { JsonObject o; VisitFields((T&)object, Visitor{*this,o}); return o; }
 };
 
+// Writes objects directly to a JsonWriter, without building a JsonValue. Output matches JsonSerializer, which omits null fields.
+class JsonStreamSerializer
+{
+    struct Visitor { JsonStreamSerializer & j; template<class U> void operator() (const char * name, const U & field) { if(!IsNull(field)) { j.writer.key(name); j.Save(field); } } };
+    JsonWriter & writer;
+
+    template<class T> static bool IsNull(const T &) { return false; }
+    static bool IsNull(float object) { return !std::isfinite(object); }
+    static bool IsNull(double object) { return !std::isfinite(object); }
+    template<class T> static bool IsNull(const std::unique_ptr<T> & object) { return !object; }
+    template<class T> static bool IsNull(const std::shared_ptr<T> & object) { return !object; }
+    template<class T> static bool IsNull(const AssetLibrary::Handle<T> & object) { return !object; }
+public:
+    JsonStreamSerializer(JsonWriter & writer) : writer(writer) {}
+
+    void Save(const bool & object) { writer.value(object); }
+    void Save(const std::string & object) { writer.value(object); }
+    template<class T> std::enable_if_t<std::is_arithmetic<T>::value, void> Save(const T & object) { writer.value(object); }
+    template<class T> void Save(const vec<T,2> & object) { writer.beginArray(); Save(object.x); Save(object.y); writer.endArray(); }
+    template<class T> void Save(const vec<T,3> & object) { writer.beginArray(); Save(object.x); Save(object.y); Save(object.z); writer.endArray(); }
+    template<class T> void Save(const vec<T,4> & object) { writer.beginArray(); Save(object.x); Save(object.y); Save(object.z); Save(object.w); writer.endArray(); }
+    void Save(const Pose & object) { writer.beginArray(); Save(object.position); Save(object.orientation); writer.endArray(); }
+    template<class T> void Save(const std::unique_ptr<T> & object) { if(object) Save(*object); else writer.value(nullptr); }
+    template<class T> void Save(const std::shared_ptr<T> & object) { if(object) Save(*object); else writer.value(nullptr); }
+    template<class T> void Save(const std::vector<T> & object) { writer.beginArray(); for(auto & elem : object) Save(elem); writer.endArray(); }
+    template<class T> void Save(const AssetLibrary::Handle<T> & object) { if(object) writer.value(object.GetId()); else writer.value(nullptr); }
+    template<class T> std::enable_if_t<std::is_class<T>::value, void> Save(const T & object) { writer.beginObject(); VisitFields((T&)object, Visitor{*this}); writer.endObject(); }
+};
+
 class JsonDeserializer
 {
     struct Visitor { JsonDeserializer & j; const JsonValue & value; template<class U> void operator() (const char * name, U & field) { j.Load(field, value[name]); } };
@@ -47,11 +76,67 @@ public:
     template<class T> std::enable_if_t<std::is_class<T>::value, void> Load(T & object, const JsonValue & value) { VisitFields(object, Visitor{*this,value}); }
 };
 
+// Loads objects directly from the events of a JsonReader, without building a JsonValue. Each Load() expects the reader to be on the first
+// event of a value, and leaves it on the last. Results match JsonDeserializer: absent fields are loaded as though they were null, only the
+// first of any duplicate keys is used, and unrecognized keys are skipped.
+class JsonStreamDeserializer
+{
+    struct FieldFinder { const std::string & key; int & found; int index; template<class U> void operator() (const char * name, U &) { if (found < 0 && key == name) found = index; ++index; } };
+    struct FieldLoader { JsonStreamDeserializer & j; int target, index; template<class U> void operator() (const char *, U & field) { if (index++ == target) j.Load(field); } };
+    struct FieldCounter { int & count; template<class U> void operator() (const char *, U &) { ++count; } };
+    struct NullLoader { JsonStreamDeserializer & j; const std::vector<bool> & loaded; int index; template<class U> void operator() (const char *, U & field) { if (!loaded[index++]) j.LoadNull(field); } };
+    JsonReader & reader;
+    AssetLibrary & assets;
+
+    template<class T> void LoadNull(T & object) { JsonDeserializer(assets).Load(object, JsonValue()); }
+    template<class F> void LoadElements(F load) { if (reader.current() != JsonReader::BeginArray) { reader.skip(); return; } for (int i = 0; reader.next() != JsonReader::EndArray; ++i) load(i); }
+    template<class T, int M> void LoadVector(vec<T,M> & object) { int n = 0; LoadElements([&](int i) { if (i < M) Load(object[n++]); else reader.skip(); }); for (; n < M; ++n) LoadNull(object[n]); }
+public:
+    JsonStreamDeserializer(JsonReader & reader, AssetLibrary & assets) : reader(reader), assets(assets) {}
+
+    void Load(bool & object) { object = reader.current() == JsonReader::True; reader.skip(); }
+    void Load(std::string & object) { if (reader.current() == JsonReader::String) object = reader.string(); else { object.clear(); reader.skip(); } }
+    template<class T> std::enable_if_t<std::is_arithmetic<T>::value, void> Load(T & object) { object = reader.current() == JsonReader::Number ? reader.number<T>() : T(); reader.skip(); }
+    template<class T> void Load(vec<T,2> & object) { LoadVector(object); }
+    template<class T> void Load(vec<T,3> & object) { LoadVector(object); }
+    template<class T> void Load(vec<T,4> & object) { LoadVector(object); }
+    void Load(Pose & object) { int n = 0; LoadElements([&](int i) { if (i == 0) Load(object.position); else if (i == 1) Load(object.orientation); else reader.skip(); n = i + 1; }); if (n < 1) LoadNull(object.position); if (n < 2) LoadNull(object.orientation); }
+    template<class T> void Load(std::unique_ptr<T> & object) { if (reader.current() == JsonReader::BeginObject) { object = std::make_unique<T>(); Load(*object); } else { object.reset(); reader.skip(); } }
+    template<class T> void Load(std::shared_ptr<T> & object) { if (reader.current() == JsonReader::BeginObject) { object = std::make_shared<T>(); Load(*object); } else { object.reset(); reader.skip(); } }
+    template<class T> void Load(std::vector<T> & object) { object.clear(); LoadElements([&](int) { object.emplace_back(); Load(object.back()); }); }
+    template<class T> void Load(AssetLibrary::Handle<T> & object) { std::string id; Load(id); object = assets.GetAsset<T>(id); }
+    template<class T> std::enable_if_t<std::is_class<T>::value, void> Load(T & object)
+    {
+        int fields = 0;
+        VisitFields(object, FieldCounter{fields});
+        std::vector<bool> loaded(fields);
+        if (reader.current() == JsonReader::BeginObject) while (reader.next() == JsonReader::Key)
+        {
+            int field = -1;
+            VisitFields(object, FieldFinder{reader.string(), field, 0});
+            reader.next();
+            if (field < 0 || loaded[field]) reader.skip();
+            else
+            {
+                VisitFields(object, FieldLoader{*this, field, 0});
+                loaded[field] = true;
+            }
+        }
+        else reader.skip();
+        VisitFields(object, NullLoader{*this, loaded, 0});
+    }
+};
+
 template<class T> JsonValue SerializeToJson(const T & object)
 {
     return JsonSerializer().Save(object);
 }
 
+template<class T> void SerializeToJson(JsonWriter & writer, const T & object)
+{
+    JsonStreamSerializer(writer).Save(object);
+}
+
 template<class T> T DeserializeFromJson(const JsonValue & value, AssetLibrary & assets)
 {
     T object;
@@ -59,4 +144,13 @@ template<class T> T DeserializeFromJson(const JsonValue & value, AssetLibrary &
     return object;
 }
 
+template<class T> T DeserializeFromJson(JsonReader & reader, AssetLibrary & assets)
+{
+    T object;
+    reader.next();
+    JsonStreamDeserializer(reader, assets).Load(object);
+    reader.next(); // Ensure nothing follows the value
+    return object;
+}
+
 #endif
@@ -0,0 +1,73 @@
+#include "parallel.h"
+
+ThreadPool::ThreadPool(size_t threadCount) : task(), count(), busy(), next(), generation(), quit(), errorIndex()
+{
+    for(size_t i=1; i<threadCount; ++i) workers.push_back(std::thread([this]()
+    {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true)
+        {
+            wake.wait(lock, [this, seen]() { return quit || generation != seen; });
+            if(quit) return;
+            seen = generation;
+            lock.unlock();
+            Work();
+            lock.lock();
+            if(--busy == 0) done.notify_one();
+        }
+    }));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    for(auto & worker : workers) worker.join();
+}
+
+void ThreadPool::Work()
+{
+    for(size_t i; (i = next++) < count; )
+    {
+        try { (*task)(i); }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!error || i < errorIndex) { error = std::current_exception(); errorIndex = i; }
+        }
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)> & task)
+{
+    if(workers.empty() || count <= 1)
+    {
+        for(size_t i=0; i<count; ++i) task(i);
+        return;
+    }
+
+    std::lock_guard<std::mutex> call(callMutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->task = &task;
+        this->count = count;
+        next = 0;
+        busy = workers.size();
+        ++generation;
+    }
+    wake.notify_all();
+    Work();
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return busy == 0; });
+        this->task = nullptr;
+        std::swap(error, this->error);
+    }
+    if(error) std::rethrow_exception(error);
+}
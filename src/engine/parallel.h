@@ -0,0 +1,50 @@
+#ifndef ENGINE_PARALLEL_H
+#define ENGINE_PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, which execute the iterations of indexed loops together with the calling thread
+class ThreadPool
+{
+    std::vector<std::thread>                    workers;
+    std::mutex                                  callMutex;      // Serializes calls to ParallelFor
+    std::mutex                                  mutex;
+    std::condition_variable                     wake, done;
+    const std::function<void(size_t)> *         task;
+    size_t                                      count, busy;
+    std::atomic<size_t>                         next;
+    uint64_t                                    generation;
+    bool                                        quit;
+    std::exception_ptr                          error;
+    size_t                                      errorIndex;
+
+    void                                        Work();
+public:
+                                                ThreadPool(size_t threadCount = std::thread::hardware_concurrency()); // threadCount includes the calling thread
+                                                ThreadPool(const ThreadPool &) = delete;
+                                                ~ThreadPool();
+
+    ThreadPool &                                operator = (const ThreadPool &) = delete;
+
+    size_t                                      GetThreadCount() const { return workers.size() + 1; }
+
+    // Calls task(i) for each i in [0, count) and returns once all calls have finished. If any calls throw, the exception from the lowest index
+    // is rethrown. Must not be called from within a task.
+    void                                        ParallelFor(size_t count, const std::function<void(size_t)> & task);
+};
+
+// Calls threads->ParallelFor, or runs the loop on the calling thread if threads is null
+template<class F> void ParallelFor(ThreadPool * threads, size_t count, F task)
+{
+    if(threads) threads->ParallelFor(count, task);
+    else for(size_t i=0; i<count; ++i) task(i);
+}
+
+#endif
@@ -0,0 +1,59 @@
+#include "render.h"
+
+#include <algorithm>
+#include <cstring>
+
+static uint16_t GetId(std::unordered_map<const void *, uint16_t> & ids, const void * object)
+{
+    auto it = ids.find(object);
+    if(it != ids.end()) return it->second;
+    auto id = static_cast<uint16_t>(std::min<size_t>(ids.size(), 0xFFFF));
+    ids[object] = id;
+    return id;
+}
+
+void RenderQueue::Clear()
+{
+    items.clear();
+    keys.clear();
+    programIds.clear();
+    meshIds.clear();
+}
+
+void RenderQueue::Add(const DrawItem & item, float depth)
+{
+    // Non-negative floats order the same way as their bit patterns, so the depth can fill the low bits as is
+    uint32_t depthBits = 0;
+    if(depth > 0) memcpy(&depthBits, &depth, sizeof(depthBits));
+    uint64_t key = uint64_t(GetId(programIds, item.program)) << 48 | uint64_t(GetId(meshIds, item.mesh)) << 32 | depthBits;
+    keys.push_back({key, static_cast<uint32_t>(items.size())});
+    items.push_back(item);
+}
+
+void RenderQueue::Submit(IRenderBackend & backend)
+{
+    // Radix sort on one byte of the keys at a time, from the least significant, which is stable, so draws with equal keys keep the order they
+    // were added in. Bytes which every key shares are skipped, which with few programs and meshes leaves little more than the depth.
+    sorted.resize(keys.size());
+    for(int shift=0; shift<64 && !keys.empty(); shift+=8)
+    {
+        size_t offsets[256] = {};
+        for(auto & key : keys) ++offsets[key.first >> shift & 0xFF];
+        if(offsets[keys[0].first >> shift & 0xFF] == keys.size()) continue;
+        for(size_t i=0, offset=0; i<256; ++i) { auto count = offsets[i]; offsets[i] = offset; offset += count; }
+        for(auto & key : keys) sorted[offsets[key.first >> shift & 0xFF]++] = key;
+        keys.swap(sorted);
+    }
+
+    const gl::Program * program = nullptr;
+    const gl::Mesh * mesh = nullptr;
+    for(auto & key : keys)
+    {
+        auto & item = items[key.second];
+        if(item.program != program) backend.UseProgram(*(program = item.program));
+        if(item.mesh != mesh) backend.BindMesh(*(mesh = item.mesh));
+        if(item.binding >= 0) backend.BindUniforms(item.binding, item.perObject);
+        if(item.instances) backend.DrawInstanced(*item.mesh, *item.instances, item.firstInstance, item.instanceCount);
+        else backend.Draw(*item.mesh);
+    }
+}
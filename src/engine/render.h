@@ -0,0 +1,75 @@
+#ifndef ENGINE_RENDER_H
+#define ENGINE_RENDER_H
+
+#include "gl.h"
+
+#include <unordered_map>
+
+// Receives the state changes and draws submitted by a RenderQueue, so that the queue can drive GL or be recorded without a GPU
+struct IRenderBackend
+{
+    virtual void UseProgram(const gl::Program & program) = 0;
+    virtual void BindMesh(const gl::Mesh & mesh) = 0;
+    virtual void BindUniforms(GLuint binding, const gl::UniformRange & range) = 0;
+    virtual void Draw(const gl::Mesh & mesh) = 0; // Draws mesh, which is the bound mesh
+    virtual void DrawInstanced(const gl::Mesh & mesh, const gl::InstanceBuffer & instances, size_t firstInstance, GLsizei instanceCount) = 0;
+};
+
+class GLRenderBackend : public IRenderBackend
+{
+    const gl::UniformRing & uniforms;
+public:
+    GLRenderBackend(const gl::UniformRing & uniforms) : uniforms(uniforms) {}
+
+    void UseProgram(const gl::Program & program) override { program.Use(); }
+    void BindMesh(const gl::Mesh & mesh) override { mesh.Bind(); }
+    void BindUniforms(GLuint binding, const gl::UniformRange & range) override { uniforms.Bind(range, binding); }
+    void Draw(const gl::Mesh & mesh) override { mesh.DrawBound(); }
+    void DrawInstanced(const gl::Mesh & mesh, const gl::InstanceBuffer & instances, size_t firstInstance, GLsizei instanceCount) override { instances.Bind(firstInstance); mesh.DrawBoundInstanced(instanceCount); instances.Unbind(); }
+};
+
+// Records the commands it receives, for tests and benchmarks of a RenderQueue on machines without a GPU
+class RecordingRenderBackend : public IRenderBackend
+{
+public:
+    enum class Type { UseProgram, BindMesh, BindUniforms, Draw, DrawInstanced };
+    struct Command { Type type; const void * object; GLuint binding; gl::UniformRange range; const gl::InstanceBuffer * instances; size_t firstInstance; GLsizei instanceCount; };
+    std::vector<Command> commands;
+
+    void UseProgram(const gl::Program & program) override { commands.push_back({Type::UseProgram, &program, 0, {0,0}, nullptr, 0, 0}); }
+    void BindMesh(const gl::Mesh & mesh) override { commands.push_back({Type::BindMesh, &mesh, 0, {0,0}, nullptr, 0, 0}); }
+    void BindUniforms(GLuint binding, const gl::UniformRange & range) override { commands.push_back({Type::BindUniforms, nullptr, binding, range, nullptr, 0, 0}); }
+    void Draw(const gl::Mesh & mesh) override { commands.push_back({Type::Draw, &mesh, 0, {0,0}, nullptr, 0, 0}); }
+    void DrawInstanced(const gl::Mesh & mesh, const gl::InstanceBuffer & instances, size_t firstInstance, GLsizei instanceCount) override { commands.push_back({Type::DrawInstanced, &mesh, 0, {0,0}, &instances, firstInstance, instanceCount}); }
+};
+
+// Draw of a mesh with a program, along with the range of a uniform ring which holds the draw's own uniform block, or the run of instances
+// which the draw covers
+struct DrawItem
+{
+    const gl::Program * program;
+    const gl::Mesh * mesh;
+    GLint binding;                  // Binding point of the block in perObject, or -1 if the draw has none
+    gl::UniformRange perObject;
+    const gl::InstanceBuffer * instances; // Null unless the draw is instanced
+    size_t firstInstance;
+    GLsizei instanceCount;
+};
+
+// Collects the draws of a frame, and submits them in order of a 64 bit key, which packs the program, the mesh and the depth from the most
+// significant bits down. Draws which share a program run together, then those which also share a mesh, front to back. Submission skips the
+// program and mesh binds which would not change the bound state.
+class RenderQueue
+{
+    std::vector<DrawItem> items;
+    std::vector<std::pair<uint64_t, uint32_t>> keys, sorted;        // Key and index into items of each draw, and space for sorting them
+    std::unordered_map<const void *, uint16_t> programIds, meshIds; // Numbered in order of first use, with any beyond 0xFFFF sharing the last
+public:
+    size_t GetSize() const { return items.size(); }
+
+    void Clear();
+    void Add(const DrawItem & item, float depth);                   // depth orders draws sharing a mesh, nearest first, and must not be negative
+    void Submit(IRenderBackend & backend);                          // Leaves the draws in the queue until Clear
+};
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef ENGINE_SIMD_H
+#define ENGINE_SIMD_H
+
+#include <cstdint>
+#include <cstring>
+
+// Character classification over blocks of text, and lanes of float arithmetic. Uses AVX2 (AVX for floats) or SSE2 when the compiler targets
+// them, and 64-bit words or scalar floats otherwise.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define ENGINE_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ENGINE_SIMD_SSE2
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#define ENGINE_SIMD_FLOAT_AVX
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace simd
+{
+    inline int CountTrailingZeros(uint32_t mask) // mask must be nonzero
+    {
+#ifdef _MSC_VER
+        unsigned long index; _BitScanForward(&index, mask); return static_cast<int>(index);
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    inline bool IsSpace(char ch) { return ch == ' ' || (ch >= '\t' && ch <= '\r'); } // Matches isspace in the C locale
+    inline bool IsStringSpecial(char ch) { auto c = static_cast<uint8_t>(ch); return c == '"' || c == '\\' || c < 0x20 || c == 0x7F; }
+
+    // Returns the first character in [it, last) which is not whitespace, or last
+    inline const char * SkipWhitespace(const char * it, const char * last)
+    {
+        if (it == last || !IsSpace(*it)) return it; // Most runs are empty, or a single space
+#if defined(ENGINE_SIMD_AVX2)
+        for (; last - it >= 32; it += 32)
+        {
+            auto c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(it));
+            auto ws = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('\t' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), c)));
+            if (auto mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(ws))) return it + CountTrailingZeros(mask);
+        }
+#elif defined(ENGINE_SIMD_SSE2)
+        for (; last - it >= 16; it += 16)
+        {
+            auto c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+            auto ws = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('\t' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('\r' + 1))));
+            if (auto mask = ~static_cast<uint32_t>(_mm_movemask_epi8(ws)) & 0xFFFF) return it + CountTrailingZeros(mask);
+        }
+#endif
+        while (it != last && IsSpace(*it)) ++it;
+        return it;
+    }
+
+    // Returns the first character in [it, last) which is '"', '\\', a control character below 0x20, or 0x7F, or last. These are the characters
+    // which end or escape a run of plain text in a JSON string.
+    inline const char * FindStringSpecial(const char * it, const char * last)
+    {
+#if defined(ENGINE_SIMD_AVX2)
+        for (; last - it >= 32; it += 32)
+        {
+            auto c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(it));
+            auto control = _mm256_cmpeq_epi8(_mm256_min_epu8(c, _mm256_set1_epi8(0x1F)), c); // Unsigned c <= 0x1F
+            auto special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\\'))), _mm256_or_si256(control, _mm256_cmpeq_epi8(c, _mm256_set1_epi8(0x7F))));
+            if (auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(special))) return it + CountTrailingZeros(mask);
+        }
+#elif defined(ENGINE_SIMD_SSE2)
+        for (; last - it >= 16; it += 16)
+        {
+            auto c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+            auto control = _mm_cmpeq_epi8(_mm_min_epu8(c, _mm_set1_epi8(0x1F)), c); // Unsigned c <= 0x1F
+            auto special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('"')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\\'))), _mm_or_si128(control, _mm_cmpeq_epi8(c, _mm_set1_epi8(0x7F))));
+            if (auto mask = static_cast<uint32_t>(_mm_movemask_epi8(special))) return it + CountTrailingZeros(mask);
+        }
+#else
+        // Flag bytes of each word which are below 0x20, or equal to '"', '\\', or 0x7F. Borrows can flag bytes following a match,
+        // so flagged words are rechecked one character at a time.
+        const uint64_t ones = 0x0101010101010101, highs = 0x8080808080808080;
+        auto zeroBytes = [=](uint64_t x) { return (x - ones) & ~x & highs; };
+        for (; last - it >= 8; it += 8)
+        {
+            uint64_t word; memcpy(&word, it, sizeof(word));
+            if (((word - ones * 0x20) & ~word & highs) | zeroBytes(word ^ (ones * '"')) | zeroBytes(word ^ (ones * '\\')) | zeroBytes(word ^ (ones * 0x7F))) break;
+        }
+#endif
+        while (it != last && !IsStringSpecial(*it)) ++it;
+        return it;
+    }
+
+    // Lanes of floats for kernels written once for every instruction set: 8 lanes with AVX, 4 with SSE2, and 4 emulated lanes otherwise. Each
+    // operation rounds exactly as the scalar operation would, and Min and Max match std::min and std::max, including for NaNs and signed zeros.
+#if defined(ENGINE_SIMD_FLOAT_AVX)
+    struct maskv { __m256 v; };
+    struct floatv
+    {
+        enum { Width = 8 };
+        __m256 v;
+        floatv() {}
+        floatv(__m256 v) : v(v) {}
+        floatv(float f) : v(_mm256_set1_ps(f)) {}
+        static floatv Load(const float * p) { return _mm256_loadu_ps(p); }
+        void Store(float * p) const { _mm256_storeu_ps(p, v); }
+    };
+    inline floatv operator + (floatv a, floatv b) { return _mm256_add_ps(a.v, b.v); }
+    inline floatv operator - (floatv a, floatv b) { return _mm256_sub_ps(a.v, b.v); }
+    inline floatv operator * (floatv a, floatv b) { return _mm256_mul_ps(a.v, b.v); }
+    inline floatv operator / (floatv a, floatv b) { return _mm256_div_ps(a.v, b.v); }
+    inline maskv operator < (floatv a, floatv b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+    inline maskv operator > (floatv a, floatv b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+    inline maskv operator <= (floatv a, floatv b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+    inline maskv operator == (floatv a, floatv b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ)}; }
+    inline maskv operator & (maskv a, maskv b) { return {_mm256_and_ps(a.v, b.v)}; }
+    inline maskv operator | (maskv a, maskv b) { return {_mm256_or_ps(a.v, b.v)}; }
+    inline maskv AndNot(maskv a, maskv b) { return {_mm256_andnot_ps(b.v, a.v)}; } // a & ~b
+    inline floatv Select(maskv m, floatv a, floatv b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+    inline floatv Min(floatv a, floatv b) { return _mm256_min_ps(b.v, a.v); }
+    inline floatv Max(floatv a, floatv b) { return _mm256_max_ps(b.v, a.v); }
+    inline uint32_t MoveMask(maskv m) { return static_cast<uint32_t>(_mm256_movemask_ps(m.v)); }
+#elif defined(ENGINE_SIMD_SSE2)
+    struct maskv { __m128 v; };
+    struct floatv
+    {
+        enum { Width = 4 };
+        __m128 v;
+        floatv() {}
+        floatv(__m128 v) : v(v) {}
+        floatv(float f) : v(_mm_set1_ps(f)) {}
+        static floatv Load(const float * p) { return _mm_loadu_ps(p); }
+        void Store(float * p) const { _mm_storeu_ps(p, v); }
+    };
+    inline floatv operator + (floatv a, floatv b) { return _mm_add_ps(a.v, b.v); }
+    inline floatv operator - (floatv a, floatv b) { return _mm_sub_ps(a.v, b.v); }
+    inline floatv operator * (floatv a, floatv b) { return _mm_mul_ps(a.v, b.v); }
+    inline floatv operator / (floatv a, floatv b) { return _mm_div_ps(a.v, b.v); }
+    inline maskv operator < (floatv a, floatv b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+    inline maskv operator > (floatv a, floatv b) { return {_mm_cmpgt_ps(a.v, b.v)}; }
+    inline maskv operator <= (floatv a, floatv b) { return {_mm_cmple_ps(a.v, b.v)}; }
+    inline maskv operator == (floatv a, floatv b) { return {_mm_cmpeq_ps(a.v, b.v)}; }
+    inline maskv operator & (maskv a, maskv b) { return {_mm_and_ps(a.v, b.v)}; }
+    inline maskv operator | (maskv a, maskv b) { return {_mm_or_ps(a.v, b.v)}; }
+    inline maskv AndNot(maskv a, maskv b) { return {_mm_andnot_ps(b.v, a.v)}; } // a & ~b
+    inline floatv Select(maskv m, floatv a, floatv b) { return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)); }
+    inline floatv Min(floatv a, floatv b) { return _mm_min_ps(b.v, a.v); }
+    inline floatv Max(floatv a, floatv b) { return _mm_max_ps(b.v, a.v); }
+    inline uint32_t MoveMask(maskv m) { return static_cast<uint32_t>(_mm_movemask_ps(m.v)); }
+#else
+    struct maskv { bool v[4]; };
+    struct floatv
+    {
+        enum { Width = 4 };
+        float v[4];
+        floatv() {}
+        floatv(float f) { for(int i=0; i<4; ++i) v[i] = f; }
+        static floatv Load(const float * p) { floatv r; for(int i=0; i<4; ++i) r.v[i] = p[i]; return r; }
+        void Store(float * p) const { for(int i=0; i<4; ++i) p[i] = v[i]; }
+    };
+    template<class F> floatv Apply(floatv a, floatv b, F f) { floatv r; for(int i=0; i<4; ++i) r.v[i] = f(a.v[i], b.v[i]); return r; }
+    template<class F> maskv Compare(floatv a, floatv b, F f) { maskv r; for(int i=0; i<4; ++i) r.v[i] = f(a.v[i], b.v[i]); return r; }
+    inline floatv operator + (floatv a, floatv b) { return Apply(a, b, [](float x, float y) { return x + y; }); }
+    inline floatv operator - (floatv a, floatv b) { return Apply(a, b, [](float x, float y) { return x - y; }); }
+    inline floatv operator * (floatv a, floatv b) { return Apply(a, b, [](float x, float y) { return x * y; }); }
+    inline floatv operator / (floatv a, floatv b) { return Apply(a, b, [](float x, float y) { return x / y; }); }
+    inline maskv operator < (floatv a, floatv b) { return Compare(a, b, [](float x, float y) { return x < y; }); }
+    inline maskv operator > (floatv a, floatv b) { return Compare(a, b, [](float x, float y) { return x > y; }); }
+    inline maskv operator <= (floatv a, floatv b) { return Compare(a, b, [](float x, float y) { return x <= y; }); }
+    inline maskv operator == (floatv a, floatv b) { return Compare(a, b, [](float x, float y) { return x == y; }); }
+    inline maskv operator & (maskv a, maskv b) { maskv r; for(int i=0; i<4; ++i) r.v[i] = a.v[i] && b.v[i]; return r; }
+    inline maskv operator | (maskv a, maskv b) { maskv r; for(int i=0; i<4; ++i) r.v[i] = a.v[i] || b.v[i]; return r; }
+    inline maskv AndNot(maskv a, maskv b) { maskv r; for(int i=0; i<4; ++i) r.v[i] = a.v[i] && !b.v[i]; return r; } // a & ~b
+    inline floatv Select(maskv m, floatv a, floatv b) { floatv r; for(int i=0; i<4; ++i) r.v[i] = m.v[i] ? a.v[i] : b.v[i]; return r; }
+    inline floatv Min(floatv a, floatv b) { return Apply(a, b, [](float x, float y) { return y < x ? y : x; }); }
+    inline floatv Max(floatv a, floatv b) { return Apply(a, b, [](float x, float y) { return x < y ? y : x; }); }
+    inline uint32_t MoveMask(maskv m) { uint32_t r = 0; for(int i=0; i<4; ++i) r |= m.v[i] << i; return r; }
+#endif
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "transform.h"
+#include "simd.h"
 
 float4 RotationQuaternionAxisAngle(const float3 & axisOfRotation, float angleInRadians)
 {
@@ -26,6 +27,14 @@ float4x4 ScaledTransformationMatrix(const float3 & scale, const float4 & rot, co
     return {{qxdir(rot)*scale.x,0},{qydir(rot)*scale.y,0},{qzdir(rot)*scale.z,0},{vec,1}};
 }
 
+float4x4 ScaledNormalMatrix(const float3 & scale, const float4 & rot, const float3 & vec)
+{
+    // The rotation part is mag2(rot) times a pure rotation, so its inverse is its transpose divided by mag2(rot) squared
+    auto n = mag2(rot);
+    auto x = qxdir(rot) * (1 / (scale.x * (n*n))), y = qydir(rot) * (1 / (scale.y * (n*n))), z = qzdir(rot) * (1 / (scale.z * (n*n)));
+    return {{x,-dot(x,vec)},{y,-dot(y,vec)},{z,-dot(z,vec)},{0,0,0,1}};
+}
+
 float4x4 PerspectiveMatrixRhGl(float verticalFieldOfViewInRadians, float aspectRatioWidthOverHeight, float nearClipDistance, float farClipDistance)
 {
     const auto yf = 1/std::tan(verticalFieldOfViewInRadians/2), xf = yf/aspectRatioWidthOverHeight, dz = nearClipDistance-farClipDistance;
@@ -36,4 +45,61 @@ float4x4 LookAtMatrixRh(const float3 & eye, const float3 & center, const float3
 {
     auto f = norm(center - eye), s = norm(cross(f, up)), u = norm(cross(s, f));
     return mul(transpose(float4x4({s,0},{u,0},{-f,0},{0,0,0,1})), TranslationMatrix(-eye));
-}
\ No newline at end of file
+}
+
+void ComputeScaledTransformationMatrices(size_t count, const float3 * scale, const float4 * rot, const float3 * vec, float4x4 * transform, float4x4 * normal)
+{
+    using simd::floatv;
+    enum { W = floatv::Width };
+    size_t i = 0;
+    for(; i+W <= count; i += W)
+    {
+        // Transpose the next W transforms into lanes, evaluate the same expressions as the scalar functions, then transpose back
+        float in[10][W];
+        for(int j=0; j<W; ++j)
+        {
+            for(int k=0; k<3; ++k) { in[k][j] = scale[i+j][k]; in[7+k][j] = vec[i+j][k]; }
+            for(int k=0; k<4; ++k) in[3+k][j] = rot[i+j][k];
+        }
+        floatv s[3], q[4], t[3];
+        for(int k=0; k<3; ++k) { s[k] = floatv::Load(in[k]); t[k] = floatv::Load(in[7+k]); }
+        for(int k=0; k<4; ++k) q[k] = floatv::Load(in[3+k]);
+
+        const floatv two(2), one(1), n = q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3];
+        const floatv dir[3][3] = {
+            {q[3]*q[3] + q[0]*q[0] - q[1]*q[1] - q[2]*q[2], (q[0]*q[1] + q[2]*q[3])*two, (q[2]*q[0] - q[1]*q[3])*two},
+            {(q[0]*q[1] - q[2]*q[3])*two, q[3]*q[3] - q[0]*q[0] + q[1]*q[1] - q[2]*q[2], (q[1]*q[2] + q[0]*q[3])*two},
+            {(q[2]*q[0] + q[1]*q[3])*two, (q[1]*q[2] - q[0]*q[3])*two, q[3]*q[3] - q[0]*q[0] - q[1]*q[1] + q[2]*q[2]}};
+
+        float out[3][8][W]; // For each column, three rows of the transform, three rows of the normal matrix, and the negated last row
+        for(int c=0; c<3; ++c)
+        {
+            const floatv f = one / (s[c] * (n*n));
+            floatv m[3];
+            for(int r=0; r<3; ++r)
+            {
+                (dir[c][r] * s[c]).Store(out[c][r]);
+                m[r] = dir[c][r] * f;
+                m[r].Store(out[c][3+r]);
+            }
+            (m[0]*t[0] + m[1]*t[1] + m[2]*t[2]).Store(out[c][6]);
+        }
+        for(int j=0; j<W; ++j)
+        {
+            auto & a = transform[i+j];
+            auto & b = normal[i+j];
+            for(int c=0; c<3; ++c)
+            {
+                a[c] = {out[c][0][j], out[c][1][j], out[c][2][j], 0};
+                b[c] = {out[c][3][j], out[c][4][j], out[c][5][j], -out[c][6][j]};
+            }
+            a.w = {vec[i+j], 1};
+            b.w = {0,0,0,1};
+        }
+    }
+    for(; i<count; ++i)
+    {
+        transform[i] = ScaledTransformationMatrix(scale[i], rot[i], vec[i]);
+        normal[i] = ScaledNormalMatrix(scale[i], rot[i], vec[i]);
+    }
+}
@@ -3,6 +3,8 @@
 
 #include "linalg.h"
 
+#include <cstddef>
+
 inline float3 TransformDirection(const float4x4 & transformMatrix, const float3 & direction) { return mul(transformMatrix, float4(direction,0)).xyz(); } // Works for rigid transforms only
 inline float3 TransformCoordinate(const float4x4 & transformMatrix, const float3 & coordinate) { auto r = mul(transformMatrix, float4(coordinate,1)); return r.xyz() / r.w; }
 
@@ -12,9 +14,14 @@ float4 RotationQuaternionFromToVec(const float3 & fromVector, const float3 & toV
 float4x4 TranslationMatrix(const float3 & translationVec);
 float4x4 RigidTransformationMatrix(const float4 & rotationQuat, const float3 & translationVec);
 float4x4 ScaledTransformationMatrix(const float3 & scalingFactors, const float4 & rotationQuat, const float3 & translationVec);
+float4x4 ScaledNormalMatrix(const float3 & scalingFactors, const float4 & rotationQuat, const float3 & translationVec); // Equals inv(transpose(ScaledTransformationMatrix(...)))
 float4x4 PerspectiveMatrixRhGl(float verticalFieldOfViewInRadians, float aspectRatioWidthOverHeight, float nearClipDistance, float farClipDistance);
 float4x4 LookAtMatrixRh(const float3 & eye, const float3 & center, const float3 & up);
 
+// Computes ScaledTransformationMatrix and ScaledNormalMatrix for count transforms at once, reading each part of the transforms from its own
+// array. Processes several transforms per instruction, with results identical to calling the functions on each transform in turn.
+void ComputeScaledTransformationMatrices(size_t count, const float3 * scalingFactors, const float4 * rotationQuats, const float3 * translationVecs, float4x4 * transformMatrices, float4x4 * normalMatrices);
+
 struct Pose
 {
     float3      position;
@@ -0,0 +1,108 @@
+#include "test.h"
+#include "engine/file.h"
+
+#include <chrono>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+// Reads a whole file through stdio, as the loaders did before MappedFile
+static std::string ReadWholeFile(const std::string & path)
+{
+    std::string contents;
+    if(FILE * f = fopen(path.c_str(), "rb"))
+    {
+        fseek(f, 0, SEEK_END);
+        contents.resize(ftell(f));
+        fseek(f, 0, SEEK_SET);
+        contents.resize(fread(&contents[0], 1, contents.size(), f));
+        fclose(f);
+    }
+    return contents;
+}
+
+// Bytes of every value, including zeros and line endings, so that nothing is treated as text
+static std::string GenerateBytes(size_t size, uint32_t seed)
+{
+    std::mt19937 engine(seed);
+    std::string bytes(size, 0);
+    for(auto & c : bytes) c = static_cast<char>(engine());
+    return bytes;
+}
+
+TEST(MappedFileMatchesRead)
+{
+    // Sizes around the page size, and the size of the first buffer of the fallback
+    for(size_t size : {1, 7, 4095, 4096, 4097, 65539, 1 << 20})
+    {
+        TempFile file("mapped_file_test.bin", GenerateBytes(size, static_cast<uint32_t>(size)));
+        auto expected = ReadWholeFile(file.path);
+        MappedFile mapped(file.path);
+        CHECK(mapped.isMapped());
+        CHECK(mapped.size() == size && expected.size() == size);
+        CHECK(std::equal(mapped.begin(), mapped.end(), expected.begin()));
+    }
+}
+
+TEST(MappedFileEmpty)
+{
+    // Empty files cannot be mapped, so they are read instead, giving an empty range
+    TempFile file("mapped_file_empty.bin", "");
+    MappedFile mapped(file.path);
+    CHECK(!mapped.isMapped());
+    CHECK(mapped.size() == 0 && mapped.begin() == mapped.end());
+}
+
+TEST(MappedFileMissing)
+{
+    remove("mapped_file_missing.bin");
+    std::string message;
+    try { MappedFile mapped("mapped_file_missing.bin"); }
+    catch(const std::runtime_error & e) { message = e.what(); }
+    CHECK(message == "File not found: mapped_file_missing.bin");
+}
+
+TEST(GetFileInfoReportsSizeAndTime)
+{
+    remove("file_info_missing.bin");
+    uint64_t size = 0;
+    int64_t modifiedTime = 0;
+    CHECK(!GetFileInfo("file_info_missing.bin", size, modifiedTime));
+
+    TempFile file("file_info_test.bin", GenerateBytes(12345, 2));
+    CHECK(GetFileInfo(file.path, size, modifiedTime));
+    CHECK(size == 12345);
+
+    // Rewriting the file moves its time forward, once the clock has passed the resolution of the file system, which may be a second
+    auto firstTime = modifiedTime;
+    for(int i=0; i<300 && modifiedTime == firstTime; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::ofstream(file.path, std::ios::binary) << "rewritten";
+        CHECK(GetFileInfo(file.path, size, modifiedTime));
+    }
+    CHECK(size == 9 && modifiedTime > firstTime);
+}
+
+TEST(RenameFileReplacesTarget)
+{
+    TempFile from("rename_from.bin", "new contents"), to("rename_to.bin", "old");
+    CHECK(RenameFile(from.path, to.path));
+    uint64_t size;
+    int64_t modifiedTime;
+    CHECK(!GetFileInfo(from.path, size, modifiedTime));
+    CHECK(ReadWholeFile(to.path) == "new contents");
+    CHECK(!RenameFile(from.path, to.path)); // The source is gone, and the target is left as it was
+    CHECK(ReadWholeFile(to.path) == "new contents");
+}
+
+BENCHMARK(MappedFileRead)
+{
+    // As LoadTextFile reads a file, before and after it used MappedFile, with the file in the OS cache
+    TempFile file("mapped_file_bench.bin", GenerateBytes(14 << 20, 1));
+    ReadWholeFile(file.path);
+    size_t sink = 0;
+    auto read = MeasureMilliseconds(10, [&]() { sink += ReadWholeFile(file.path).size(); });
+    auto mapped = MeasureMilliseconds(10, [&]() { MappedFile mapped(file.path); sink += std::string(mapped.begin(), mapped.end()).size(); });
+    printf("  14 MB file: fread %6.2f ms, mapped %6.2f ms (%d)\n", read, mapped, static_cast<int>(sink % 10));
+}
@@ -0,0 +1,282 @@
+#include "test.h"
+#include "engine/load.h"
+
+#include <algorithm>
+#include <random>
+
+static bool Equal(const RayMeshHit & a, const RayMeshHit & b)
+{
+    if(a.hit != b.hit) return false;
+    return !a.hit || (a.t == b.t && a.u == b.u && a.v == b.v && a.triangle == b.triangle);
+}
+
+// Triangles scattered through a unit cube, including duplicates, which tie on every ray that hits them, and degenerate triangles
+static Mesh GenerateSoup(size_t count, uint32_t seed)
+{
+    std::mt19937 engine(seed);
+    std::uniform_real_distribution<float> coord(-1, 1), offset(-0.1f, 0.1f);
+    Mesh mesh;
+    for(size_t i=0; i<count; ++i)
+    {
+        auto base = static_cast<uint32_t>(mesh.vertices.size());
+        float3 center(coord(engine), coord(engine), coord(engine));
+        for(int j=0; j<3; ++j) mesh.vertices.push_back({center + float3(offset(engine), offset(engine), offset(engine))});
+        if(i % 50 == 7) mesh.vertices.back().position = mesh.vertices[base].position;
+        mesh.triangles.push_back({base, base+1, base+2});
+        if(i % 20 == 3) mesh.triangles.push_back({base, base+1, base+2});
+    }
+    mesh.Upload();
+    return mesh;
+}
+
+// Box around the vertices of a mesh, or the cube from -1 to 1 if it has none
+struct Box { float3 min, max; };
+static Box GetBox(const Mesh & mesh)
+{
+    if(mesh.vertices.empty()) return {float3(-1,-1,-1), float3(1,1,1)};
+    Box box = {mesh.vertices[0].position, mesh.vertices[0].position};
+    for(auto & vertex : mesh.vertices) for(int i=0; i<3; ++i)
+    {
+        box.min[i] = std::min(box.min[i], vertex.position[i]);
+        box.max[i] = std::max(box.max[i], vertex.position[i]);
+    }
+    return box;
+}
+
+// Rays from around the box toward points within it, from points within it, and along the axes
+static std::vector<Ray> GenerateRays(const Box & box, size_t count, uint32_t seed)
+{
+    std::mt19937 engine(seed);
+    std::uniform_real_distribution<float> unit(0, 1);
+    auto center = (box.min + box.max) * 0.5f, extent = box.max - box.min;
+    auto inside = [&]() { return box.min + extent * float3(unit(engine), unit(engine), unit(engine)); };
+    std::vector<Ray> rays;
+    for(size_t i=0; i<count; ++i)
+    {
+        switch(i % 3)
+        {
+        case 0: rays.push_back(Ray::Between(center + norm(float3(unit(engine)-0.5f, unit(engine)-0.5f, unit(engine)-0.5f)) * (mag(extent) * 2), inside())); break;
+        case 1: rays.push_back(Ray::Between(inside(), inside())); break;
+        case 2: { float3 dir; dir[i/3%3] = i/9%2 ? 1.0f : -1.0f; rays.push_back({inside(), dir}); break; }
+        }
+    }
+    return rays;
+}
+
+TEST(BvhHitMatchesBruteForce)
+{
+    auto teapot = LoadMeshFromObj("../assets/teapot.obj", false);
+    teapot.Upload();
+    Mesh meshes[] = {std::move(teapot), GenerateSoup(5000, 1), GenerateSoup(1, 2), GenerateSoup(0, 3)};
+    for(auto & mesh : meshes)
+    {
+        for(auto & ray : GenerateRays(GetBox(mesh), 20000, 4))
+        {
+            auto expected = IntersectRayMesh(ray, mesh.vertices.data(), &Vertex::position, mesh.triangles.data(), mesh.triangles.size());
+            CHECK(Equal(mesh.Hit(ray), expected));
+        }
+    }
+}
+
+BENCHMARK(BvhHit)
+{
+    printf("  mesh                  triangles   build      brute force    bvh\n");
+    auto measure = [](const char * name, const Mesh & mesh, int bruteRays)
+    {
+        auto rays = GenerateRays(GetBox(mesh), 100000, 5);
+        auto build = MeasureMilliseconds(3, [&]() { TriangleBvh(mesh.vertices.data(), &Vertex::position, mesh.triangles.data(), mesh.triangles.size()); });
+        auto brute = MeasureMilliseconds(1, [&]() { for(int i=0; i<bruteRays; ++i) IntersectRayMesh(rays[i], mesh.vertices.data(), &Vertex::position, mesh.triangles.data(), mesh.triangles.size()); });
+        mesh.Hit(rays[0]); // Builds the tree
+        auto time = MeasureMilliseconds(3, [&]() { for(auto & ray : rays) mesh.Hit(ray); });
+        printf("  %-20s %10llu %8.1f ms %9.3f us/ray %7.3f us/ray\n", name, static_cast<unsigned long long>(mesh.triangles.size()), build,
+            brute * 1000 / bruteRays, time * 1000 / rays.size());
+    };
+    auto teapot = LoadMeshFromObj("../assets/teapot.obj", false);
+    teapot.Upload();
+    measure("teapot.obj", teapot, 10000);
+    measure("soup of 1M triangles", GenerateSoup(1000000, 6), 100);
+}
+
+static bool Equal(const RayTriHit & a, const RayTriHit & b)
+{
+    return a.hit == b.hit && (!a.hit || (a.t == b.t && a.u == b.u && a.v == b.v));
+}
+
+TEST(IntersectLanesMatchScalar)
+{
+    // Triangles and rays drawn so that hits, misses and near-parallel rays are all common
+    enum { Width = TriangleBlock::Width };
+    std::mt19937 engine(7);
+    std::uniform_real_distribution<float> coord(-1, 1);
+    auto point = [&]() { return float3(coord(engine), coord(engine), coord(engine)); };
+    for(int n=0; n<20000; ++n)
+    {
+        float3 corners[Width][3];
+        Ray rays[Width];
+        TriangleBlock block;
+        for(int j=0; j<Width; ++j)
+        {
+            for(auto & corner : corners[j]) corner = point();
+            if(n % 10 == 0) corners[j][2] = corners[j][0] + (corners[j][1] - corners[j][0]) * 0.5f;
+            block.Set(j, corners[j][0], corners[j][1], corners[j][2]);
+            rays[j] = n % 7 == 0 ? Ray{point(), norm(corners[j][1] - corners[j][0])} : Ray::Between(point() * 3.0f, point() * 0.5f);
+        }
+
+        RayTriHit hits[Width];
+        auto mask = IntersectRayTriangles(rays[0], block, hits);
+        for(int j=0; j<Width; ++j)
+        {
+            auto expected = IntersectRayTriangle(rays[0], corners[j][0], corners[j][1], corners[j][2]);
+            CHECK(((mask >> j & 1) != 0) == expected.hit);
+            if(mask >> j & 1) CHECK(Equal(hits[j], expected));
+        }
+
+        const RayPacket packet(rays, n % Width + 1);
+        mask = IntersectRaysTriangle(packet, corners[0][0], corners[0][1], corners[0][2], hits);
+        for(int j=0; j<Width; ++j)
+        {
+            auto expected = IntersectRayTriangle(rays[std::min(j, n % Width)], corners[0][0], corners[0][1], corners[0][2]);
+            CHECK(((mask >> j & 1) != 0) == expected.hit);
+            if(mask >> j & 1) CHECK(Equal(hits[j], expected));
+        }
+    }
+}
+
+// Rays from a pinhole camera through a grid of pixels, which are coherent, as a packet traverses best
+static std::vector<Ray> GenerateCameraRays(const Box & box, int size)
+{
+    auto center = (box.min + box.max) * 0.5f, extent = box.max - box.min;
+    auto eye = center + float3(0.3f, 0.4f, 1) * mag(extent);
+    std::vector<Ray> rays;
+    for(int y=0; y<size; ++y) for(int x=0; x<size; ++x) rays.push_back(Ray::Between(eye, center + extent * float3(x / (size - 1.0f) - 0.5f, y / (size - 1.0f) - 0.5f, 0)));
+    return rays;
+}
+
+TEST(BvhPacketHitMatchesSingleRays)
+{
+    auto teapot = LoadMeshFromObj("../assets/teapot.obj", false);
+    teapot.Upload();
+    Mesh meshes[] = {std::move(teapot), GenerateSoup(5000, 8), GenerateSoup(0, 9)};
+    for(auto & mesh : meshes)
+    {
+        auto box = GetBox(mesh);
+        auto bvh = mesh.GetBvh();
+        std::vector<Ray> batches[] = {GenerateCameraRays(box, 101), GenerateRays(box, 10001, 10)};
+        for(auto & rays : batches)
+        {
+            std::vector<RayMeshHit> hits(rays.size());
+            bvh->Hit(rays.data(), rays.size(), hits.data());
+            for(size_t i=0; i<rays.size(); ++i) CHECK(Equal(hits[i], bvh->Hit(rays[i])));
+        }
+    }
+}
+
+BENCHMARK(BvhPacketHit)
+{
+    auto teapot = LoadMeshFromObj("../assets/teapot.obj", false);
+    teapot.Upload();
+    auto bvh = teapot.GetBvh();
+    printf("  teapot.obj, %d lanes    single rays      packets\n", static_cast<int>(RayPacket::Width));
+    auto measure = [&](const char * name, const std::vector<Ray> & rays)
+    {
+        std::vector<RayMeshHit> hits(rays.size());
+        auto single = MeasureMilliseconds(3, [&]() { for(size_t i=0; i<rays.size(); ++i) hits[i] = bvh->Hit(rays[i]); });
+        auto packets = MeasureMilliseconds(3, [&]() { bvh->Hit(rays.data(), rays.size(), hits.data()); });
+        printf("  %-20s %8.2f Mrays/s %8.2f Mrays/s\n", name, rays.size() / single / 1000, rays.size() / packets / 1000);
+    };
+    measure("camera rays", GenerateCameraRays(GetBox(teapot), 512));
+    measure("random rays", GenerateRays(GetBox(teapot), 262144, 11));
+}
+
+// View and projection of a camera at a random point in the cube from -10 to 10, looking toward another
+static float4x4 RandomViewProj(std::mt19937 & engine)
+{
+    std::uniform_real_distribution<float> coord(-10, 10);
+    float3 eye(coord(engine), coord(engine), coord(engine)), center(coord(engine), coord(engine), coord(engine));
+    return mul(PerspectiveMatrixRhGl(1, 1.5f, 0.1f, 50), LookAtMatrixRh(eye, center, float3(0,1,0)));
+}
+
+// Boxes of many sizes around and beyond the cameras of RandomViewProj
+static BoxArrays GenerateBoxes(size_t count, uint32_t seed)
+{
+    std::mt19937 engine(seed);
+    std::uniform_real_distribution<float> coord(-40, 40), size(0.01f, 3);
+    BoxArrays boxes;
+    boxes.Resize(count);
+    for(size_t i=0; i<count; ++i) boxes.Set(i, float3(coord(engine), coord(engine), coord(engine)), float3(size(engine), size(engine), size(engine)));
+    return boxes;
+}
+
+static Bounds GetBounds(const BoxArrays & boxes, size_t i)
+{
+    float3 center(boxes.center[0][i], boxes.center[1][i], boxes.center[2][i]), extent(boxes.extent[0][i], boxes.extent[1][i], boxes.extent[2][i]);
+    return Bounds(center - extent, center + extent);
+}
+
+TEST(FrustumFromMatrixMatchesClipVolume)
+{
+    // Points are spread through and around the clip volume by unprojecting, then classified by their clip coordinates. Points within
+    // rounding of a face of the volume could land on either side, and are skipped.
+    std::mt19937 engine(3);
+    std::uniform_real_distribution<float> ndc(-1.2f, 1.2f);
+    size_t inside = 0, outside = 0;
+    for(int camera=0; camera<10; ++camera)
+    {
+        auto viewProj = RandomViewProj(engine);
+        auto frustum = Frustum::FromMatrix(viewProj);
+        CHECK(frustum.planes.size() == 6);
+        auto invViewProj = inv(viewProj);
+        for(int i=0; i<20000; ++i)
+        {
+            auto p = mul(invViewProj, float4(ndc(engine), ndc(engine), ndc(engine), 1));
+            auto point = p.xyz() / p.w;
+            auto clip = mul(viewProj, float4(point, 1));
+            float margin = INFINITY;
+            for(int j=0; j<3; ++j) margin = std::min(margin, clip.w - std::abs(clip[j]));
+            if(std::abs(margin) < clip.w * 1e-3f) continue;
+            CHECK(frustum.Contains(point) == (margin > 0));
+            ++(margin > 0 ? inside : outside);
+        }
+    }
+    CHECK(inside > 50000 && outside > 50000);
+}
+
+TEST(CullBoxesMatchesGetOverlap)
+{
+    // A count which is not a multiple of the width, culled whole and in blocks as Scene does, leaving a partial block at the end
+    const size_t count = 100003;
+    auto boxes = GenerateBoxes(count, 4);
+    std::mt19937 engine(5);
+    for(int camera=0; camera<4; ++camera)
+    {
+        auto frustum = Frustum::FromMatrix(RandomViewProj(engine));
+        std::vector<uint8_t> whole(count, 2), blocks(count, 2);
+        auto culled = CullBoxes(frustum, boxes, 0, count, whole.data());
+        size_t blockCulled = 0;
+        for(size_t first=0; first<count; first+=256) blockCulled += CullBoxes(frustum, boxes, first, std::min<size_t>(first+256, count), blocks.data());
+        CHECK(blocks == whole);
+        CHECK(blockCulled == culled);
+        CHECK(culled == static_cast<size_t>(std::count(begin(whole), end(whole), 0)));
+        CHECK(culled > 0 && culled < count);
+        for(size_t i=0; i<count; ++i) CHECK(whole[i] == (GetOverlap(frustum, GetBounds(boxes, i)) != Overlap::Outside));
+    }
+
+    // A frustum without planes culls nothing
+    std::vector<uint8_t> visible(count);
+    CHECK(CullBoxes(Frustum(), boxes, 0, count, visible.data()) == 0);
+    CHECK(std::count(begin(visible), end(visible), 1) == static_cast<ptrdiff_t>(count));
+}
+
+BENCHMARK(CullBoxes)
+{
+    const size_t count = 100000;
+    auto boxes = GenerateBoxes(count, 4);
+    std::vector<Bounds> bounds;
+    for(size_t i=0; i<count; ++i) bounds.push_back(GetBounds(boxes, i));
+    std::mt19937 engine(5);
+    auto frustum = Frustum::FromMatrix(RandomViewProj(engine));
+    std::vector<uint8_t> visible(count);
+    auto overlap = MeasureMilliseconds(20, [&]() { for(size_t i=0; i<count; ++i) visible[i] = GetOverlap(frustum, bounds[i]) != Overlap::Outside; });
+    auto lanes = MeasureMilliseconds(20, [&]() { CullBoxes(frustum, boxes, 0, count, visible.data()); });
+    printf("  100k boxes, %d lanes: GetOverlap %6.2f ms, CullBoxes %6.2f ms\n", static_cast<int>(BoxArrays::Width), overlap, lanes);
+}
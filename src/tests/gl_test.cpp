@@ -0,0 +1,269 @@
+#include "test.h"
+#include "engine/gl.h"
+
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+// A gl::Api which records its calls instead of making them, reporting the alignment set in recordedAlignment. Api holds plain function
+// pointers, so the record is global, and each test clears it first.
+struct GlCall { std::string name; GLenum target; GLuint buffer, index; GLintptr offset; GLsizeiptr size; std::vector<uint8_t> data; };
+static std::vector<GlCall> recordedCalls;
+static GLint recordedAlignment;
+static GLuint lastBuffer;
+
+static void Record(const char * name, GLenum target, GLuint buffer, GLuint index, GLintptr offset, GLsizeiptr size, const GLvoid * data)
+{
+    GlCall call = {name, target, buffer, index, offset, size, {}};
+    if(data) call.data.assign(static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + size);
+    recordedCalls.push_back(call);
+}
+
+static const gl::Api recordingApi = {
+    [](GLsizei n, GLuint * buffers) { for(GLsizei i=0; i<n; ++i) buffers[i] = ++lastBuffer; Record("GenBuffers", 0, lastBuffer, 0, 0, 0, nullptr); },
+    [](GLsizei n, const GLuint * buffers) { for(GLsizei i=0; i<n; ++i) Record("DeleteBuffers", 0, buffers[i], 0, 0, 0, nullptr); },
+    [](GLenum target, GLuint buffer) { Record("BindBuffer", target, buffer, 0, 0, 0, nullptr); },
+    [](GLenum target, GLsizeiptr size, const GLvoid * data, GLenum) { Record("BufferData", target, 0, 0, 0, size, data); },
+    [](GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid * data) { Record("BufferSubData", target, 0, 0, offset, size, data); },
+    [](GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) { Record("BindBufferRange", target, buffer, index, offset, size, nullptr); },
+    [](GLenum name, GLint * params) { *params = name == GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT ? recordedAlignment : 0; Record("GetIntegerv", name, 0, 0, 0, 0, nullptr); }
+};
+
+static void ResetRecording(GLint alignment) { recordedCalls.clear(); recordedAlignment = alignment; }
+static size_t CountCalls(const char * name) { size_t count = 0; for(auto & call : recordedCalls) if(call.name == name) ++count; return count; }
+static const GlCall * FindLastCall(const char * name) { for(auto it = recordedCalls.rbegin(); it != recordedCalls.rend(); ++it) if(it->name == name) return &*it; return nullptr; }
+
+TEST(UniformRingAlignsRanges)
+{
+    // A reported alignment of 0 falls back to 256, the largest the specification permits
+    for(GLint alignment : {1, 16, 64, 256, 0})
+    {
+        ResetRecording(alignment);
+        gl::UniformRing ring(recordingApi);
+        GLint expected = alignment ? alignment : 256;
+        GLintptr end = 0;
+        for(GLsizeiptr size : {4, 100, 300, 1, 64, 256, 7})
+        {
+            auto range = ring.Allocate(size);
+            CHECK(range.offset % expected == 0);
+            CHECK(range.offset >= end && range.offset < end + expected);
+            CHECK(range.size == size);
+            auto data = ring.GetData(range);
+            for(GLsizeiptr i=0; i<size; ++i) CHECK(data[i] == 0);
+            memset(data, 0xAB, size);
+            end = range.offset + size;
+        }
+        CHECK(CountCalls("GetIntegerv") == 1); // Queried once, on the first allocation
+        ring.Upload();
+    }
+}
+
+TEST(UniformRingUploadsOncePerFrame)
+{
+    ResetRecording(64);
+    gl::UniformRing ring(recordingApi);
+    ring.Upload(); // Nothing allocated, so nothing to send
+    CHECK(recordedCalls.empty());
+
+    gl::UniformRange ranges[10];
+    for(int i=0; i<10; ++i)
+    {
+        ranges[i] = ring.Allocate(16 + i * 8);
+        memset(ring.GetData(ranges[i]), i + 1, ranges[i].size);
+    }
+    ring.Upload();
+    CHECK(CountCalls("BufferSubData") == 1);
+    auto upload = FindLastCall("BufferSubData");
+    CHECK(upload && upload->target == GL_UNIFORM_BUFFER && upload->offset == 0 && upload->size == ranges[9].offset + ranges[9].size);
+    for(int i=0; i<10 && upload; ++i) for(GLsizeiptr j=0; j<ranges[i].size; ++j) CHECK(upload->data[ranges[i].offset + j] == i + 1);
+
+    // Binding a range points at the bytes it was given
+    ring.Bind(ranges[3], 5);
+    auto bind = FindLastCall("BindBufferRange");
+    CHECK(bind && bind->target == GL_UNIFORM_BUFFER && bind->index == 5 && bind->buffer == FindLastCall("GenBuffers")->buffer);
+    CHECK(bind && bind->offset == ranges[3].offset && bind->size == ranges[3].size);
+
+    for(int frame=0; frame<5; ++frame)
+    {
+        recordedCalls.clear();
+        for(int i=0; i<10; ++i) ring.Allocate(16 + i * 8);
+        ring.Upload();
+        CHECK(CountCalls("BufferSubData") == 1);
+        CHECK(CountCalls("BufferData") == 0 && CountCalls("GenBuffers") == 0);
+    }
+}
+
+TEST(UniformRingRotatesSegments)
+{
+    ResetRecording(256);
+    gl::UniformRing ring(recordingApi, 3);
+    GLintptr segmentSize = 0;
+    for(int frame=0; frame<7; ++frame)
+    {
+        auto range = ring.Allocate(1000);
+        ring.Upload();
+        if(frame == 0) segmentSize = FindLastCall("BufferData")->size / 3;
+        auto upload = FindLastCall("BufferSubData");
+        CHECK(upload && upload->offset == frame % 3 * segmentSize);
+        ring.Bind(range, 0);
+        CHECK(FindLastCall("BindBufferRange")->offset == frame % 3 * segmentSize + range.offset);
+    }
+    CHECK(segmentSize == 1024);
+    CHECK(CountCalls("BufferData") == 1);
+}
+
+TEST(UniformRingGrowsOnOverflow)
+{
+    ResetRecording(256);
+    {
+        gl::UniformRing ring(recordingApi, 3);
+        ring.Allocate(1000);
+        ring.Upload();
+        ring.Allocate(1000);
+        ring.Upload(); // Fills the second segment
+
+        // A frame larger than a segment replaces the buffer with one of at least twice the size, and starts again from the first segment
+        recordedCalls.clear();
+        for(int i=0; i<5; ++i) ring.Allocate(1000);
+        ring.Upload();
+        auto grow = FindLastCall("BufferData");
+        CHECK(grow && grow->target == GL_UNIFORM_BUFFER && grow->size == 3 * 5120 && grow->data.empty()); // 5096 bytes, rounded to the alignment
+        auto upload = FindLastCall("BufferSubData");
+        CHECK(upload && upload->offset == 0 && upload->size == 4 * 1024 + 1000);
+        CHECK(CountCalls("GenBuffers") == 0); // The buffer object is kept
+
+        // A frame just over the new segment size doubles it
+        recordedCalls.clear();
+        for(int i=0; i<6; ++i) ring.Allocate(1000);
+        ring.Upload();
+        CHECK(FindLastCall("BufferData") && FindLastCall("BufferData")->size == 3 * 2 * 5120);
+        CHECK(FindLastCall("BufferSubData")->offset == 0);
+
+        ring.Allocate(1000);
+        ring.Upload();
+        CHECK(FindLastCall("BufferSubData")->offset == 10240);
+        recordedCalls.clear();
+    }
+    CHECK(CountCalls("DeleteBuffers") == 1);
+}
+
+// A block as the GL reflects it for std140 layout, with a packed mat4, a vec3, an array and a float
+static gl::BlockDesc MakeBlockDesc()
+{
+    gl::BlockDesc block;
+    block.name = "PerObject";
+    block.binding = 2;
+    block.dataSize = 208;
+    gl::UniformDesc uniforms[] = {
+        {"u_model", 0, 1, 0, 16, GL_FLOAT_MAT4},
+        {"u_diffuse", 64, 1, 0, 0, GL_FLOAT_VEC3},
+        {"u_colors[0]", 80, 4, 16, 0, GL_FLOAT_VEC3},
+        {"u_strided", 144, 1, 0, 32, GL_FLOAT_MAT4}, // Padded columns, as under a layout other than std140
+        {"u_scale", 76, 1, 0, 0, GL_FLOAT}
+    };
+    block.uniforms.assign(std::begin(uniforms), std::end(uniforms));
+    return block;
+}
+
+template<class T> static bool ResolveThrows(const gl::BlockDesc & block, const std::string & name)
+{
+    try { gl::Uniform<T> uniform(block, name); }
+    catch(const std::runtime_error &) { return true; }
+    return false;
+}
+
+TEST(UniformResolvesMatchingTypes)
+{
+    auto block = MakeBlockDesc();
+    std::vector<uint8_t> data(block.dataSize, 0xCD), expected = data;
+    const float4x4 model = {{1,2,3,4}, {5,6,7,8}, {9,10,11,12}, {13,14,15,16}};
+    const float3 diffuse(0.25f, 0.5f, 0.75f);
+    const float scale = 3;
+
+    gl::Uniform<float4x4> modelUniform(block, "u_model");
+    gl::Uniform<float3> diffuseUniform(block, "u_diffuse");
+    gl::Uniform<float> scaleUniform(block, "u_scale");
+    CHECK(modelUniform.IsValid() && diffuseUniform.IsValid() && scaleUniform.IsValid());
+    modelUniform.Set(data.data(), model);
+    diffuseUniform.Set(data.data(), diffuse);
+    scaleUniform.Set(data.data(), scale);
+
+    // Each write is a store of the value at the reflected offset, and touches nothing else
+    memcpy(&expected[0], &model, sizeof(model));
+    memcpy(&expected[64], &diffuse, sizeof(diffuse));
+    memcpy(&expected[76], &scale, sizeof(scale));
+    CHECK(data == expected);
+}
+
+TEST(UniformRejectsOtherLayouts)
+{
+    auto block = MakeBlockDesc();
+    CHECK(ResolveThrows<float3>(block, "u_model"));             // Other types
+    CHECK(ResolveThrows<float4>(block, "u_diffuse"));
+    CHECK(ResolveThrows<float4x4>(block, "u_diffuse"));
+    CHECK(ResolveThrows<float>(block, "u_diffuse"));
+    CHECK(ResolveThrows<float3>(block, "u_colors[0]"));         // Arrays
+    CHECK(ResolveThrows<float4x4>(block, "u_strided"));         // Matrices whose columns are not packed
+    CHECK(!ResolveThrows<float4x4>(block, "u_model"));
+
+    std::string message;
+    try { gl::Uniform<float3> uniform(block, "u_model"); }
+    catch(const std::runtime_error & e) { message = e.what(); }
+    CHECK(message == "uniform u_model of block PerObject does not have the expected type");
+}
+
+TEST(UniformMissingNameIgnoresWrites)
+{
+    auto block = MakeBlockDesc();
+    std::vector<uint8_t> data(block.dataSize, 0xCD), expected = data;
+
+    // Names the block lacks resolve without throwing, whatever the type, as do default constructed handles
+    CHECK(!ResolveThrows<float4x4>(block, "u_missing"));
+    gl::Uniform<float4x4> missing(block, "u_missing"), unresolved;
+    gl::Uniform<float3> missingVector(block, "u_model_");
+    CHECK(!missing.IsValid() && !unresolved.IsValid() && !missingVector.IsValid());
+    missing.Set(data.data(), float4x4());
+    unresolved.Set(data.data(), float4x4());
+    missingVector.Set(data.data(), float3(1,2,3));
+    CHECK(data == expected);
+}
+
+BENCHMARK(UniformWrites)
+{
+    // The four PerObject uniforms of 100k objects, written by name as before and through handles resolved once
+    gl::BlockDesc block;
+    block.name = "PerObject";
+    block.dataSize = 160;
+    gl::UniformDesc uniforms[] = {{"u_model", 0, 1, 0, 16, GL_FLOAT_MAT4}, {"u_modelIT", 64, 1, 0, 16, GL_FLOAT_MAT4}, {"u_diffuse", 128, 1, 0, 0, GL_FLOAT_VEC3}, {"u_emissive", 144, 1, 0, 0, GL_FLOAT_VEC3}};
+    block.uniforms.assign(std::begin(uniforms), std::end(uniforms));
+    enum { Count = 100000 };
+    std::vector<uint8_t> data(Count * block.dataSize);
+    const float4x4 model = {{1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {1,2,3,1}};
+    const float3 color(1, 0.5f, 0.25f);
+
+    auto byName = MeasureMilliseconds(5, [&]()
+    {
+        for(size_t i=0; i<Count; ++i)
+        {
+            auto object = &data[i * block.dataSize];
+            block.SetUniform(object, "u_model", model);
+            block.SetUniform(object, "u_modelIT", model);
+            block.SetUniform(object, "u_diffuse", color);
+            block.SetUniform(object, "u_emissive", color);
+        }
+    });
+    auto handles = MeasureMilliseconds(5, [&]()
+    {
+        gl::Uniform<float4x4> modelUniform(block, "u_model"), normalUniform(block, "u_modelIT");
+        gl::Uniform<float3> diffuseUniform(block, "u_diffuse"), emissiveUniform(block, "u_emissive");
+        for(size_t i=0; i<Count; ++i)
+        {
+            auto object = &data[i * block.dataSize];
+            modelUniform.Set(object, model);
+            normalUniform.Set(object, model);
+            diffuseUniform.Set(object, color);
+            emissiveUniform.Set(object, color);
+        }
+    });
+    printf("  100000 objects: by name %.2f ms, handles %.2f ms (%d)\n", byName, handles, data[data.size() - 1]);
+}
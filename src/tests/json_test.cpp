@@ -0,0 +1,489 @@
+#include "test.h"
+#include "legacy_json.h"
+#include "engine/json.h"
+#include "engine/simd.h"
+
+#include <cctype>
+#include <cfloat>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+
+// Compares a document parsed by the engine with the same document parsed by the legacy DOM
+static bool Equal(const JsonValue & a, const legacy::JsonValue & b)
+{
+    if(a.isNull() || a.isTrue() || a.isFalse()) return a.isNull() == b.isNull() && a.isTrue() == b.isTrue() && a.isFalse() == b.isFalse();
+    if(a.isString()) return b.isString() && a.string() == b.string();
+    if(a.isNumber()) return b.isNumber() && a.contents() == b.contents();
+    if(a.isArray())
+    {
+        if(!b.isArray() || a.array().size() != b.array().size()) return false;
+        for(size_t i=0; i<a.array().size(); ++i) if(!Equal(a.array()[i], b.array()[i])) return false;
+        return true;
+    }
+    if(!b.isObject() || a.object().size() != b.object().size()) return false;
+    for(size_t i=0; i<a.object().size(); ++i)
+    {
+        auto & f = a.object()[i]; auto & g = b.object()[i];
+        if(std::string(f.first.data(), f.first.size()) != g.first || !Equal(f.second, g.second)) return false;
+    }
+    return true;
+}
+
+// Returns the text of the error thrown while parsing text, or "ok" if it parsed, and stores the result in out
+template<class V, class P> static std::string Parse(const std::string & text, P parse, V & out)
+{
+    try { out = parse(text); return "ok"; }
+    catch(const std::runtime_error & e) { return e.what(); }
+}
+
+// Generates a tabbed scene document of the form Editor saves, with the given number of objects. Values are deterministic for a given count.
+static std::string GenerateScene(int objects)
+{
+    std::string text = "{\n    \"objects\": [";
+    uint32_t seed = 12345;
+    auto next = [&seed]() { seed = seed * 1664525 + 1013904223; return (seed >> 8) * (1.0f / 16777216); };
+    char buffer[1024];
+    for(int i=0; i<objects; ++i)
+    {
+        sprintf(buffer, "%s\n        {\n            \"name\": \"Object %d\",\n            \"pose\": [\n                [%g,%g,%g],\n                [%g,%g,%g,%g]\n            ],\n"
+            "            \"scale\": [%g,%g,%g],\n            \"diffuse\": [%g,%g,%g],\n            \"mesh\": \"%s\",\n            \"prog\": \"simple\"%s\n        }",
+            i ? "," : "", i, next()*100-50, next()*100-50, next()*10, next()-0.5f, next()-0.5f, next()-0.5f, next(), next()+0.1f, next()+0.1f, next()+0.1f,
+            next(), next(), next(), i % 3 ? "cube" : "teapot", i % 50 ? "" : ",\n            \"light\": {\n                \"color\": [1,1,1]\n            }");
+        text += buffer;
+    }
+    return text + "\n    ]\n}";
+}
+
+TEST(JsonParseMatchesLegacy)
+{
+    const char * documents[] = {
+        "null", "true", "false", "0", "-0", "12", "-3.25e+17", "1E-3", "\"\"", "\"text\"", "\"esc\\\"ape\\\\s\\/\\b\\f\\n\\r\\t\"", "\"\\u0041\\u00e9\\u20AC\"",
+        "[]", "{}", "[1,2,[3,[]],{}]", "{\"a\":1,\"b\":[true,false,null],\"c\":{\"d\":\"e\"}}", " \t\r\n[ 1 , 2 ] \n", "{\"dup\":1,\"dup\":2}",
+        "", "[", "]", "[1,]", "[1 2]", "{\"a\"}", "{\"a\":}", "{1:2}", "{\"a\":1,}", "01", "1.", ".5", "-", "1e", "+1", "0x10", "\"open", "\"bad\\q\"",
+        "\"\\u12G4\"", "\"\\u12\"", "\"tab\there\"", "nulls", "truefalse", "@", "[1]]", "1 2", "[\"a\" \"b\"]",
+    };
+    for(auto doc : documents)
+    {
+        JsonValue a; legacy::JsonValue b;
+        auto errorA = Parse(doc, [](const std::string & s) { return jsonFrom(s); }, a);
+        auto errorB = Parse(doc, [](const std::string & s) { return legacy::jsonFrom(s); }, b);
+        CHECK(errorA == errorB);
+        if(errorA == "ok") CHECK(Equal(a, b));
+    }
+
+    // Literals must match exactly, where the token parser accepted a prefix of them
+    JsonValue a;
+    CHECK(Parse("nul", [](const std::string & s) { return jsonFrom(s); }, a) == "json parse error - Invalid token: nul");
+    CHECK(Parse("tru", [](const std::string & s) { return jsonFrom(s); }, a) == "json parse error - Invalid token: tru");
+    CHECK(Parse("[fals]", [](const std::string & s) { return jsonFrom(s); }, a) == "json parse error - Invalid token: fals");
+
+    auto scene = GenerateScene(1000);
+    legacy::JsonValue b;
+    CHECK(Parse(scene, [](const std::string & s) { return jsonFrom(s); }, a) == "ok");
+    CHECK(Parse(scene, [](const std::string & s) { return legacy::jsonFrom(s); }, b) == "ok");
+    CHECK(Equal(a, b));
+}
+
+BENCHMARK(JsonParseScene)
+{
+    auto scene = GenerateScene(100000);
+    printf("  %.1f MB scene, best of 3\n", scene.size() / 1e6);
+
+    auto start = GetHeapCounters();
+    ResetPeakHeapBytes();
+    auto legacyTime = MeasureMilliseconds(3, [&]() { legacy::jsonFrom(scene); });
+    auto legacyPeak = GetHeapCounters().peakBytes - start.bytes;
+
+    ResetPeakHeapBytes();
+    auto time = MeasureMilliseconds(3, [&]() { jsonFrom(scene); });
+    auto peak = GetHeapCounters().peakBytes - start.bytes;
+
+    printf("  token vector: %8.1f ms, peak heap %6.1f MB\n", legacyTime, legacyPeak / 1e6);
+    printf("  single pass:  %8.1f ms, peak heap %6.1f MB\n", time, peak / 1e6);
+}
+
+TEST(JsonNumberValidationMatchesRegex)
+{
+    // Every string of up to four characters from the number alphabet, then random longer ones
+    const char alphabet[] = "0123456789-+.eE";
+    std::string text;
+    for(int length=1; length<=4; ++length)
+    {
+        int count = 1;
+        for(int i=0; i<length; ++i) count *= 15;
+        for(int n=0; n<count; ++n)
+        {
+            text.clear();
+            for(int i=0, m=n; i<length; ++i, m/=15) text += alphabet[m % 15];
+            CHECK(isJsonNumber(text) == legacy::isJsonNumber(text));
+        }
+    }
+    std::mt19937 engine;
+    for(int n=0; n<100000; ++n)
+    {
+        text.clear();
+        for(int i=0, length=5+engine()%16; i<length; ++i) text += alphabet[engine() % (engine() % 4 ? 10 : 15)];
+        CHECK(isJsonNumber(text) == legacy::isJsonNumber(text));
+    }
+}
+
+TEST(JsonNumberConversionMatchesStrtod)
+{
+    // Random values printed at 1 to 17 significant digits, within the normal range of float, must convert exactly as strtod and strtof do
+    std::mt19937 engine;
+    std::uniform_real_distribution<double> mantissa(1, 10);
+    std::uniform_int_distribution<int> exponent(-37, 37);
+    char text[64];
+    for(int n=0; n<300000; ++n)
+    {
+        auto len = sprintf(text, "%.*e", n % 17, (n & 1 ? -1 : 1) * mantissa(engine) * pow(10.0, exponent(engine)));
+        CHECK(parseJsonDouble(text, text + len) == strtod(text, nullptr));
+        CHECK(parseJsonFloat(text, text + len) == strtof(text, nullptr));
+        CHECK(JsonValue::fromNumber(text).number<float>() == strtof(text, nullptr));
+    }
+
+    // Integers convert exactly, and saturate outside the range of the type
+    std::uniform_int_distribution<int64_t> integer(INT64_MIN, INT64_MAX);
+    for(int n=0; n<100000; ++n)
+    {
+        auto value = integer(engine) >> engine() % 64;
+        auto len = sprintf(text, "%lld", static_cast<long long>(value));
+        CHECK(parseJsonInt64(text, text + len) == value);
+        CHECK(JsonValue::fromNumber(text).number<int64_t>() == value);
+        CHECK(JsonValue::fromNumber(text).number<int32_t>() == (value < INT32_MIN ? INT32_MIN : value > INT32_MAX ? INT32_MAX : value));
+    }
+    CHECK(JsonValue::fromNumber("18446744073709551615").number<uint64_t>() == UINT64_MAX);
+    CHECK(JsonValue::fromNumber("18446744073709551616").number<uint64_t>() == UINT64_MAX);
+    CHECK(JsonValue::fromNumber("-9223372036854775809").number<int64_t>() == INT64_MIN);
+    CHECK(JsonValue::fromNumber("-1").number<uint32_t>() == 0);
+    CHECK(JsonValue::fromNumber("1e3").number<int>() == 1000);
+    CHECK(JsonValue::fromNumber("-2.75").number<int>() == -2);
+}
+
+BENCHMARK(JsonNumbers)
+{
+    std::mt19937 engine;
+    std::uniform_real_distribution<float> value(-1000, 1000);
+    std::vector<std::string> texts(2000000);
+    char text[32];
+    for(auto & t : texts) t.assign(text, sprintf(text, "%.6g", value(engine)));
+    std::vector<legacy::JsonValue> legacyValues;
+    std::vector<JsonValue> values;
+    for(auto & t : texts) { legacyValues.push_back(legacy::JsonValue::fromNumber(t)); values.push_back(JsonValue::fromNumber(t)); }
+
+    int valid = 0; float sum = 0;
+    auto legacyValidate = MeasureMilliseconds(3, [&]() { for(auto & t : texts) valid += legacy::isJsonNumber(t); });
+    auto validate = MeasureMilliseconds(3, [&]() { for(auto & t : texts) valid += isJsonNumber(t); });
+    auto legacyNumber = MeasureMilliseconds(3, [&]() { for(auto & v : legacyValues) sum += v.number<float>(); });
+    auto number = MeasureMilliseconds(3, [&]() { for(auto & t : texts) sum += parseJsonFloat(t.data(), t.data() + t.size()); });
+    auto stored = MeasureMilliseconds(3, [&]() { for(auto & v : values) sum += v.number<float>(); });
+
+    auto perNumber = 1e6 / texts.size();
+    printf("  2M %%.6g floats, best of 3 (%d, %g)\n", valid, sum);
+    printf("  validate:         regex %6.1f ns, scanner %6.1f ns per number\n", legacyValidate * perNumber, validate * perNumber);
+    printf("  number<float>():  istringstream %6.1f ns, parseJsonFloat %6.1f ns, stored %6.1f ns per number\n", legacyNumber * perNumber, number * perNumber, stored * perNumber);
+}
+
+TEST(JsonValueLayout)
+{
+    CHECK(sizeof(JsonValue) == 24);
+
+    // Moves must leave the source null, whichever kind of value it held
+    JsonValue values[] = {nullptr, true, 1.5f, "text", JsonValue::fromNumber("3.14159265358979323846"), JsonArray{1, 2}, JsonObject{{"a", 1}}};
+    for(auto & value : values)
+    {
+        JsonValue copy = value, moved = std::move(value);
+        CHECK(moved == copy);
+        CHECK(value.isNull());
+    }
+    CHECK(JsonValue::fromNumber("3.14159265358979323846").contents() == "3.14159265358979323846");
+    CHECK(JsonValue::fromNumber("-1.2345678901e-7").contents() == "-1.2345678901e-7");
+}
+
+// Returns the heap bytes still held after f returns the value it built
+template<class F> static size_t MeasureHeldBytes(F f)
+{
+    auto before = GetHeapCounters().bytes;
+    auto value = f();
+    return GetHeapCounters().bytes - before;
+}
+
+BENCHMARK(JsonValueSize)
+{
+    printf("  sizeof(JsonValue):              legacy %3d, tagged union %3d bytes\n", (int)sizeof(legacy::JsonValue), (int)sizeof(JsonValue));
+
+    std::mt19937 engine;
+    std::uniform_real_distribution<float> value(-1000, 1000);
+    std::vector<float> floats(1000000);
+    for(auto & f : floats) f = value(engine);
+    auto legacyArray = MeasureHeldBytes([&]() { legacy::JsonArray a; a.reserve(floats.size()); for(auto f : floats) a.push_back(f); return a; });
+    auto array = MeasureHeldBytes([&]() { JsonArray a; a.reserve(floats.size()); for(auto f : floats) a.push_back(f); return a; });
+    printf("  1M-element JsonArray of float:  legacy %5.1f, tagged union %5.1f MB\n", legacyArray / 1e6, array / 1e6);
+
+    std::string text = "[";
+    char buffer[32];
+    for(auto f : floats) text.append(buffer, sprintf(buffer, "%s%.12g", text.size() > 1 ? "," : "", f * 1.000001));
+    text += "]";
+    auto legacyDoubles = MeasureHeldBytes([&]() { return legacy::jsonFrom(text); });
+    auto doubles = MeasureHeldBytes([&]() { return jsonFrom(text); });
+    printf("  1M parsed doubles (~13 chars):  legacy %5.1f, tagged union %5.1f MB\n", legacyDoubles / 1e6, doubles / 1e6);
+}
+
+TEST(JsonArenaParse)
+{
+    auto scene = GenerateScene(1000);
+    auto heap = jsonFrom(scene);
+    JsonValue copy;
+    {
+        JsonArena arena(256);
+        auto value = jsonFrom(scene, arena);
+        CHECK(value == heap);
+        CHECK(arena.bytesReserved() > 0);
+        copy = value; // Copies are detached from the arena
+    }
+    CHECK(copy == heap);
+}
+
+BENCHMARK(JsonArenaScene)
+{
+    auto scene = GenerateScene(100000);
+    printf("  %.1f MB scene, parse and release, best of 5\n", scene.size() / 1e6);
+
+    auto measure = [](const char * name, std::function<void()> f)
+    {
+        auto before = GetHeapCounters().allocations;
+        f();
+        auto allocations = GetHeapCounters().allocations - before;
+        printf("  %-8s %8llu allocations, %7.1f ms\n", name, static_cast<unsigned long long>(allocations), MeasureMilliseconds(5, f));
+    };
+    measure("legacy:", [&]() { legacy::jsonFrom(scene); });
+    measure("heap:", [&]() { jsonFrom(scene); });
+    measure("arena:", [&]() { JsonArena arena; jsonFrom(scene, arena); });
+}
+
+// Builds an object with the given number of fields, named "key0", "key1" and so on, where each field's value is its index
+static JsonObject MakeFields(int count)
+{
+    JsonObject fields;
+    for(int i=0; i<count; ++i) fields.emplace_back(JsonString(("key" + std::to_string(i)).c_str()), JsonValue(i));
+    return fields;
+}
+
+TEST(JsonObjectLookupMatchesScan)
+{
+    for(int count : {0, 1, 16, 17, 100, 1000})
+    {
+        auto fields = MakeFields(count);
+        fields.emplace_back("key0", JsonValue(-1)); // Duplicates resolve to the first occurrence
+        JsonValue constructed = fields;
+        std::ostringstream text;
+        text << constructed;
+        JsonArena arena;
+        JsonValue parsed = jsonFrom(text.str()), parsedInArena = jsonFrom(text.str(), arena);
+        for(auto * value : {&constructed, &parsed, &parsedInArena})
+        {
+            for(int i=0; i<count; ++i) CHECK((*value)["key" + std::to_string(i)].number<int>() == i);
+            CHECK((*value)["key" + std::to_string(count + 1)].isNull());
+            CHECK((*value)["key"].isNull());
+            CHECK((*value)[""].isNull());
+            CHECK(value->object().size() == fields.size());
+        }
+        JsonValue copy = parsedInArena;
+        for(int i=0; i<count; ++i) CHECK(copy["key" + std::to_string(i)].number<int>() == i);
+    }
+}
+
+BENCHMARK(JsonObjectLookup)
+{
+    printf("  average time to look up each key of an object\n");
+    printf("  keys    linear scan   indexed\n");
+    for(int count : {10, 100, 10000})
+    {
+        auto fields = MakeFields(count);
+        legacy::JsonObject legacyFields;
+        for(auto & f : fields) legacyFields.emplace_back(std::string(f.first.data(), f.first.size()), legacy::JsonValue(f.second.number<int>()));
+        legacy::JsonValue legacyObject = legacyFields;
+        JsonValue object = fields;
+        std::vector<std::string> keys;
+        for(auto & f : fields) keys.push_back(std::string(f.first.data(), f.first.size()));
+
+        int sum = 0, repeats = 1000000 / count;
+        auto legacyTime = MeasureMilliseconds(3, [&]() { for(int r=0; r<(count > 1000 ? 1 : repeats); ++r) for(auto & key : keys) sum += legacyObject[key].isNumber(); });
+        auto time = MeasureMilliseconds(3, [&]() { for(int r=0; r<repeats; ++r) for(auto & key : keys) sum += object[key].isNumber(); });
+        printf("  %-7d %8.1f ns   %8.1f ns (%d)\n", count, legacyTime * 1e6 / (count * (count > 1000 ? 1 : repeats)), time * 1e6 / (count * repeats), sum);
+    }
+}
+
+TEST(JsonFormatRoundTrips)
+{
+    // Includes extreme exponents, which are formatted by the sprintf fallback
+    std::mt19937 engine;
+    std::uniform_int_distribution<uint32_t> floatBits;
+    std::uniform_int_distribution<uint64_t> doubleBits;
+    char text[32];
+    for(int n=0; n<200000; ++n)
+    {
+        uint32_t fb = floatBits(engine); float f; memcpy(&f, &fb, sizeof(f));
+        uint64_t db = doubleBits(engine); double d; memcpy(&d, &db, sizeof(d));
+        if(auto end = formatJsonFloat(f, text)) CHECK(isJsonNumber(text, end) && parseJsonFloat(text, end) == f);
+        else CHECK(!std::isfinite(f));
+        if(auto end = formatJsonDouble(d, text)) CHECK(isJsonNumber(text, end) && (parseJsonDouble(text, end) == d || std::abs(d) == DBL_MAX));
+        else CHECK(!std::isfinite(d));
+    }
+}
+
+// Generates a compact, string-heavy document of asset records, whose strings contain some characters which must be escaped
+static std::string GenerateStrings(int records)
+{
+    std::mt19937 engine;
+    const char * words[] = {"texture", "mesh", "C:\\assets\\", "shader", "\"quoted\"", "tab\t", "line\n", "caf\xC3\xA9", "\x7F", "/path/to/file", "ctrl\x01"};
+    std::ostringstream text;
+    JsonWriter writer(text);
+    writer.beginArray();
+    for(int i=0; i<records; ++i)
+    {
+        writer.beginObject();
+        std::string name;
+        for(int j=0, n=2+engine()%6; j<n; ++j) name += words[engine() % (engine() % 4 ? 4 : 11)];
+        writer.key("name"); writer.value(name);
+        writer.key("id"); writer.value(i);
+        writer.key("tags"); writer.beginArray(); for(int j=0, n=engine()%4; j<n; ++j) writer.value(words[engine() % 11]); writer.endArray();
+        writer.key("size"); writer.beginArray(); writer.value(engine() % 4096); writer.value(engine() % 4096); writer.endArray();
+        writer.key("nested"); writer.beginArray(); if(i % 7 == 0) { writer.beginObject(); writer.endObject(); writer.beginArray(); writer.endArray(); } writer.endArray();
+        writer.endObject();
+    }
+    writer.endArray();
+    writer.flush();
+    return text.str();
+}
+
+TEST(JsonPrintMatchesLegacy)
+{
+    for(auto & text : {GenerateScene(200), GenerateStrings(2000), std::string("[[],{},[[1,2],[]],{\"a\":[{}]},\"\",0]")})
+    {
+        auto value = jsonFrom(text);
+        auto legacyValue = legacy::jsonFrom(text);
+        std::ostringstream a, b;
+        a << value; b << legacyValue;
+        CHECK(a.str() == b.str());
+        a << value.array(); b << legacyValue.array();
+        CHECK(a.str() == b.str());
+        for(int tabWidth : {1, 4})
+        {
+            for(int indent : {0, 3, 200})
+            {
+                std::ostringstream a, b;
+                a << tabbed(value, tabWidth, indent); b << legacy::tabbed(legacyValue, tabWidth, indent);
+                CHECK(a.str() == b.str());
+                a << tabbed(value.array(), tabWidth, indent); b << legacy::tabbed(legacyValue.array(), tabWidth, indent);
+                a << tabbed(value[0].object(), tabWidth, indent); b << legacy::tabbed(legacyValue[0].object(), tabWidth, indent);
+                CHECK(a.str() == b.str());
+            }
+        }
+    }
+}
+
+// Discards its output, so that writing to it measures only the cost of printing
+struct NullBuffer : std::streambuf
+{
+    int overflow(int ch) override { return ch; }
+    std::streamsize xsputn(const char *, std::streamsize count) override { return count; }
+};
+
+BENCHMARK(JsonPrint)
+{
+    auto text = GenerateStrings(200000);
+    auto value = jsonFrom(text);
+    auto legacyValue = legacy::jsonFrom(text);
+    printf("  %.1f MB string-heavy document, best of 3\n", text.size() / 1e6);
+    printf("                        iostream path   writer\n");
+
+    auto measure = [&](const char * name, bool tabs, bool discard)
+    {
+        std::ostringstream sized;
+        if(tabs) sized << tabbed(value, 4); else sized << value;
+        auto size = sized.str().size();
+        auto time = [&](std::function<void(std::ostream &)> print)
+        {
+            return MeasureMilliseconds(3, [&]()
+            {
+                NullBuffer null;
+                std::ostringstream memory; std::ostream discarded(&null);
+                print(discard ? discarded : memory);
+            });
+        };
+        auto legacyTime = time([&](std::ostream & out) { if(tabs) out << legacy::tabbed(legacyValue, 4); else out << legacyValue; });
+        auto writerTime = time([&](std::ostream & out) { if(tabs) out << tabbed(value, 4); else out << value; });
+        printf("  %-20s  %6.0f MB/s     %6.0f MB/s\n", name, size / legacyTime / 1e3, size / writerTime / 1e3);
+    };
+    measure("compact, to memory", false, false);
+    measure("tabbed, to memory", true, false);
+    measure("compact, discarded", false, true);
+    measure("tabbed, discarded", true, true);
+}
+
+static const char * SkipWhitespaceScalar(const char * it, const char * last) { while(it != last && simd::IsSpace(*it)) ++it; return it; }
+static const char * FindStringSpecialScalar(const char * it, const char * last) { while(it != last && !simd::IsStringSpecial(*it)) ++it; return it; }
+
+TEST(JsonScansMatchScalar)
+{
+    CHECK(simd::IsSpace(' ') && simd::IsSpace('\t') && simd::IsSpace('\n') && simd::IsSpace('\v') && simd::IsSpace('\f') && simd::IsSpace('\r'));
+    for(int ch=0; ch<256; ++ch)
+    {
+        CHECK(simd::IsSpace(static_cast<char>(ch)) == (isspace(ch) != 0));
+        CHECK(simd::IsStringSpecial(static_cast<char>(ch)) == (ch == '"' || ch == '\\' || ch < 0x20 || ch == 0x7F));
+    }
+
+    // Runs of whitespace or plain text of every length up to past two blocks, ended by every byte value, at every alignment
+    std::vector<char> buffer(160);
+    for(int length=0; length<80; ++length)
+    {
+        for(int end=0; end<256; ++end)
+        {
+            for(int offset : {0, 1, 7, 31})
+            {
+                auto first = buffer.data() + offset;
+                for(int i=0; i<length; ++i) first[i] = " \t\n\r"[(i * 7 + end) % 4];
+                first[length] = static_cast<char>(end);
+                for(auto last : {first + length, first + length + 1, first + length + 40})
+                {
+                    CHECK(simd::SkipWhitespace(first, last) == SkipWhitespaceScalar(first, last));
+                }
+                for(int i=0; i<length; ++i) first[i] = "abc \xC3\xA9/{}"[(i * 7 + end) % 9];
+                for(auto last : {first + length, first + length + 1, first + length + 40})
+                {
+                    CHECK(simd::FindStringSpecial(first, last) == FindStringSpecialScalar(first, last));
+                }
+            }
+        }
+    }
+}
+
+BENCHMARK(JsonScans)
+{
+    auto manifest = GenerateStrings(500000);
+    auto scene = GenerateScene(200000);
+    printf("  manifest is %.1f MB of compact, string-heavy records, scene is %.1f MB of tabbed numbers, best of 3\n", manifest.size() / 1e6, scene.size() / 1e6);
+
+    for(auto & doc : {std::make_pair("manifest", &manifest), std::make_pair("scene", &scene)})
+    {
+        auto & text = *doc.second;
+        auto first = text.data(), last = text.data() + text.size();
+        size_t count = 0;
+        auto blocks = MeasureMilliseconds(3, [&]()
+        {
+            for(auto it = first; it != last; ++it) { it = simd::SkipWhitespace(it, last); if(it != last && *it == '"') { it = simd::FindStringSpecial(it + 1, last); ++count; } if(it == last) break; }
+        });
+        auto scalar = MeasureMilliseconds(3, [&]()
+        {
+            for(auto it = first; it != last; ++it) { it = SkipWhitespaceScalar(it, last); if(it != last && *it == '"') { it = FindStringSpecialScalar(it + 1, last); ++count; } if(it == last) break; }
+        });
+        auto reader = MeasureMilliseconds(3, [&]() { JsonReader r(first, last); while(r.next() != JsonReader::EndOfStream) ++count; });
+        auto dom = MeasureMilliseconds(3, [&]() { JsonArena arena; count += jsonFrom(text, arena).array().size(); });
+        auto rate = [&](double ms) { return text.size() / ms / 1e6; };
+        printf("  %-9s scan: scalar %5.2f, blocks %5.2f GB/s   JsonReader %5.2f GB/s   jsonFrom %5.2f GB/s (%d)\n", doc.first, rate(scalar), rate(blocks), rate(reader), rate(dom), static_cast<int>(count % 10));
+    }
+}
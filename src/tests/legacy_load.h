@@ -0,0 +1,13 @@
+#ifndef TESTS_LEGACY_LOAD_H
+#define TESTS_LEGACY_LOAD_H
+
+#include "engine/load.h"
+
+// The OBJ loader as it was before the memory mapped, pointer-based and parallel loaders, kept as the baseline for load_test.cpp
+namespace legacy {
+
+Mesh LoadMeshFromObj(const std::string & filepath, bool swapYZ);
+
+}
+
+#endif
@@ -0,0 +1,130 @@
+#include "test.h"
+#include "engine/linalg.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+
+// A float which is not float, so that vec<Scalar,4> and mat<Scalar,4,4> always use the generic templates. Calling the templates on float4
+// directly would not do, as the operations they call inside are found again at instantiation, and resolve to the SSE overloads.
+struct Scalar
+{
+    float f;
+    Scalar() : f() {}
+    Scalar(float f) : f(f) {}
+};
+static Scalar operator + (Scalar a, Scalar b) { return a.f + b.f; }
+static Scalar operator - (Scalar a, Scalar b) { return a.f - b.f; }
+static Scalar operator * (Scalar a, Scalar b) { return a.f * b.f; }
+static Scalar operator / (Scalar a, Scalar b) { return a.f / b.f; }
+static Scalar operator + (Scalar a) { return a; }
+static Scalar operator - (Scalar a) { return -a.f; }
+
+typedef vec<Scalar,4> Scalar4;
+typedef mat<Scalar,4,4> Scalar4x4;
+
+static Scalar4 Generic(const float4 & a) { return {a.x, a.y, a.z, a.w}; }
+static Scalar4x4 Generic(const float4x4 & a) { return {Generic(a.x), Generic(a.y), Generic(a.z), Generic(a.w)}; }
+static bool Identical(const float4 & a, const Scalar4 & b) { float c[] = {b.x.f, b.y.f, b.z.f, b.w.f}; return memcmp(&a, c, sizeof(c)) == 0; }
+static bool Identical(const float4x4 & a, const Scalar4x4 & b) { return Identical(a.x, b.x) && Identical(a.y, b.y) && Identical(a.z, b.z) && Identical(a.w, b.w); }
+
+// Model matrices of the form the editor builds, which are well conditioned
+static float4x4 GenerateTransform(std::mt19937 & engine)
+{
+    std::uniform_real_distribution<float> coord(-10, 10), unit(-1, 1), scale(0.5f, 2);
+    float4 q(unit(engine), unit(engine), unit(engine), unit(engine));
+    q = q / std::sqrt(dot(q, q));
+    float3 s(scale(engine), scale(engine), scale(engine));
+    return {float4(qxdir(q) * s.x, 0), float4(qydir(q) * s.y, 0), float4(qzdir(q) * s.z, 0), float4(coord(engine), coord(engine), coord(engine), 1)};
+}
+
+TEST(LinalgSseMatchesTemplates)
+{
+    std::mt19937 engine(1);
+    std::uniform_real_distribution<float> coord(-100, 100);
+    auto vector = [&]() { return float4(coord(engine), coord(engine), coord(engine), coord(engine)); };
+    for(int n=0; n<200000; ++n)
+    {
+        auto a = vector(), b = vector();
+        auto s = coord(engine);
+        float4x4 m = {vector(), vector(), vector(), vector()}, k = {vector(), vector(), vector(), vector()};
+        CHECK(Identical(a + b, Generic(a) + Generic(b)));
+        CHECK(Identical(a - b, Generic(a) - Generic(b)));
+        CHECK(Identical(a * b, Generic(a) * Generic(b)));
+        CHECK(Identical(a / b, Generic(a) / Generic(b)));
+        CHECK(Identical(a + s, Generic(a) + Scalar(s)));
+        CHECK(Identical(a - s, Generic(a) - Scalar(s)));
+        CHECK(Identical(a * s, Generic(a) * Scalar(s)));
+        CHECK(Identical(a / s, Generic(a) / Scalar(s)));
+        CHECK(Identical(qmul(a, b), qmul(Generic(a), Generic(b))));
+        CHECK(Identical(mul(m, a), mul(Generic(m), Generic(a))));
+        CHECK(Identical(mul(m, k), mul(Generic(m), Generic(k))));
+        CHECK(Identical(transpose(m), transpose(Generic(m))));
+    }
+}
+
+TEST(LinalgSseInverse)
+{
+    // Neither inverse rounds as the other does, so both are compared against an inverse computed in double precision
+    std::mt19937 engine(2);
+    double worst = 0, worstGeneric = 0;
+    for(int n=0; n<200000; ++n)
+    {
+        auto m = GenerateTransform(engine);
+        double4x4 d;
+        for(int j=0; j<4; ++j) for(int i=0; i<4; ++i) d[j][i] = m[j][i];
+        auto exact = inv(d);
+        auto sse = inv(m);
+        auto generic = inv(Generic(m));
+        double largest = 0, error = 0, errorGeneric = 0;
+        for(int j=0; j<4; ++j) for(int i=0; i<4; ++i)
+        {
+            largest = std::max(largest, std::abs(exact[j][i]));
+            error = std::max(error, std::abs(sse[j][i] - exact[j][i]));
+            errorGeneric = std::max(errorGeneric, std::abs(generic[j][i].f - exact[j][i]));
+        }
+        worst = std::max(worst, error / largest);
+        worstGeneric = std::max(worstGeneric, errorGeneric / largest);
+    }
+    CHECK(worst < 1e-5);
+    CHECK(worst <= worstGeneric * 2);
+}
+
+// Prints the time per call of an SSE overload and of the same operation through the templates. Results are summed into a global, so that
+// none of them can be discarded.
+float linalgBenchmarkSum;
+template<class F, class G> static void MeasureOperation(const char * name, int count, F sse, G generic)
+{
+    float sink = 0;
+    auto genericTime = MeasureMilliseconds(50, [&]() { for(int i=0; i<count; ++i) sink += generic(i).x.f; });
+    auto sseTime = MeasureMilliseconds(50, [&]() { for(int i=0; i<count; ++i) sink += sse(i).x; });
+    linalgBenchmarkSum += sink;
+    printf("  %-16s %7.2f ns %7.2f ns\n", name, genericTime * 1e6 / count, sseTime * 1e6 / count);
+}
+
+BENCHMARK(LinalgSse)
+{
+    enum { Count = 4096 };
+    std::mt19937 engine(3);
+    std::vector<float4x4> m;
+    std::vector<float4> v;
+    std::vector<Scalar4x4> gm;
+    std::vector<Scalar4> gv;
+    for(int i=0; i<Count; ++i)
+    {
+        m.push_back(GenerateTransform(engine));
+        v.push_back(m.back().w);
+        gm.push_back(Generic(m.back()));
+        gv.push_back(Generic(v.back()));
+    }
+
+    const int j = Count - 1;
+    printf("  operation        template     sse\n");
+    MeasureOperation("float4 * float4", Count, [&](int i) { return v[i] * v[j-i]; }, [&](int i) { return gv[i] * gv[j-i]; });
+    MeasureOperation("qmul", Count, [&](int i) { return qmul(v[i], v[j-i]); }, [&](int i) { return qmul(gv[i], gv[j-i]); });
+    MeasureOperation("mul(m, v)", Count, [&](int i) { return mul(m[i], v[j-i]); }, [&](int i) { return mul(gm[i], gv[j-i]); });
+    MeasureOperation("mul(m, m)", Count, [&](int i) { return mul(m[i], m[j-i]).w; }, [&](int i) { return mul(gm[i], gm[j-i]).w; });
+    MeasureOperation("transpose", Count, [&](int i) { return transpose(m[i]).w; }, [&](int i) { return transpose(gm[i]).w; });
+    MeasureOperation("inv", Count, [&](int i) { return inv(m[i]).w; }, [&](int i) { return inv(gm[i]).w; });
+    MeasureOperation("normal matrix", Count, [&](int i) { return inv(transpose(mul(m[i], m[j-i]))).x; }, [&](int i) { return inv(transpose(mul(gm[i], gm[j-i]))).x; });
+}
@@ -0,0 +1,210 @@
+#include "test.h"
+#include "legacy_load.h"
+#include "engine/file.h"
+#include "engine/parallel.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+// Generates a grid of quads, or pairs of triangles, in the given face format, "v", "v/vt", "v//vn" or "v/vt/vn". Every fifth row of quads uses
+// a flat normal, so that its vertices are split from the smooth ones around them.
+static std::string GenerateObjGrid(int size, const char * format, bool triangles = false, const char * newline = "\n", bool trailingNewline = true)
+{
+    std::string text, f = format;
+    char buffer[256];
+    for(int y=0; y<=size; ++y) for(int x=0; x<=size; ++x)
+    {
+        text.append(buffer, sprintf(buffer, "v %g %g %g%s", x * 0.1f, y * 0.1f, (x * y % 7) * 0.01f, newline));
+        if(f.find("vt") != std::string::npos) text.append(buffer, sprintf(buffer, "vt %g %g%s", x / float(size), y / float(size), newline));
+        if(f.find("vn") != std::string::npos) text.append(buffer, sprintf(buffer, "vn %g %g 1%s", (x % 3) * 0.1f, (y % 3) * 0.1f, newline));
+    }
+    for(int y=0; y<size; ++y) for(int x=0; x<size; ++x)
+    {
+        int corners[] = {y*(size+1)+x, y*(size+1)+x+1, (y+1)*(size+1)+x+1, (y+1)*(size+1)+x, y*(size+1)+x, (y+1)*(size+1)+x+1};
+        for(int i=0; i<(triangles ? 6 : 4); ++i)
+        {
+            if(i % (triangles ? 3 : 4) == 0) text += "f";
+            int v = corners[i] + 1, n = y % 5 == 4 ? 1 : v;
+            if(f == "v") text.append(buffer, sprintf(buffer, " %d", v));
+            if(f == "v/vt") text.append(buffer, sprintf(buffer, " %d/%d", v, v));
+            if(f == "v//vn") text.append(buffer, sprintf(buffer, " %d//%d", v, n));
+            if(f == "v/vt/vn") text.append(buffer, sprintf(buffer, " %d/%d/%d", v, v, n));
+            if(i % (triangles ? 3 : 4) == (triangles ? 2 : 3)) text += newline;
+        }
+    }
+    if(!trailingNewline) text.resize(text.size() - strlen(newline));
+    return text;
+}
+
+static bool Equal(const Mesh & a, const Mesh & b)
+{
+    return a.vertices.size() == b.vertices.size() && a.triangles.size() == b.triangles.size()
+        && memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(Vertex)) == 0
+        && memcmp(a.triangles.data(), b.triangles.data(), a.triangles.size() * sizeof(uint3)) == 0;
+}
+
+static const char * edgeCases =
+    "# comment\n\n"
+    "mtllib scene.mtl\n"
+    "o thing\n"
+    "v 0 0 0\n"
+    "v\t1.5e0  0\t0 2\n"
+    "v 1 1 0 # trailing comment\n"
+    "v 0 1 0\n"
+    "v +0.5 2 -0.0\n"
+    "vt 0 0\nvt 1 0 0.5\nvt 1 1\n"
+    "vn 0 0 2\nvn 0 1 1\n"
+    "g group\nusemtl material\ns off\n"
+    "f 1/1/1 2/2/1 3/3/2\n"
+    "f 1/1/1 3/3/2 4/1/2 5/2/2\n"
+    "f  1//2   2//2 \t 3//2  \n"
+    "f 2/3 3/2 4/1\n"
+    "f 5 4 3\n";
+
+// Returns the text of the error thrown while loading the file, or "ok"
+static std::string LoadError(const std::string & text)
+{
+    TempFile file("load_test_error.obj", text);
+    try { LoadMeshFromObj(file.path, false); return "ok"; }
+    catch(const std::runtime_error & e) { return e.what(); }
+}
+
+TEST(LoadObjMatchesLegacy)
+{
+    for(bool swapYZ : {false, true})
+    {
+        for(auto path : {"../assets/cube.obj", "../assets/teapot.obj"}) CHECK(Equal(LoadMeshFromObj(path, swapYZ), legacy::LoadMeshFromObj(path, swapYZ)));
+
+        std::string files[] = {edgeCases, GenerateObjGrid(30, "v"), GenerateObjGrid(30, "v/vt"), GenerateObjGrid(30, "v//vn"), GenerateObjGrid(30, "v/vt/vn"),
+            GenerateObjGrid(30, "v/vt/vn", false, "\r\n"), GenerateObjGrid(30, "v/vt/vn", true, "\r\n", false), GenerateObjGrid(30, "v//vn", true, "\n", false)};
+        for(auto & text : files)
+        {
+            TempFile file("load_test.obj", text);
+            CHECK(Equal(LoadMeshFromObj(file.path, swapYZ), legacy::LoadMeshFromObj(file.path, swapYZ)));
+        }
+    }
+
+    // Relative indices refer back from the latest attributes
+    TempFile absolute("load_test_absolute.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\nf 1//1 2//1 3//1\nv 1 1 0\nvn 0 1 0\nf 2//2 4//2 3//1\n");
+    TempFile relative("load_test_relative.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\nf -3//-1 -2//-1 -1//-1\nv 1 1 0\nvn 0 1 0\nf -3//-1 -1//-1 -2//-2\n");
+    CHECK(Equal(LoadMeshFromObj(absolute.path, false), LoadMeshFromObj(relative.path, false)));
+
+    CHECK(LoadError("v 0 0 0\nf 1 1 2\n") == "Index out of range in load_test_error.obj");
+    CHECK(LoadError("v 0 0 0\nf 1 1 -2\n") == "Index out of range in load_test_error.obj");
+    CHECK(LoadError("v 0 0 0\nvt 0 0\nf 1/2 1/1 1/1\n") == "Index out of range in load_test_error.obj");
+    CHECK(LoadError("v 0 0 0\nf 1 1 1\n") == "ok");
+}
+
+// Returns the best time of several loads of a mesh, in milliseconds
+template<class F> static double MeasureLoad(int runs, F load)
+{
+    return MeasureMilliseconds(runs, [&]() { load(); });
+}
+
+BENCHMARK(LoadObj)
+{
+    printf("  file                                       size   istringstream    pointer scan\n");
+    auto measure = [](const char * name, const std::string & path, int runs)
+    {
+        auto legacyTime = MeasureLoad(runs, [&]() { return legacy::LoadMeshFromObj(path, false); });
+        auto time = MeasureLoad(runs, [&]() { return LoadMeshFromObj(path, false); });
+        auto size = std::ifstream(path, std::ios::binary | std::ios::ate).tellg();
+        printf("  %-34s %8.1f MB %10.3f ms   %10.3f ms\n", name, static_cast<double>(size) / 1e6, legacyTime, time);
+    };
+    measure("cube.obj", "../assets/cube.obj", 100);
+    measure("teapot.obj", "../assets/teapot.obj", 10);
+    {
+        TempFile file("load_test_medium.obj", GenerateObjGrid(300, "v/vt/vn", false, "\r\n"));
+        measure("300x300 grid, v/vt/vn, 180k tris", file.path, 3);
+    }
+    {
+        TempFile file("load_test_large.obj", GenerateObjGrid(2237, "v", true));
+        measure("2237x2237 grid, v, 10M faces", file.path, 1);
+    }
+}
+
+TEST(LoadObjParallelMatchesSerial)
+{
+    // Files of several MB, so that they are split into chunks of at least 1 MB, including one with relative indices and one with an error at the end
+    std::string relative = GenerateObjGrid(150, "v//vn", true);
+    for(int i=0; i<20000; ++i) relative += "v 0 0 " + std::to_string(i) + "\nvn 0 1 0\nf -1//-1 -2//-1 -3//-1\n";
+    std::string files[] = {GenerateObjGrid(300, "v/vt/vn"), GenerateObjGrid(300, "v//vn", true, "\r\n"), relative};
+    for(auto & text : files)
+    {
+        TempFile file("load_test.obj", text);
+        auto serial = LoadMeshFromObj(file.path, false);
+        for(int threadCount : {1, 2, 4, 8, 16})
+        {
+            ThreadPool threads(threadCount);
+            CHECK(Equal(LoadMeshFromObj(file.path, false, &threads), serial));
+        }
+    }
+
+    TempFile file("load_test_error.obj", files[0] + "f 1 2 1000000000\n");
+    for(int threadCount : {1, 4})
+    {
+        ThreadPool threads(threadCount);
+        bool thrown = false;
+        try { LoadMeshFromObj(file.path, false, &threads); }
+        catch(const std::runtime_error &) { thrown = true; }
+        CHECK(thrown);
+    }
+}
+
+BENCHMARK(LoadObjThreads)
+{
+    TempFile file("load_test_large.obj", GenerateObjGrid(2237, "v", true));
+    printf("  2237x2237 grid, v, 10M faces, on %d hardware threads\n", static_cast<int>(std::thread::hardware_concurrency()));
+    auto serial = MeasureLoad(1, [&]() { return LoadMeshFromObj(file.path, false); });
+    printf("  no pool     %8.1f ms\n", serial);
+    for(int threadCount : {1, 2, 4, 8, 16})
+    {
+        ThreadPool threads(threadCount);
+        auto time = MeasureLoad(1, [&]() { return LoadMeshFromObj(file.path, false, &threads); });
+        printf("  %2d threads  %8.1f ms, %.2fx\n", threadCount, time, serial / time);
+    }
+}
+
+TEST(LoadObjCacheMatchesParse)
+{
+    auto first = GenerateObjGrid(30, "v/vt/vn"), second = GenerateObjGrid(20, "v//vn", true);
+    TempFile file("load_test_cache.obj", first), cache(file.path + ".mesh", ""); // An empty cache is rejected like a truncated one
+    auto parsed = LoadMeshFromObj(file.path, false);
+    CHECK(Equal(LoadMeshFromObjCached(file.path, false), parsed)); // Writes the cache
+    CHECK(Equal(LoadMeshFromObjCached(file.path, false), parsed)); // Reads it
+    CHECK(!Equal(LoadMeshFromObjCached(file.path, true), parsed));
+
+    // A truncated cache, or one for a different source, is parsed again
+    std::ofstream(file.path + ".mesh", std::ios::binary) << "short";
+    CHECK(Equal(LoadMeshFromObjCached(file.path, false), parsed));
+    std::ofstream(file.path, std::ios::binary) << second;
+    CHECK(Equal(LoadMeshFromObjCached(file.path, false), LoadMeshFromObj(file.path, false)));
+    CHECK(!Equal(LoadMeshFromObjCached(file.path, false), parsed));
+}
+
+BENCHMARK(LoadObjCached)
+{
+    printf("  file                                       parse         cached\n");
+    auto measure = [](const char * name, const std::string & path, int runs)
+    {
+        auto parse = MeasureLoad(runs, [&]() { return LoadMeshFromObj(path, false); });
+        TempFile cache(path + ".mesh", "");
+        LoadMeshFromObjCached(path, false); // Writes the cache
+        auto cached = MeasureLoad(runs, [&]() { return LoadMeshFromObjCached(path, false); });
+        printf("  %-34s %10.3f ms  %10.3f ms\n", name, parse, cached);
+    };
+    {
+        MappedFile teapot("../assets/teapot.obj"); // Copied, so that no cache is left among the assets
+        TempFile file("load_test_teapot.obj", std::string(teapot.begin(), teapot.end()));
+        measure("teapot.obj", file.path, 10);
+    }
+    {
+        TempFile file("load_test_medium.obj", GenerateObjGrid(300, "v/vt/vn", false, "\r\n"));
+        measure("300x300 grid, v/vt/vn, 180k tris", file.path, 3);
+    }
+    {
+        TempFile file("load_test_large.obj", GenerateObjGrid(2237, "v", true));
+        measure("2237x2237 grid, v, 10M faces", file.path, 1);
+    }
+}
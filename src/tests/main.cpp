@@ -0,0 +1,90 @@
+#include "test.h"
+#include "engine/load.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <new>
+#include <string>
+
+std::vector<TestCase> & GetTestCases()
+{
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+static int failures;
+
+void ReportFailure(const char * file, int line, const char * condition)
+{
+    if(failures++ < 100) printf("  %s(%d): CHECK(%s) failed\n", file, line, condition);
+}
+
+// Every allocation is preceded by a header which records its size, so that delete can keep the byte counts
+static std::atomic<size_t> allocations, bytes, peakBytes;
+enum { HeaderSize = 16 };
+
+void * operator new(size_t size)
+{
+    auto p = static_cast<char *>(malloc(size + HeaderSize));
+    if(!p) throw std::bad_alloc();
+    memcpy(p, &size, sizeof(size));
+    ++allocations;
+    auto total = bytes += size;
+    for(auto peak = peakBytes.load(); total > peak && !peakBytes.compare_exchange_weak(peak, total); ) {}
+    return p + HeaderSize;
+}
+
+void operator delete(void * p) throw()
+{
+    if(!p) return;
+    auto block = static_cast<char *>(p) - HeaderSize;
+    size_t size;
+    memcpy(&size, block, sizeof(size));
+    bytes -= size;
+    free(block);
+}
+
+HeapCounters GetHeapCounters() { return {allocations.load(), bytes.load(), peakBytes.load()}; }
+void ResetPeakHeapBytes() { peakBytes = bytes.load(); }
+
+// Mesh::Upload and Mesh::Draw are defined by the editor in mesh.cpp. Tests run without a GL context, so they only get the CPU side.
+void Mesh::Upload()
+{
+    bvh.reset();
+    ComputeBounds();
+}
+
+void Mesh::Draw() const {}
+
+// Runs every test whose name contains one of the arguments, or every test if there are none. Benchmarks run if --bench is given, or if they
+// are named by one of the arguments. Returns the number of tests which failed.
+int main(int argc, char * argv[])
+{
+    bool benchmarks = false;
+    std::vector<std::string> filters;
+    for(int i=1; i<argc; ++i)
+    {
+        if(strcmp(argv[i], "--bench") == 0) benchmarks = true;
+        else filters.push_back(argv[i]);
+    }
+
+    int failed = 0, run = 0;
+    for(auto & test : GetTestCases())
+    {
+        bool named = false;
+        for(auto & filter : filters) if(strstr(test.name, filter.c_str())) named = true;
+        if(filters.empty() ? test.isBenchmark && !benchmarks : !named) continue;
+
+        printf("%s\n", test.name);
+        fflush(stdout);
+        failures = 0;
+        try { test.run(); }
+        catch(const std::exception & e) { ReportFailure(__FILE__, __LINE__, e.what()); }
+        if(failures) { printf("  FAILED with %d failures\n", failures); ++failed; }
+        ++run;
+    }
+    printf("%d of %d passed\n", run - failed, run);
+    return failed;
+}
@@ -0,0 +1,32 @@
+#include "test.h"
+#include "engine/pack.h"
+
+// A reflected type with more fields than fit in a 64-bit mask, the last of which are not numbers
+struct WideRecord { int values[70]; std::string name; float3 position; };
+template<class F> void VisitFields(WideRecord & o, F f)
+{
+    static const auto names = []() { std::vector<std::string> names; for(int i=0; i<70; ++i) names.push_back("f" + std::to_string(i)); return names; }();
+    for(int i=0; i<70; ++i) f(names[i].c_str(), o.values[i]);
+    f("name", o.name);
+    f("position", o.position);
+}
+
+TEST(JsonStreamDeserializerWideObject)
+{
+    // Fields in reverse order, with f3 missing, a duplicate of f68, and an unknown key
+    std::string text = "{\"extra\":[1,{\"f1\":2}],\"position\":[1,2,3],\"name\":\"wide\"";
+    for(int i=69; i>=0; --i) if(i != 3) text += ",\"f" + std::to_string(i) + "\":" + std::to_string(i * 10);
+    text += ",\"f68\":-1}";
+
+    AssetLibrary assets;
+    JsonReader reader(text.data(), text.data() + text.size());
+    auto streamed = DeserializeFromJson<WideRecord>(reader, assets);
+    auto loaded = DeserializeFromJson<WideRecord>(jsonFrom(text), assets);
+    for(int i=0; i<70; ++i)
+    {
+        CHECK(streamed.values[i] == (i == 3 ? 0 : i * 10));
+        CHECK(loaded.values[i] == streamed.values[i]);
+    }
+    CHECK(streamed.name == "wide" && loaded.name == "wide");
+    CHECK(streamed.position == float3(1,2,3) && loaded.position == float3(1,2,3));
+}
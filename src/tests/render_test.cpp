@@ -0,0 +1,212 @@
+#include "test.h"
+#include "engine/render.h"
+
+#include <algorithm>
+#include <random>
+#include <tuple>
+
+typedef RecordingRenderBackend::Type CommandType;
+typedef std::tuple<const void *, const void *, GLint, GLintptr, const void *, size_t, GLsizei> DrawSignature; // Program, mesh, binding, offset and instances
+
+// Draws of several programs and meshes, added in a shuffled order, each told apart by the offset of its uniform range. Every tenth draw
+// shares its depth with the draw before it, and every seventh has no uniform block.
+struct Scenario
+{
+    gl::Program programs[4];
+    gl::Mesh meshes[6];
+    gl::InstanceBuffer instances;
+    std::vector<std::pair<DrawItem, float>> draws;
+
+    Scenario(size_t count, uint32_t seed)
+    {
+        std::mt19937 engine(seed);
+        std::uniform_real_distribution<float> depth(0, 100);
+        for(size_t i=0; i<count; ++i)
+        {
+            DrawItem item = {&programs[engine() % 4], &meshes[engine() % 6], i % 7 ? static_cast<GLint>(i % 3) : -1, {static_cast<GLintptr>(i * 256), 256}, nullptr, 0, 0};
+            draws.push_back({item, i % 10 == 9 ? draws.back().second : depth(engine)});
+        }
+    }
+
+    void AddTo(RenderQueue & queue) const { for(auto & draw : draws) queue.Add(draw.first, draw.second); }
+
+    // The draws in the order the queue must submit them, by programs and then meshes in order of first use, then by depth, then in the order
+    // added. Draws without a uniform block or instances can only be told apart by their program and mesh, so nothing else is compared for them.
+    std::vector<DrawSignature> GetExpectedDraws() const
+    {
+        std::vector<const void *> programOrder, meshOrder;
+        for(auto & draw : draws)
+        {
+            if(std::find(programOrder.begin(), programOrder.end(), draw.first.program) == programOrder.end()) programOrder.push_back(draw.first.program);
+            if(std::find(meshOrder.begin(), meshOrder.end(), draw.first.mesh) == meshOrder.end()) meshOrder.push_back(draw.first.mesh);
+        }
+        auto rank = [&](size_t i)
+        {
+            auto & item = draws[i].first;
+            return std::make_tuple(std::find(programOrder.begin(), programOrder.end(), item.program) - programOrder.begin(),
+                std::find(meshOrder.begin(), meshOrder.end(), item.mesh) - meshOrder.begin(), draws[i].second);
+        };
+        std::vector<size_t> order;
+        for(size_t i=0; i<draws.size(); ++i) order.push_back(i);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return rank(a) < rank(b); });
+
+        std::vector<DrawSignature> signatures;
+        for(auto i : order)
+        {
+            auto & item = draws[i].first;
+            signatures.push_back(std::make_tuple(item.program, item.mesh, item.binding, item.binding >= 0 ? item.perObject.offset : -1, item.instances, item.firstInstance, item.instanceCount));
+        }
+        return signatures;
+    }
+};
+
+// Replays the recorded commands, returning the state each draw was made with. Uniforms bound for a draw count only for the draw which follows.
+static std::vector<DrawSignature> ReplayDraws(const RecordingRenderBackend & backend)
+{
+    std::vector<DrawSignature> draws;
+    const void * program = nullptr, * mesh = nullptr;
+    GLint binding = -1;
+    GLintptr offset = -1;
+    for(auto & command : backend.commands)
+    {
+        switch(command.type)
+        {
+        case CommandType::UseProgram: program = command.object; break;
+        case CommandType::BindMesh: mesh = command.object; break;
+        case CommandType::BindUniforms: binding = command.binding; offset = command.range.offset; break;
+        case CommandType::Draw: case CommandType::DrawInstanced:
+            CHECK(command.object == mesh);
+            draws.push_back(std::make_tuple(program, mesh, binding, offset, command.instances, command.firstInstance, command.instanceCount));
+            binding = -1;
+            offset = -1;
+            break;
+        }
+    }
+    return draws;
+}
+
+static size_t CountCommands(const RecordingRenderBackend & backend, CommandType type)
+{
+    return std::count_if(backend.commands.begin(), backend.commands.end(), [type](const RecordingRenderBackend::Command & c) { return c.type == type; });
+}
+
+TEST(RenderQueueSortsByProgramMeshAndDepth)
+{
+    for(size_t count : {0, 1, 2, 50, 1000})
+    {
+        Scenario scenario(count, static_cast<uint32_t>(count));
+        RenderQueue queue;
+        scenario.AddTo(queue);
+        RecordingRenderBackend backend;
+        queue.Submit(backend);
+        CHECK(ReplayDraws(backend) == scenario.GetExpectedDraws());
+
+        // Submitting again, or after clearing and adding the same draws, gives the same commands
+        RecordingRenderBackend again;
+        queue.Submit(again);
+        CHECK(again.commands.size() == backend.commands.size());
+        queue.Clear();
+        CHECK(queue.GetSize() == 0);
+        scenario.AddTo(queue);
+        RecordingRenderBackend cleared;
+        queue.Submit(cleared);
+        CHECK(ReplayDraws(cleared) == scenario.GetExpectedDraws());
+    }
+}
+
+TEST(RenderQueueSkipsRedundantBinds)
+{
+    Scenario scenario(1000, 1);
+    RenderQueue queue;
+    scenario.AddTo(queue);
+    RecordingRenderBackend backend;
+    queue.Submit(backend);
+
+    // One UseProgram per program, one BindMesh per run of a mesh within a program, and neither ever rebinds what is already bound
+    size_t runs = 0;
+    const void * program = nullptr, * mesh = nullptr;
+    for(auto & command : backend.commands)
+    {
+        if(command.type == CommandType::UseProgram) { CHECK(command.object != program); program = command.object; mesh = nullptr; }
+        if(command.type == CommandType::BindMesh) { CHECK(command.object != mesh); mesh = command.object; ++runs; }
+    }
+    std::vector<std::pair<const void *, const void *>> pairs;
+    for(auto & draw : scenario.draws) pairs.push_back({draw.first.program, draw.first.mesh});
+    std::sort(pairs.begin(), pairs.end());
+    CHECK(CountCommands(backend, CommandType::UseProgram) == 4);
+    CHECK(runs == static_cast<size_t>(std::unique(pairs.begin(), pairs.end()) - pairs.begin()));
+    CHECK(CountCommands(backend, CommandType::Draw) == 1000);
+
+    // Every draw with a uniform block binds it, directly before the draw
+    size_t blocks = 0;
+    for(auto & draw : scenario.draws) if(draw.first.binding >= 0) ++blocks;
+    CHECK(CountCommands(backend, CommandType::BindUniforms) == blocks);
+    for(size_t i=0; i<backend.commands.size(); ++i) if(backend.commands[i].type == CommandType::BindUniforms) CHECK(i+1 < backend.commands.size() && backend.commands[i+1].type == CommandType::Draw);
+}
+
+TEST(RenderQueueKeepsInstancedDrawsInOrder)
+{
+    // Instanced draws, at depth 0 as Scene adds them, go first among the draws of their program and mesh, and draw the run they were added with
+    Scenario scenario(200, 2);
+    for(size_t i=0; i<scenario.draws.size(); i+=25)
+    {
+        auto & draw = scenario.draws[i];
+        draw.first.binding = -1;
+        draw.first.instances = &scenario.instances;
+        draw.first.firstInstance = i * 10;
+        draw.first.instanceCount = static_cast<GLsizei>(i + 1);
+        draw.second = 0;
+    }
+    RenderQueue queue;
+    scenario.AddTo(queue);
+    RecordingRenderBackend backend;
+    queue.Submit(backend);
+    CHECK(ReplayDraws(backend) == scenario.GetExpectedDraws());
+    CHECK(CountCommands(backend, CommandType::DrawInstanced) == 8);
+    for(auto & command : backend.commands)
+    {
+        if(command.type != CommandType::DrawInstanced) continue;
+        CHECK(command.instances == &scenario.instances);
+        CHECK(command.instanceCount == static_cast<GLsizei>(command.firstInstance / 10 + 1));
+    }
+}
+
+// Without a GPU, the cost of a state change cannot be measured, so both ways of drawing are recorded, which makes each command cost about
+// the same, and the number of program and mesh binds they issue is what would carry over to GL
+BENCHMARK(RenderQueueSubmit)
+{
+    Scenario scenario(100000, 3);
+    RecordingRenderBackend backend;
+    backend.commands.reserve(scenario.draws.size() * 4);
+    auto print = [&](const char * name, double time)
+    {
+        printf("  %-30s %7.2f ms %9llu %9llu %9llu\n", name, time, static_cast<unsigned long long>(CountCommands(backend, CommandType::UseProgram)),
+            static_cast<unsigned long long>(CountCommands(backend, CommandType::BindMesh)), static_cast<unsigned long long>(backend.commands.size()));
+    };
+    printf("  %-30s %10s %9s %9s %9s\n", "100k draws, 4 programs, 6 meshes", "time", "programs", "meshes", "commands");
+
+    // As Scene drew before the queue, binding the program, mesh and uniforms of every object in turn
+    auto loopTime = MeasureMilliseconds(10, [&]()
+    {
+        backend.commands.clear();
+        for(auto & draw : scenario.draws)
+        {
+            auto & item = draw.first;
+            backend.UseProgram(*item.program);
+            backend.BindMesh(*item.mesh);
+            if(item.binding >= 0) backend.BindUniforms(item.binding, item.perObject);
+            backend.Draw(*item.mesh);
+        }
+    });
+    print("per-object loop", loopTime);
+
+    RenderQueue queue;
+    auto queueTime = MeasureMilliseconds(10, [&]()
+    {
+        backend.commands.clear();
+        queue.Clear();
+        scenario.AddTo(queue);
+        queue.Submit(backend);
+    });
+    print("sorted queue (add and submit)", queueTime);
+}
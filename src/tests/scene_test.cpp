@@ -0,0 +1,360 @@
+#include "test.h"
+#include "editor/scene.h"
+#include "engine/pack.h"
+#include "engine/parallel.h"
+
+#include <cstring>
+#include <random>
+#include <sstream>
+
+// Closest object hit, favoring the earliest in objects on ties, by testing every object as Scene::Hit did before it kept a hierarchy
+static std::shared_ptr<Object> HitEveryObject(const Scene & scene, const Ray & ray)
+{
+    std::shared_ptr<Object> best = nullptr;
+    float bestT = 0;
+    for(auto & obj : scene.objects)
+    {
+        auto hit = obj->Hit(ray);
+        if(hit.hit && (!best || hit.t < bestT))
+        {
+            best = obj;
+            bestT = hit.t;
+        }
+    }
+    return best;
+}
+
+static MeshHandle AddMesh(AssetLibrary & assets, const std::string & id, Mesh mesh)
+{
+    mesh.Upload();
+    return assets.AddAsset(id, std::move(mesh));
+}
+
+// Boxes and cylinders scattered through a cube, with a few objects whose meshes are empty or missing, and coincident duplicates of some
+struct RandomScene
+{
+    AssetLibrary assets;
+    MeshHandle meshes[4];
+    std::mt19937 engine;
+    Scene scene;
+
+    RandomScene(size_t count, float size, uint32_t seed) : engine(seed), size(size)
+    {
+        Mesh box, cylinder;
+        box.AddBox({-1,-1,-1}, {1,1,1});
+        cylinder.AddCylinder({0,-1,0}, 0.5f, {0,1,0}, 1.0f, {1,0,0}, {0,0,1}, 12);
+        meshes[0] = AddMesh(assets, "box", std::move(box));
+        meshes[1] = AddMesh(assets, "cylinder", std::move(cylinder));
+        meshes[2] = AddMesh(assets, "empty", Mesh());
+        for(size_t i=0; i<count; ++i)
+        {
+            if(i % 16 == 15) scene.DuplicateObject(*scene.objects[engine() % scene.objects.size()]);
+            else scene.CreateObject("object", RandomPoint(), RandomScale(), RandomMesh(), {}, {1,1,1})->pose.orientation = RandomOrientation();
+        }
+    }
+
+    float Random(float lo, float hi) { return std::uniform_real_distribution<float>(lo, hi)(engine); }
+    float3 RandomPoint() { return float3(Random(-size, size), Random(-size, size), Random(-size, size)); }
+    float3 RandomScale() { return float3(Random(0.2f, 3), Random(0.2f, 3), Random(0.2f, 3)); }
+    float4 RandomOrientation() { return norm(float4(Random(-1, 1), Random(-1, 1), Random(-1, 1), Random(-1, 1))); }
+    MeshHandle RandomMesh() { auto r = engine() % 20; return meshes[r < 9 ? 0 : r < 18 ? 1 : r - 16]; } // meshes[3] is left missing
+    Ray RandomRay() { return Ray::Between(RandomPoint() * 2.0f, RandomPoint()); }
+
+    // Region seen by a camera outside the cube, through a rectangle of random size
+    Frustum RandomFrustum()
+    {
+        auto eye = RandomPoint() * 2.0f, forward = norm(RandomPoint() - eye), right = norm(cross(forward, float3(0,1,0))), up = cross(right, forward);
+        float width = Random(0.05f, 0.6f), height = Random(0.05f, 0.6f), far = size * 8;
+        float3 nearCorners[4], farCorners[4];
+        for(int i=0; i<4; ++i)
+        {
+            auto offset = forward + right * (i == 1 || i == 2 ? width : -width) + up * (i >= 2 ? height : -height);
+            nearCorners[i] = eye + offset;
+            farCorners[i] = eye + offset * far;
+        }
+        return Frustum::Between(nearCorners, farCorners);
+    }
+private:
+    float size;
+};
+
+TEST(SceneHitMatchesEveryObjectAfterEdits)
+{
+    RandomScene random(600, 20, 1);
+    auto & scene = random.scene;
+    auto checkRays = [&]()
+    {
+        for(int i=0; i<300; ++i)
+        {
+            auto ray = random.RandomRay();
+            CHECK(scene.Hit(ray) == HitEveryObject(scene, ray));
+        }
+    };
+    checkRays();
+
+    // Objects whose meshes have triangles are in the hierarchy, so moving or scaling them refits it rather than marking it for a rebuild
+    auto pickInHierarchy = [&]() -> Object &
+    {
+        while(true)
+        {
+            auto & obj = *scene.objects[random.engine() % scene.objects.size()];
+            if(obj.mesh && !obj.mesh->triangles.empty()) return obj;
+        }
+    };
+    for(int round=0; round<20; ++round)
+    {
+        for(int i=0; i<10; ++i)
+        {
+            switch(round % 4)
+            {
+            case 0: { auto & obj = pickInHierarchy(); obj.pose = Pose(random.RandomPoint(), random.RandomOrientation()); scene.UpdateObjectBounds(obj); break; }
+            case 1: { auto & obj = pickInHierarchy(); obj.localScale = random.RandomScale(); scene.UpdateObjectBounds(obj); break; }
+            case 2: { auto & obj = *scene.objects[random.engine() % scene.objects.size()]; obj.mesh = random.RandomMesh(); scene.UpdateObjectBounds(obj); break; }
+            case 3: scene.DeleteObject(scene.objects[random.engine() % scene.objects.size()]); break;
+            }
+        }
+        if(round % 4 < 2) CHECK(!scene.bvhDirty);
+        checkRays();
+    }
+}
+
+TEST(SceneBatchedHitMatchesSingleRays)
+{
+    RandomScene random(2000, 20, 3);
+    std::vector<Ray> rays;
+    for(int i=0; i<10001; ++i) rays.push_back(random.RandomRay());
+
+    ThreadPool pool(4);
+    ThreadPool * pools[] = {nullptr, &pool};
+    for(auto threads : pools)
+    {
+        std::vector<std::shared_ptr<Object>> hits(rays.size());
+        random.scene.Hit(rays.data(), rays.size(), hits.data(), threads);
+        for(size_t i=0; i<rays.size(); ++i) CHECK(hits[i] == random.scene.Hit(rays[i]));
+    }
+}
+
+// Whether every vertex of the object's mesh lies inside the frustum (1), some vertex lies outside it (0), or a vertex lies so close to one of
+// its planes that rounding could decide either way (-1). Objects without triangles are never selected.
+static int ContainsEveryVertex(const Frustum & frustum, const Object & obj)
+{
+    if(!obj.mesh || obj.mesh->triangles.empty()) return 0;
+    int result = 1;
+    for(auto & vertex : obj.mesh->vertices)
+    {
+        auto position = obj.pose.TransformCoord(vertex.position * obj.localScale);
+        for(auto & plane : frustum.planes)
+        {
+            auto distance = (dot(plane.GetNormal(), position) + plane.coeff.w) / mag(plane.GetNormal());
+            if(distance < -1e-3f) return 0;
+            if(distance < 1e-3f) result = -1;
+        }
+    }
+    return result;
+}
+
+TEST(SceneSelectMatchesEveryVertex)
+{
+    RandomScene random(2000, 20, 4);
+    auto & scene = random.scene;
+    ThreadPool pool(4);
+    ThreadPool * pools[] = {nullptr, &pool};
+    size_t selectedCount = 0;
+    for(int n=0; n<40; ++n)
+    {
+        // The first frustum holds the whole scene, so that every subtree lies inside it
+        const float3 nearCorners[4] = {{-100,-100,-100}, {100,-100,-100}, {100,100,-100}, {-100,100,-100}};
+        const float3 farCorners[4] = {{-100,-100,100}, {100,-100,100}, {100,100,100}, {-100,100,100}};
+        auto frustum = n == 0 ? Frustum::Between(nearCorners, farCorners) : random.RandomFrustum();
+        for(auto threads : pools)
+        {
+            auto selected = scene.Select(frustum, threads);
+            selectedCount += selected.size();
+            size_t next = 0;
+            for(auto & obj : scene.objects)
+            {
+                bool isSelected = next < selected.size() && selected[next] == obj;
+                if(isSelected) ++next;
+                auto expected = ContainsEveryVertex(frustum, *obj);
+                if(expected >= 0) CHECK(isSelected == (expected == 1));
+            }
+            CHECK(next == selected.size());
+        }
+    }
+    CHECK(selectedCount > 2000);
+}
+
+// Whether the cached matrices of the object are those of its current transform, bit for bit
+static bool HasCurrentMatrices(const Object & obj)
+{
+    auto model = ScaledTransformationMatrix(obj.localScale, obj.pose.orientation, obj.pose.position);
+    auto normal = ScaledNormalMatrix(obj.localScale, obj.pose.orientation, obj.pose.position);
+    return memcmp(&obj.GetModelMatrix(), &model, sizeof(model)) == 0 && memcmp(&obj.GetNormalMatrix(), &normal, sizeof(normal)) == 0;
+}
+
+TEST(ObjectMatricesFollowEdits)
+{
+    RandomScene random(300, 20, 5);
+    ThreadPool pool(4);
+    ThreadPool * pools[] = {nullptr, &pool};
+    for(auto threads : pools)
+    {
+        for(int round=0; round<10; ++round)
+        {
+            for(int i=0; i<20; ++i)
+            {
+                auto & obj = *random.scene.objects[random.engine() % random.scene.objects.size()];
+                if(i % 2) obj.pose = Pose(random.RandomPoint(), random.RandomOrientation() * random.Random(0.5f, 2)); // Includes unnormalized orientations
+                else obj.localScale = random.RandomScale();
+                obj.InvalidateMatrices();
+            }
+            // Alternate between the batch in Scene and computing the matrices of each object on first use
+            if(round % 2) random.scene.UpdateMatrices(threads);
+            for(auto & obj : random.scene.objects) CHECK(HasCurrentMatrices(*obj));
+        }
+    }
+}
+
+TEST(ObjectMatricesStartInvalid)
+{
+    RandomScene random(50, 20, 6);
+    auto & scene = random.scene;
+    CHECK(scene.UpdateMatrices() == scene.objects.size());
+    for(auto & obj : scene.objects) CHECK(obj->matricesValid);
+
+    // Copies and loaded objects compute their own matrices, rather than trusting those of their source
+    auto & original = *scene.objects[0];
+    Object copy(original);
+    CHECK(!copy.matricesValid);
+    copy.pose.position += float3(1,2,3);
+    CHECK(HasCurrentMatrices(copy));
+    auto duplicate = scene.DuplicateObject(original);
+    CHECK(!duplicate->matricesValid && HasCurrentMatrices(*duplicate));
+
+    // Saved and loaded as the editor does
+    std::ostringstream out;
+    {
+        JsonWriter writer(out);
+        SerializeToJson(writer, scene);
+    }
+    auto text = out.str();
+    JsonReader reader(text.data(), text.data() + text.size());
+    auto loaded = DeserializeFromJson<Scene>(reader, random.assets);
+    CHECK(loaded.objects.size() == scene.objects.size());
+    for(auto & obj : loaded.objects) CHECK(!obj->matricesValid);
+    CHECK(loaded.UpdateMatrices() == loaded.objects.size());
+    for(auto & obj : loaded.objects) CHECK(HasCurrentMatrices(*obj));
+}
+
+TEST(SceneUpdateMatricesOnlyMoved)
+{
+    RandomScene random(1000, 20, 7);
+    auto & scene = random.scene;
+    ThreadPool pool(4);
+    ThreadPool * pools[] = {nullptr, &pool};
+    for(auto threads : pools)
+    {
+        scene.UpdateMatrices(threads);
+        CHECK(scene.UpdateMatrices(threads) == 0);
+
+        // Mark the cached matrices of every object, then move some. Only the moved objects may lose the mark.
+        const float4x4 mark = {{1,2,3,4}, {5,6,7,8}, {9,10,11,12}, {13,14,15,16}};
+        for(auto & obj : scene.objects) obj->modelMatrix = obj->normalMatrix = mark;
+        std::vector<uint8_t> moved(scene.objects.size());
+        for(int i=0; i<100; ++i)
+        {
+            auto index = random.engine() % scene.objects.size();
+            scene.objects[index]->pose.position = random.RandomPoint();
+            scene.objects[index]->InvalidateMatrices();
+            moved[index] = 1;
+        }
+        CHECK(scene.UpdateMatrices(threads) == static_cast<size_t>(std::count(begin(moved), end(moved), 1)));
+        for(size_t i=0; i<scene.objects.size(); ++i)
+        {
+            auto & obj = *scene.objects[i];
+            if(moved[i]) CHECK(HasCurrentMatrices(obj));
+            else CHECK(memcmp(&obj.modelMatrix, &mark, sizeof(mark)) == 0 && memcmp(&obj.normalMatrix, &mark, sizeof(mark)) == 0);
+        }
+        for(auto & obj : scene.objects) obj->InvalidateMatrices();
+    }
+}
+
+TEST(SceneCountsCulledObjects)
+{
+    // A camera at the origin looking down -z, and unit boxes around it. A shader without uniform blocks lets the scene write and draw a frame
+    // without GL, with the draws recorded.
+    AssetLibrary assets;
+    Mesh box;
+    box.AddBox({-1,-1,-1}, {1,1,1});
+    auto mesh = AddMesh(assets, "box", std::move(box)), empty = AddMesh(assets, "empty", Mesh());
+    ProgramHandle prog = assets.AddAsset("shader", Shader(gl::Program()));
+    Scene scene;
+    scene.CreateObject("ahead", {0,0,-10}, {1,1,1}, mesh, prog, {1,1,1});
+    scene.CreateObject("around", {0,0,0}, {1,1,1}, mesh, prog, {1,1,1});    // Straddles the near plane
+    auto behind = scene.CreateObject("behind", {0,0,10}, {1,1,1}, mesh, prog, {1,1,1});
+    scene.CreateObject("aside", {-100,0,-10}, {1,1,1}, mesh, prog, {1,1,1});
+    scene.CreateObject("beyond", {0,0,-200}, {1,1,1}, mesh, prog, {1,1,1});
+    scene.CreateObject("empty", {0,0,-10}, {1,1,1}, empty, prog, {1,1,1}); // Hidden without being tested
+    scene.CreateObject("unshaded", {0,0,-10}, {1,1,1}, mesh, {}, {1,1,1}); // Neither tested nor drawn
+
+    RenderContext ctx;
+    ctx.frustum = Frustum::FromMatrix(mul(PerspectiveMatrixRhGl(1, 1, 0.1f, 100), LookAtMatrixRh({0,0,0}, {0,0,-1}, {0,1,0})));
+    auto drawFrame = [&]()
+    {
+        scene.WriteUniforms(ctx);
+        RecordingRenderBackend backend;
+        scene.Draw(ctx, backend);
+        size_t draws = 0;
+        for(auto & command : backend.commands) if(command.type == RecordingRenderBackend::Type::Draw) ++draws;
+        CHECK(draws == ctx.counters.drawn);
+    };
+    drawFrame();
+    CHECK(ctx.counters.tested == 5 && ctx.counters.culled == 3 && ctx.counters.drawn == 2);
+
+    behind->pose.position = {0,0,-20};
+    behind->InvalidateMatrices();
+    drawFrame();
+    CHECK(ctx.counters.tested == 5 && ctx.counters.culled == 2 && ctx.counters.drawn == 3);
+
+    // Without planes, nothing is tested, and every object with a mesh and a shader is drawn
+    ctx.frustum = Frustum();
+    drawFrame();
+    CHECK(ctx.counters.tested == 0 && ctx.counters.culled == 0 && ctx.counters.drawn == 6);
+}
+
+BENCHMARK(SceneHit)
+{
+    RandomScene random(100000, 400, 2);
+    auto & scene = random.scene;
+    std::vector<Ray> rays;
+    for(int i=0; i<2000; ++i) rays.push_back(random.RandomRay());
+    std::vector<Object *> moved; // Objects in the hierarchy, since moving any other marks it for a rebuild
+    while(moved.size() < 10000)
+    {
+        auto obj = scene.objects[random.engine() % scene.objects.size()].get();
+        if(obj->mesh && !obj->mesh->triangles.empty()) moved.push_back(obj);
+    }
+
+    size_t sink = 0;
+    auto build = MeasureMilliseconds(3, [&]() { scene.RebuildBvh(); });
+    auto linear = MeasureMilliseconds(1, [&]() { for(auto & ray : rays) sink += !!HitEveryObject(scene, ray); });
+    auto bvh = MeasureMilliseconds(3, [&]() { for(auto & ray : rays) sink += !!scene.Hit(ray); });
+    auto refit = MeasureMilliseconds(3, [&]() { for(auto obj : moved) { obj->pose.position.x += 0.01f; scene.UpdateObjectBounds(*obj); } });
+    CHECK(!scene.bvhDirty);
+    printf("  %d objects: build %.1f ms, every object %.1f us/ray, hierarchy %.2f us/ray, refit %.2f us/update (%d)\n", static_cast<int>(scene.objects.size()),
+        build, linear * 1000 / rays.size(), bvh * 1000 / rays.size(), refit * 1000 / moved.size(), static_cast<int>(sink % 10));
+}
+
+BENCHMARK(SceneSelect)
+{
+    RandomScene random(100000, 400, 5);
+    std::vector<Frustum> frusta;
+    for(int i=0; i<40; ++i) frusta.push_back(random.RandomFrustum());
+    random.scene.Select(frusta[0]); // Builds the hierarchies
+
+    size_t sink = 0;
+    auto select = MeasureMilliseconds(3, [&]() { for(auto & frustum : frusta) sink += random.scene.Select(frustum).size(); });
+    auto every = MeasureMilliseconds(1, [&]() { for(auto & frustum : frusta) for(auto & obj : random.scene.objects) sink += ContainsEveryVertex(frustum, *obj) == 1; });
+    printf("  %d objects: select %.2f ms/frustum, every vertex %.2f ms/frustum (%d)\n", static_cast<int>(random.scene.objects.size()),
+        select / frusta.size(), every / frusta.size(), static_cast<int>(sink % 10));
+}
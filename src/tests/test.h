@@ -0,0 +1,49 @@
+#ifndef TESTS_TEST_H
+#define TESTS_TEST_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Tests compare the engine's results against a reference, and report mismatches through CHECK. Benchmarks print their measurements, and only
+// run when --bench is given, or when named on the command line. Both register themselves with the runner in main.cpp.
+struct TestCase { const char * name; void (*run)(); bool isBenchmark; };
+std::vector<TestCase> & GetTestCases();
+struct TestRegistration { TestRegistration(const char * name, void (*run)(), bool isBenchmark) { GetTestCases().push_back({name, run, isBenchmark}); } };
+
+#define TEST(NAME) static void NAME(); static TestRegistration NAME##Registration(#NAME, NAME, false); static void NAME()
+#define BENCHMARK(NAME) static void NAME(); static TestRegistration NAME##Registration(#NAME, NAME, true); static void NAME()
+
+void ReportFailure(const char * file, int line, const char * condition);
+#define CHECK(CONDITION) ((CONDITION) ? (void)0 : ReportFailure(__FILE__, __LINE__, #CONDITION))
+
+// Counts of the heap use of the process, kept by the replacements of operator new and delete in main.cpp
+struct HeapCounters { size_t allocations, bytes, peakBytes; };
+HeapCounters GetHeapCounters();
+void ResetPeakHeapBytes();          // Sets the peak to the bytes currently allocated
+
+// Returns the time of the fastest of several calls to f, in milliseconds
+template<class F> double MeasureMilliseconds(int runs, F f)
+{
+    double best = 1e30;
+    for(int i=0; i<runs; ++i)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+    }
+    return best;
+}
+
+// Writes a file which is deleted when this goes out of scope
+struct TempFile
+{
+    std::string path;
+    TempFile(const std::string & path, const std::string & contents) : path(path) { std::ofstream(path, std::ios::binary) << contents; }
+    ~TempFile() { remove(path.c_str()); }
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "test.h"
+#include "engine/simd.h"
+#include "engine/transform.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+
+// Transforms of the form objects have, with orientations of any length, as ScaledNormalMatrix must handle unnormalized quaternions
+struct Transforms
+{
+    std::vector<float3> scales, positions;
+    std::vector<float4> orientations;
+
+    Transforms(size_t count, uint32_t seed)
+    {
+        std::mt19937 engine(seed);
+        std::uniform_real_distribution<float> coord(-100, 100), unit(-1, 1), scale(0.1f, 10);
+        for(size_t i=0; i<count; ++i)
+        {
+            scales.push_back({scale(engine), scale(engine), scale(engine)});
+            orientations.push_back(float4(unit(engine), unit(engine), unit(engine), unit(engine)) * (i % 4 ? 1.0f : 1 / std::sqrt(2.0f)));
+            positions.push_back({coord(engine), coord(engine), coord(engine)});
+        }
+    }
+};
+
+TEST(ScaledTransformationMatricesMatchScalar)
+{
+    // Counts around multiples of the width, so that every split between lanes and the scalar tail is covered
+    for(size_t count=0; count<40; ++count)
+    {
+        Transforms transforms(count, static_cast<uint32_t>(count));
+        std::vector<float4x4> models(count), normals(count);
+        ComputeScaledTransformationMatrices(count, transforms.scales.data(), transforms.orientations.data(), transforms.positions.data(), models.data(), normals.data());
+        for(size_t i=0; i<count; ++i)
+        {
+            auto model = ScaledTransformationMatrix(transforms.scales[i], transforms.orientations[i], transforms.positions[i]);
+            auto normal = ScaledNormalMatrix(transforms.scales[i], transforms.orientations[i], transforms.positions[i]);
+            CHECK(memcmp(&models[i], &model, sizeof(model)) == 0);
+            CHECK(memcmp(&normals[i], &normal, sizeof(normal)) == 0);
+        }
+    }
+
+    Transforms transforms(100000, 40);
+    std::vector<float4x4> models(100000), normals(100000);
+    ComputeScaledTransformationMatrices(100000, transforms.scales.data(), transforms.orientations.data(), transforms.positions.data(), models.data(), normals.data());
+    for(size_t i=0; i<100000; ++i)
+    {
+        auto model = ScaledTransformationMatrix(transforms.scales[i], transforms.orientations[i], transforms.positions[i]);
+        auto normal = ScaledNormalMatrix(transforms.scales[i], transforms.orientations[i], transforms.positions[i]);
+        CHECK(memcmp(&models[i], &model, sizeof(model)) == 0);
+        CHECK(memcmp(&normals[i], &normal, sizeof(normal)) == 0);
+    }
+}
+
+TEST(ScaledNormalMatrixMatchesInverse)
+{
+    // Against the inverse transpose of the model matrix, computed in double precision
+    Transforms transforms(100000, 41);
+    double worst = 0;
+    for(size_t i=0; i<100000; ++i)
+    {
+        auto model = ScaledTransformationMatrix(transforms.scales[i], transforms.orientations[i], transforms.positions[i]);
+        auto normal = ScaledNormalMatrix(transforms.scales[i], transforms.orientations[i], transforms.positions[i]);
+        double4x4 d;
+        for(int j=0; j<4; ++j) for(int k=0; k<4; ++k) d[j][k] = model[j][k];
+        auto exact = inv(transpose(d));
+        double largest = 0, error = 0;
+        for(int j=0; j<4; ++j) for(int k=0; k<4; ++k)
+        {
+            largest = std::max(largest, std::abs(exact[j][k]));
+            error = std::max(error, std::abs(normal[j][k] - exact[j][k]));
+        }
+        worst = std::max(worst, error / largest);
+    }
+    CHECK(worst < 1e-5);
+}
+
+BENCHMARK(ScaledTransformationMatrices)
+{
+    enum { Count = 100000 };
+    Transforms transforms(Count, 42);
+    std::vector<float4x4> models(Count), normals(Count);
+    auto & s = transforms.scales; auto & q = transforms.orientations; auto & p = transforms.positions;
+    auto inverse = MeasureMilliseconds(10, [&]()
+    {
+        for(size_t i=0; i<Count; ++i)
+        {
+            models[i] = ScaledTransformationMatrix(s[i], q[i], p[i]);
+            normals[i] = inv(transpose(models[i]));
+        }
+    });
+    auto scalar = MeasureMilliseconds(10, [&]()
+    {
+        for(size_t i=0; i<Count; ++i)
+        {
+            models[i] = ScaledTransformationMatrix(s[i], q[i], p[i]);
+            normals[i] = ScaledNormalMatrix(s[i], q[i], p[i]);
+        }
+    });
+    auto batch = MeasureMilliseconds(10, [&]() { ComputeScaledTransformationMatrices(Count, s.data(), q.data(), p.data(), models.data(), normals.data()); });
+    printf("  100k objects, model and normal matrices, %d lanes\n", static_cast<int>(simd::floatv::Width));
+    printf("  inv(transpose(model)):  %6.2f ms\n", inverse);
+    printf("  ScaledNormalMatrix:     %6.2f ms\n", scalar);
+    printf("  batched:                %6.2f ms\n", batch);
+}